@@ -0,0 +1,351 @@
+#ifndef ASTUTIL_HPP
+#define ASTUTIL_HPP
+
+#include "ast.h"
+#include "symtab.h"
+#include "primitive.h"
+#include "attribute.h"
+#include <stdio.h>
+#include <string.h>
+#include <typeinfo>
+#include <algorithm>
+
+using namespace std;
+
+/*
+ * Helpers for the passes that rewrite the AST after typecheck.
+ *
+ * Nodes built here carry everything the later passes expect from a parsed and
+ * typechecked node: the scope, the line number and the basetype. The generated
+ * constructors stamp nodes with the lexer's current line, which is meaningless
+ * after parsing, so we always take those from the node being replaced.
+ */
+
+// SymName owns its spelling and deletes it, so every new SymName needs its own copy
+inline char* copy_spelling(const char* s)
+{
+    char* copy = new char[strlen(s) + 1];
+    strcpy(copy, s);
+    return copy;
+}
+
+// Make "to" look like it was typechecked in the same place as "from"
+inline void copy_attribute(Visitable* to, Visitable* from)
+{
+    to->m_attribute.m_scope = from->m_attribute.m_scope;
+    to->m_attribute.lineno = from->m_attribute.lineno;
+    to->m_parent_attribute = from->m_parent_attribute;
+}
+
+// Is e an IntLit or BoolLit? If so, and value isn't NULL, *value is its value
+inline bool is_literal(Expr* e, int* value = NULL)
+{
+    Primitive* prim;
+    if (IntLit* i = dynamic_cast<IntLit*>(e))
+        prim = i->m_primitive;
+    else if (BoolLit* b = dynamic_cast<BoolLit*>(e))
+        prim = b->m_primitive;
+    else
+        return false;
+    if (value != NULL)
+        *value = prim->m_data;
+    return true;
+}
+
+// An IntLit or BoolLit (depending on type) holding value, standing in for "like"
+inline Expr* make_literal(Basetype type, int value, Visitable* like)
+{
+    Expr* e;
+    if (type == bt_boolean)
+        e = new BoolLit(new Primitive(value));
+    else
+        e = new IntLit(new Primitive(value));
+    copy_attribute(e, like);
+    e->m_attribute.m_basetype = type;
+    e->m_attribute.m_lattice_elem = value;
+    return e;
+}
+
+// The operands of e, as pointers to the fields holding them so they can be replaced as well as read.
+// Returns how many there are: 2 for the binary operators, 1 for Not, Uminus, Magnitude and
+// ArrayAccess (its index), and 0 for Ident and the literals.
+inline int expr_operands(Expr* e, Expr** ops[2])
+{
+#define ASTUTIL_BINARY(T) \
+    if (T* b = dynamic_cast<T*>(e)) { ops[0] = &b->m_expr_1; ops[1] = &b->m_expr_2; return 2; }
+#define ASTUTIL_UNARY(T) \
+    if (T* u = dynamic_cast<T*>(e)) { ops[0] = &u->m_expr; return 1; }
+    ASTUTIL_BINARY(Plus) ASTUTIL_BINARY(Minus) ASTUTIL_BINARY(Times) ASTUTIL_BINARY(Div)
+    ASTUTIL_BINARY(And) ASTUTIL_BINARY(Or)
+    ASTUTIL_BINARY(Compare) ASTUTIL_BINARY(Noteq)
+    ASTUTIL_BINARY(Lt) ASTUTIL_BINARY(Lteq) ASTUTIL_BINARY(Gt) ASTUTIL_BINARY(Gteq)
+    ASTUTIL_UNARY(Not) ASTUTIL_UNARY(Uminus) ASTUTIL_UNARY(Magnitude) ASTUTIL_UNARY(ArrayAccess)
+#undef ASTUTIL_BINARY
+#undef ASTUTIL_UNARY
+    return 0;
+}
+
+// The operators of the binary expressions, one per node type
+enum BinaryOp {
+    op_none,    // not a binary expression
+    op_plus, op_minus, op_times, op_div,
+    op_and, op_or,
+    op_eq, op_ne, op_lt, op_le, op_gt, op_ge
+};
+
+// The operator of e, or op_none if e isn't a binary expression
+inline BinaryOp binary_op(Expr* e)
+{
+    if (dynamic_cast<Plus*>(e)) return op_plus;
+    if (dynamic_cast<Minus*>(e)) return op_minus;
+    if (dynamic_cast<Times*>(e)) return op_times;
+    if (dynamic_cast<Div*>(e)) return op_div;
+    if (dynamic_cast<And*>(e)) return op_and;
+    if (dynamic_cast<Or*>(e)) return op_or;
+    if (dynamic_cast<Compare*>(e)) return op_eq;
+    if (dynamic_cast<Noteq*>(e)) return op_ne;
+    if (dynamic_cast<Lt*>(e)) return op_lt;
+    if (dynamic_cast<Lteq*>(e)) return op_le;
+    if (dynamic_cast<Gt*>(e)) return op_gt;
+    if (dynamic_cast<Gteq*>(e)) return op_ge;
+    return op_none;
+}
+
+// Is op one of ==, !=, <, <=, > and >=?
+inline bool is_comparison(BinaryOp op)
+{
+    return op == op_eq || op == op_ne || op == op_lt || op == op_le || op == op_gt || op == op_ge;
+}
+
+// !(a op b) is the same as a negate_op(op) b. op_none for an operator that isn't a comparison.
+inline BinaryOp negate_op(BinaryOp op)
+{
+    switch (op) {
+        case op_eq: return op_ne;
+        case op_ne: return op_eq;
+        case op_lt: return op_ge;
+        case op_le: return op_gt;
+        case op_gt: return op_le;
+        case op_ge: return op_lt;
+        default: return op_none;
+    }
+}
+
+// a op b is the same as b mirror_op(op) a. Operators other than <, <=, > and >= are their own
+// mirror, though only the commutative ones (all but - and /) are really the same swapped.
+inline BinaryOp mirror_op(BinaryOp op)
+{
+    switch (op) {
+        case op_lt: return op_gt;
+        case op_le: return op_ge;
+        case op_gt: return op_lt;
+        case op_ge: return op_le;
+        default: return op;
+    }
+}
+
+// How op is written in the source
+inline const char* op_spelling(BinaryOp op)
+{
+    switch (op) {
+        case op_plus: return "+";
+        case op_minus: return "-";
+        case op_times: return "*";
+        case op_div: return "/";
+        case op_and: return "&&";
+        case op_or: return "||";
+        case op_eq: return "==";
+        case op_ne: return "!=";
+        case op_lt: return "<";
+        case op_le: return "<=";
+        case op_gt: return ">";
+        case op_ge: return ">=";
+        default: return "?";
+    }
+}
+
+// A new binary expression "e1 op e2" standing in for "like"
+inline Expr* make_binary(BinaryOp op, Expr* e1, Expr* e2, Expr* like)
+{
+    Expr* e;
+    Basetype type = bt_boolean;
+    switch (op) {
+        case op_plus: e = new Plus(e1, e2); type = bt_integer; break;
+        case op_minus: e = new Minus(e1, e2); type = bt_integer; break;
+        case op_times: e = new Times(e1, e2); type = bt_integer; break;
+        case op_div: e = new Div(e1, e2); type = bt_integer; break;
+        case op_and: e = new And(e1, e2); break;
+        case op_or: e = new Or(e1, e2); break;
+        case op_eq: e = new Compare(e1, e2); break;
+        case op_ne: e = new Noteq(e1, e2); break;
+        case op_lt: e = new Lt(e1, e2); break;
+        case op_le: e = new Lteq(e1, e2); break;
+        case op_gt: e = new Gt(e1, e2); break;
+        case op_ge: e = new Gteq(e1, e2); break;
+        default: return NULL;
+    }
+    copy_attribute(e, like);
+    e->m_attribute.m_basetype = type;
+    e->m_attribute.m_lattice_elem = TOP;
+    return e;
+}
+
+// Do a and b compute the same value? Expressions have no side effects, so this is structural
+// equality. Variables are compared by name, so both must come from the same function.
+inline bool expr_equal(Expr* a, Expr* b)
+{
+    if (typeid(*a) != typeid(*b))
+        return false;
+    int va, vb;
+    if (is_literal(a, &va)) {
+        is_literal(b, &vb);
+        return va == vb;
+    }
+    if (Ident* ia = dynamic_cast<Ident*>(a))
+        return strcmp(ia->m_symname->spelling(), ((Ident*) b)->m_symname->spelling()) == 0;
+    if (ArrayAccess* aa = dynamic_cast<ArrayAccess*>(a))
+        if (strcmp(aa->m_symname->spelling(), ((ArrayAccess*) b)->m_symname->spelling()) != 0)
+            return false;
+    Expr** ops_a[2];
+    Expr** ops_b[2];
+    int n = expr_operands(a, ops_a);
+    expr_operands(b, ops_b);
+    for (int i = 0; i < n; i++)
+        if (!expr_equal(*ops_a[i], *ops_b[i]))
+            return false;
+    return true;
+}
+
+// With --bounds-check, could indexing array with index (at the scope of p) trap? Only a literal
+// index within the array's length is known not to.
+inline bool index_may_trap(Visitable* p, SymName* array, Expr* index, SymTab* st)
+{
+    Symbol* s = st->lookup(p->m_attribute.m_scope, array->spelling());
+    int value;
+    return s == NULL || !is_literal(index, &value) || value < 0 || value >= s->arr_length;
+}
+
+// Could evaluating e trap? A division can: by 0, or INT_MIN by -1. With bounds_check
+// (--bounds-check) so can an array access, unless its index is a literal within the array, whose
+// length is looked up in st. Every pass that drops or moves an expression has to keep those where
+// they are.
+inline bool may_trap(Expr* e, SymTab* st, bool bounds_check)
+{
+    Expr** ops[2];
+    int n = expr_operands(e, ops);
+    if (dynamic_cast<Div*>(e)) {
+        int divisor;
+        if (!is_literal(*ops[1], &divisor) || divisor == 0 || divisor == -1)
+            return true;
+    }
+    if (ArrayAccess* a = dynamic_cast<ArrayAccess*>(e))
+        if (bounds_check && index_may_trap(a, a->m_symname, a->m_expr, st))
+            return true;
+    for (int i = 0; i < n; i++)
+        if (may_trap(*ops[i], st, bounds_check))
+            return true;
+    return false;
+}
+
+// Could the store a[i] = e trap? As for an expression, and with bounds_check the store itself is
+// checked too. A pass that drops a dead store has to keep it if so.
+inline bool may_trap(ArrayAssignment* p, SymTab* st, bool bounds_check)
+{
+    if (bounds_check && index_may_trap(p, p->m_symname, p->m_expr_1, st))
+        return true;
+    return may_trap(p->m_expr_1, st, bounds_check) || may_trap(p->m_expr_2, st, bounds_check);
+}
+
+// Number of nodes in the expression tree e
+inline int expr_size(Expr* e)
+{
+    Expr** ops[2];
+    int n = expr_operands(e, ops);
+    int size = 1;
+    for (int i = 0; i < n; i++)
+        size += expr_size(*ops[i]);
+    return size;
+}
+
+// Sethi-Ullman number of e: how many values evaluating it keeps at once when literals and variables
+// are used in place and each operator's result takes one. For a binary operator that is the larger
+// of its operands' numbers, or one more if they are equal, since the operand evaluated first is
+// held while the other is.
+inline int expr_registers(Expr* e)
+{
+    Expr** ops[2];
+    int n = expr_operands(e, ops);
+    if (n == 0)
+        return 0;
+    int need = expr_registers(*ops[0]);
+    if (n == 2) {
+        int right = expr_registers(*ops[1]);
+        need = need == right ? need + 1 : max(need, right);
+    }
+    return max(need, 1);
+}
+
+// The generated copy constructors only copy the children, so give every node of the copy the
+// attributes of the node it was copied from
+inline void copy_attributes_deep(Expr* to, Expr* from)
+{
+    to->m_attribute = from->m_attribute;
+    Expr** ops_to[2];
+    Expr** ops_from[2];
+    int n = expr_operands(to, ops_to);
+    expr_operands(from, ops_from);
+    for (int i = 0; i < n; i++) {
+        copy_attributes_deep(*ops_to[i], *ops_from[i]);
+        (*ops_to[i])->m_parent_attribute = &to->m_attribute;
+    }
+}
+
+// A copy of e, typechecked like e. Whoever attaches it sets its m_parent_attribute.
+inline Expr* copy_expr(Expr* e)
+{
+    Expr* copy = e->clone();
+    copy_attributes_deep(copy, e);
+    copy->m_parent_attribute = NULL;
+    return copy;
+}
+
+// Temporaries made by the optimizer are named "_tN", which the lexer never produces
+inline bool is_temporary(const char* name)
+{
+    return name[0] == '_';
+}
+
+// Does e use a temporary? Such an expression has no counterpart in the source.
+inline bool uses_temporary(Expr* e)
+{
+    if (Ident* id = dynamic_cast<Ident*>(e))
+        return is_temporary(id->m_symname->spelling());
+    if (ArrayAccess* a = dynamic_cast<ArrayAccess*>(e))
+        if (is_temporary(a->m_symname->spelling()))
+            return true;
+    Expr** ops[2];
+    int n = expr_operands(e, ops);
+    for (int i = 0; i < n; i++)
+        if (uses_temporary(*ops[i]))
+            return true;
+    return false;
+}
+
+// Add a new temporary of the given type (and length, for an intarray) to scope (the scope of a
+// function) and return its name, which stays owned by the symbol table
+inline const char* new_temporary(SymTab* st, SymScope* scope, Basetype type, int arr_length = -1)
+{
+    char name[32];
+    int n = 0;
+    do {
+        sprintf(name, "_t%d", n++);
+    } while (st->lookup_single(scope, name) != NULL);
+    char* key = strdup(name);
+    Symbol* s = new Symbol();
+    s->m_basetype = type;
+    s->arr_length = arr_length;
+    st->insert_in_scope(scope, key, s);
+    return key;
+}
+
+#endif //ASTUTIL_HPP
@@ -29,31 +29,35 @@ class LatticeElem
 {
   public:
     int value;
+    int why; // for TOP, what made it TOP, as an index into ConstantFolding's causes (0 if unknown).
+             // Only used for remarks; comparisons ignore it.
 
-    LatticeElem(const int &value = BOTTOM) : value(value) {}
-    LatticeElem(const LatticeElem &other) : value(other.value) {}
+    LatticeElem(const int &value = BOTTOM) : value(value), why(0) {}
+    LatticeElem(const LatticeElem &other) : value(other.value), why(other.why) {}
 
-    LatticeElem* clone() const { return new LatticeElem(this->value); }
+    LatticeElem* clone() const { return new LatticeElem(*this); }
 
     bool operator == (const int &other) const { return other == this->value; }
     bool operator == (const LatticeElem &other) const { return other.value == this->value; }
     bool operator != (const int &other) const { return other != this->value; }
     bool operator != (const LatticeElem &other) const { return other.value != this->value; }
 
-    LatticeElem& operator = (const LatticeElem &other) { this->value = other.value; return *this; }
-    LatticeElem& operator = (const int &value) { this->value = value; return *this; }
+    LatticeElem& operator = (const LatticeElem &other) { this->value = other.value; this->why = other.why; return *this; }
+    LatticeElem& operator = (const int &value) { this->value = value; this->why = 0; return *this; }
 
     // Joins two lattice elements. The result is stored in the first element!
     void join (const LatticeElem &other)
     {
-      if (other.value == TOP)
-        this->value = TOP;
+      if (this->value == TOP)
+        ; // keep our reason
+      else if (other.value == TOP)
+        *this = other;
       else if (this->value == BOTTOM)
 	this->value = other.value;
       else if (other.value == BOTTOM)
 	; // don't do anything
       else if (this->value != other.value)
-        this->value = TOP;
+        *this = TOP; // the caller knows why
     }
 
     const char* to_string(char* buffer) const
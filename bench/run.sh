@@ -0,0 +1,66 @@
+#!/bin/bash
+# Time each benchmark program with and without --memoize.
+#
+# Every bench/*.simple starts with a comment holding a line
+#     expect: STATUS
+# the status Main exits with (what it returns, modulo 256), which both builds must produce. Each
+# build is run three times and the best wall-clock time is reported. The programs are 32-bit x86
+# and run without libc, linked with tests/start.s, so this needs as and ld that can target i386.
+#
+# usage: bench/run.sh [COMPILER [PROGRAM...]]     (default ./simple and every program)
+
+SIMPLE=${1:-./simple}
+[ $# -gt 0 ] && shift
+DIR=$(dirname "$0")
+TMP=${TMPDIR:-/tmp}/simple-bench.$$
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+as --32 -o "$TMP/start.o" "$DIR/../tests/start.s" || exit 1
+
+# build PROGRAM OPTIONS...: compile and link PROGRAM into $TMP/prog
+build() {
+	local program=$1
+	shift
+	"$SIMPLE" "$@" < "$program" > "$TMP/prog.s" &&
+	as --32 -o "$TMP/prog.o" "$TMP/prog.s" &&
+	ld -m elf_i386 -o "$TMP/prog" "$TMP/start.o" "$TMP/prog.o"
+}
+
+# best EXPECTED: the best of three runs of $TMP/prog in seconds, or a message if it exits wrongly
+best() {
+	local best= run status seconds
+	TIMEFORMAT=%R
+	for run in 1 2 3; do
+		seconds=$( { time "$TMP/prog" > /dev/null 2>&1; echo "status $?" >&2; } 2>&1 )
+		status=$(echo "$seconds" | sed -n 's/^status //p')
+		seconds=$(echo "$seconds" | grep -v '^status')
+		if [ "$status" != "$1" ]; then
+			echo "exited with $status, expected $1"
+			return 1
+		fi
+		if [ -z "$best" ] || awk "BEGIN { exit !($seconds < $best) }"; then
+			best=$seconds
+		fi
+	done
+	echo "${best}s"
+}
+
+[ $# -eq 0 ] && set -- "$DIR"/*.simple
+failed=0
+printf '%-24s %12s %12s\n' program plain --memoize
+for program in "$@"; do
+	expected=$(sed -n 's/ *\$\].*//; s/^.*expect: *\([0-9][0-9]*\).*$/\1/p' "$program")
+	printf '%-24s' "$(basename "$program" .simple)"
+	for options in "" "--memoize"; do
+		if ! build "$program" $options 2> "$TMP/err"; then
+			result="build failed: $(head -1 "$TMP/err")"
+			failed=1
+		elif ! result=$(best "$expected"); then
+			failed=1
+		fi
+		printf ' %12s' "$result"
+	done
+	echo
+done
+exit $failed
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Count the instructions each program compiles to with and without a pass, from the
+# "codegen: N instructions" line of --stats (labels and directives aren't counted).
+#
+# usage: bench/size.sh PASS [COMPILER [PROGRAM...]]
+#     (default ./simple, and every program in tests/ and bench/)
+# e.g. bench/size.sh dse
+
+if [ $# -eq 0 ]; then
+	echo "usage: $0 PASS [COMPILER [PROGRAM...]]" >&2
+	exit 2
+fi
+PASS=$1
+shift
+SIMPLE=${1:-./simple}
+[ $# -gt 0 ] && shift
+DIR=$(dirname "$0")
+
+# count OPTIONS... < PROGRAM: the instructions it compiles to
+count() {
+	"$SIMPLE" --stats "$@" 2>&1 > /dev/null | sed -n 's/^codegen: \([0-9]*\) instructions$/\1/p'
+}
+
+[ $# -eq 0 ] && set -- "$DIR"/../tests/*.simple "$DIR"/*.simple
+total_without=0
+total_with=0
+printf '%-24s %10s %10s\n' program "no $PASS" "$PASS"
+for program in "$@"; do
+	without=$(count --disable="$PASS" < "$program")
+	with=$(count < "$program")
+	if [ -z "$without" ] || [ -z "$with" ]; then
+		echo "$program: doesn't compile" >&2
+		exit 1
+	fi
+	printf '%-24s %10d %10d\n' "$(basename "$program" .simple)" "$without" "$with"
+	total_without=$((total_without + without))
+	total_with=$((total_with + with))
+done
+printf '%-24s %10d %10d\n' total "$total_without" "$total_with"
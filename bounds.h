@@ -0,0 +1,420 @@
+#ifndef BOUNDS_HPP
+#define BOUNDS_HPP
+
+#include "ast.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "effects.h"
+#include "budget.h"
+#include <stdio.h>
+#include <limits.h>
+#include <algorithm>
+#include <map>
+#include <set>
+
+using namespace std;
+
+/*
+ * Range analysis for --bounds-check: finds the array indexes that are always in bounds, so
+ * codegen only checks the others.
+ *
+ * Walking each function in order, we keep an interval for the int variables whose value is
+ * bounded; a variable not in the map may hold anything. Assignments evaluate their right hand
+ * side over the intervals, calls forget what they may write (their mod summaries), and the
+ * conditions of Ifs and Whiles narrow the intervals in the branch or body they guard:
+ *     i = 0; while (i < 10) { a[i] = 0; i = i + 1; }
+ * gives i = [0, 0] on entry, and at the head of the loop the join of that with [1, 1], then
+ * [0, 2], ... which is widened to [0, +inf) after a few rounds; in the body, i < 10 makes that
+ * [0, 9], so a[i] is in bounds for an array of length 10. Statements are only marked once the
+ * loop head is stable.
+ *
+ * An index that may overflow is unbounded, and expressions other than +, -, *, division by a
+ * positive literal, unary minus and magnitude are too. Literal indexes are left to codegen,
+ * which knows them at compile time anyway.
+ */
+
+class BoundsAnalysis : public Visitor {
+    private:
+        struct Range
+        {
+            long long m_lo, m_hi;
+        };
+        typedef map<Symbol*, Range> State;
+
+        SideEffects m_effects;
+        set<Visitable*> m_in_bounds;
+        bool m_marking;                 // false while a loop head isn't stable yet
+        Budget m_budget;                // rounds of loops, charged by the size of the loop body
+
+        static const int precise_rounds = 3;    // rounds of a loop before widening
+
+        // statistics
+        int m_checks;
+        int m_removed;
+
+        static Range full()
+        {
+            Range r = { INT_MIN, INT_MAX };
+            return r;
+        }
+
+        static Range make_range(long long lo, long long hi)
+        {
+            if(lo < INT_MIN || hi > INT_MAX)
+                return full();
+            Range r = { lo, hi };
+            return r;
+        }
+
+        static bool is_full(const Range& r)
+        {
+            return r.m_lo <= INT_MIN && r.m_hi >= INT_MAX;
+        }
+
+        Symbol* int_var(Visitable* p, SymName* name)
+        {
+            Symbol* s = m_effects.lookup(p, name);
+            return s != NULL && s->m_basetype == bt_integer ? s : NULL;
+        }
+
+        static void set_range(State& st, Symbol* s, Range r)
+        {
+            if(s == NULL)
+                return;
+            if(is_full(r))
+                st.erase(s);
+            else
+                st[s] = r;
+        }
+
+        Range range(Expr* e, State& st)
+        {
+            int value;
+            if(is_literal(e, &value) && dynamic_cast<IntLit*>(e) != NULL)
+                return make_range(value, value);
+            if(Ident* id = dynamic_cast<Ident*>(e)){
+                State::iterator iter = st.find(int_var(id, id->m_symname));
+                return iter == st.end() ? full() : iter->second;
+            }
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            if(n == 1 && dynamic_cast<Uminus*>(e) != NULL){
+                Range a = range(*ops[0], st);
+                return make_range(-a.m_hi, -a.m_lo);
+            }
+            if(n == 1 && dynamic_cast<Magnitude*>(e) != NULL){
+                Range a = range(*ops[0], st);
+                if(a.m_lo >= 0)
+                    return a;
+                if(a.m_hi <= 0)
+                    return make_range(-a.m_hi, -a.m_lo);
+                return make_range(0, max(-a.m_lo, a.m_hi));
+            }
+            if(n != 2)
+                return full();
+            Range a = range(*ops[0], st);
+            Range b = range(*ops[1], st);
+            switch(binary_op(e)){
+                case op_plus:
+                    return make_range(a.m_lo + b.m_lo, a.m_hi + b.m_hi);
+                case op_minus:
+                    return make_range(a.m_lo - b.m_hi, a.m_hi - b.m_lo);
+                case op_times: {
+                    if(is_full(a) || is_full(b))
+                        return full();
+                    long long p[4] = { a.m_lo * b.m_lo, a.m_lo * b.m_hi, a.m_hi * b.m_lo, a.m_hi * b.m_hi };
+                    return make_range(*min_element(p, p + 4), *max_element(p, p + 4));
+                }
+                case op_div:
+                    if(b.m_lo != b.m_hi || b.m_lo <= 0 || is_full(a))
+                        return full();
+                    return make_range(a.m_lo / b.m_lo, a.m_hi / b.m_lo);
+                default:
+                    return full();
+            }
+        }
+
+        // Narrow st to what holds when cond has the given value
+        void refine(State& st, Expr* cond, bool value)
+        {
+            if(Not* n = dynamic_cast<Not*>(cond)){
+                refine(st, n->m_expr, !value);
+                return;
+            }
+            BinaryOp op = binary_op(cond);
+            Expr** ops[2];
+            if(op == op_none || expr_operands(cond, ops) != 2)
+                return;
+            if((op == op_and && value) || (op == op_or && !value)){
+                refine(st, *ops[0], value);
+                refine(st, *ops[1], value);
+                return;
+            }
+            if(!value){
+                op = negate_op(op);
+                if(op == op_none)
+                    return;
+            }
+            Range left = range(*ops[0], st);
+            Range right = range(*ops[1], st);
+            narrow(st, *ops[0], op, right);
+            // the same comparison seen from the right operand
+            narrow(st, *ops[1], mirror_op(op), left);
+        }
+
+        // Narrow e (if it is a variable) to the values for which "e op other" holds
+        void narrow(State& st, Expr* e, BinaryOp op, Range other)
+        {
+            Ident* id = dynamic_cast<Ident*>(e);
+            if(id == NULL)
+                return;
+            Symbol* s = int_var(id, id->m_symname);
+            if(s == NULL)
+                return;
+            Range r = range(e, st);
+            switch(op){
+                case op_lt: r.m_hi = min(r.m_hi, other.m_hi - 1); break;
+                case op_le: r.m_hi = min(r.m_hi, other.m_hi); break;
+                case op_gt: r.m_lo = max(r.m_lo, other.m_lo + 1); break;
+                case op_ge: r.m_lo = max(r.m_lo, other.m_lo); break;
+                case op_eq:
+                    r.m_lo = max(r.m_lo, other.m_lo);
+                    r.m_hi = min(r.m_hi, other.m_hi);
+                    break;
+                default: return;
+            }
+            set_range(st, s, r);
+        }
+
+        static State join(State& a, State& b)
+        {
+            State result;
+            State::iterator iter;
+            for(iter = a.begin(); iter != a.end(); iter++){
+                State::iterator other = b.find(iter->first);
+                if(other != b.end())
+                    set_range(result, iter->first, make_range(min(iter->second.m_lo, other->second.m_lo),
+                        max(iter->second.m_hi, other->second.m_hi)));
+            }
+            return result;
+        }
+
+        // old, with every bound that next goes past pushed out to the limit
+        static State widen(State& old, State& next)
+        {
+            State result;
+            State::iterator iter;
+            for(iter = old.begin(); iter != old.end(); iter++){
+                State::iterator other = next.find(iter->first);
+                if(other == next.end())
+                    continue;
+                Range r = iter->second;
+                if(other->second.m_lo < r.m_lo)
+                    r.m_lo = INT_MIN;
+                if(other->second.m_hi > r.m_hi)
+                    r.m_hi = INT_MAX;
+                set_range(result, iter->first, r);
+            }
+            return result;
+        }
+
+        static bool same(State& a, State& b)
+        {
+            if(a.size() != b.size())
+                return false;
+            State::iterator i = a.begin(), j = b.begin();
+            for(; i != a.end(); i++, j++){
+                if(i->first != j->first || i->second.m_lo != j->second.m_lo || i->second.m_hi != j->second.m_hi)
+                    return false;
+            }
+            return true;
+        }
+
+        // Mark p if its non-literal index is in bounds for array
+        void check(Visitable* p, SymName* array, Expr* index, State& st)
+        {
+            if(!m_marking || is_literal(index))
+                return;
+            Symbol* s = m_effects.lookup(p, array);
+            Range r = range(index, st);
+            m_checks++;
+            if(s != NULL && r.m_lo >= 0 && r.m_hi < s->arr_length){
+                m_in_bounds.insert(p);
+                m_removed++;
+            }
+        }
+
+        // Check the array accesses in e
+        void check_expr(Expr* e, State& st)
+        {
+            if(ArrayAccess* aa = dynamic_cast<ArrayAccess*>(e))
+                check(aa, aa->m_symname, aa->m_expr, st);
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            for(int i = 0; i < n; i++)
+                check_expr(*ops[i], st);
+        }
+
+        void process_stats(list<Stat_ptr>* stats, State& st)
+        {
+            list<Stat_ptr>::iterator iter;
+            for(iter = stats->begin(); iter != stats->end(); iter++)
+                process(*iter, st);
+        }
+
+        void process(Stat* s, State& st)
+        {
+            if(WhileLoop* w = dynamic_cast<WhileLoop*>(s)){
+                process_loop(w, st);
+                return;
+            }
+            vector<Expr*> exprs;
+            m_effects.evaluated(s, exprs);
+            for(unsigned i = 0; i < exprs.size(); i++)
+                check_expr(exprs[i], st);
+
+            if(Assignment* a = dynamic_cast<Assignment*>(s)){
+                Symbol* target = m_effects.lookup(a, a->m_symname);
+                if(target != NULL && target->m_basetype == bt_integer)
+                    set_range(st, target, range(a->m_expr, st));
+                else
+                    st.erase(target);
+            } else if(ArrayAssignment* aa = dynamic_cast<ArrayAssignment*>(s)){
+                check(aa, aa->m_symname, aa->m_expr_1, st);
+            } else if(IfNoElse* i = dynamic_cast<IfNoElse*>(s)){
+                State taken = st;
+                refine(taken, i->m_expr, true);
+                process_stats(i->m_nested_block->m_stat_list, taken);
+                refine(st, i->m_expr, false);
+                st = join(taken, st);
+            } else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(s)){
+                State taken = st;
+                refine(taken, ie->m_expr, true);
+                process_stats(ie->m_nested_block_1->m_stat_list, taken);
+                refine(st, ie->m_expr, false);
+                process_stats(ie->m_nested_block_2->m_stat_list, st);
+                st = join(taken, st);
+            } else {
+                // a call: forget what it may write; the ArrayCall's index is checked afterwards
+                set<Symbol*> mods;
+                m_effects.stat_mods(s, mods);
+                set<Symbol*>::iterator iter;
+                for(iter = mods.begin(); iter != mods.end(); iter++)
+                    st.erase(*iter);
+                if(ArrayCall* ac = dynamic_cast<ArrayCall*>(s))
+                    check(ac, ac->m_symname_1, ac->m_expr_1, st);
+            }
+        }
+
+        void process_loop(WhileLoop* w, State& st)
+        {
+            bool marking = m_marking;
+            m_marking = false;
+            State head = st;
+            int size = SideEffects::list_size(w->m_nested_block->m_stat_list);
+            for(int round = 0; ; round++){
+                // out of budget: nothing is known at the head
+                if(!m_budget.spend(size)){
+                    head.clear();
+                    break;
+                }
+                State body = head;
+                refine(body, w->m_expr, true);
+                process_stats(w->m_nested_block->m_stat_list, body);
+                State next = join(st, body);
+                if(round >= precise_rounds)
+                    next = widen(head, next);
+                if(same(next, head))
+                    break;
+                head = next;
+            }
+            m_marking = marking;
+            if(m_marking){
+                check_expr(w->m_expr, head);
+                State body = head;
+                refine(body, w->m_expr, true);
+                process_stats(w->m_nested_block->m_stat_list, body);
+            }
+            refine(head, w->m_expr, false);
+            st = head;
+        }
+
+        void process_func(Func* p)
+        {
+            State st;
+            m_marking = true;
+            m_budget.start(p);
+            process_stats(p->m_function_block->m_stat_list, st);
+            check_expr(p->m_function_block->m_return->m_expr, st);
+            list<Func_ptr>::iterator iter;
+            list<Func_ptr>* nested = p->m_function_block->m_func_list;
+            for(iter = nested->begin(); iter != nested->end(); iter++)
+                process_func(*iter);
+        }
+
+    public:
+        BoundsAnalysis(SymTab* st, CallGraph* cg, long budget) : m_effects(st, cg, true), m_budget("bounds", budget)
+        {
+            m_marking = true;
+            m_checks = m_removed = 0;
+        }
+
+        // Is the index of p (an ArrayAccess, ArrayAssignment or ArrayCall) known to be in bounds?
+        bool in_bounds(Visitable* p)
+        {
+            return m_in_bounds.count(p) != 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "bounds: %d of %d bounds checks on computed indexes removed\n", m_removed, m_checks);
+        }
+
+        void visitProgram(Program *p)
+        {
+            list<Func_ptr>::iterator iter;
+            for(iter = p->m_func_list->begin(); iter != p->m_func_list->end(); iter++)
+                process_func(*iter);
+        }
+
+        void visitFunc(Func *p) {}
+        void visitFunction_block(Function_block *p) {}
+        void visitNested_block(Nested_block *p) {}
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitIfNoElse(IfNoElse *p) {}
+        void visitIfWithElse(IfWithElse *p) {}
+        void visitWhileLoop(WhileLoop *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
+
+#endif //BOUNDS_HPP
@@ -0,0 +1,85 @@
+#ifndef BUDGET_HPP
+#define BUDGET_HPP
+
+#include "ast.h"
+#include <stdio.h>
+#include <map>
+#include <set>
+
+using namespace std;
+
+/*
+ * Compile-time budgets for the passes that iterate to a fixpoint. The number of rounds a loop
+ * takes to settle grows with its nesting depth, so one pathological function could otherwise
+ * dominate the build. A pass charges each round of a fixpoint loop its size in statements and
+ * expression nodes, and each function gets the same number of these steps. Counting
+ * steps rather than time keeps the output the same from one build to the next.
+ *
+ * Once a function's budget is spent, spend() returns false and the pass stops iterating, taking
+ * the conservative answer it would reach at the top of its lattice (every variable TOP for
+ * folding, every variable live for dead store elimination, no range known for bounds checks)
+ * for the rest of the function. The first time that happens in a function, a warning names it.
+ *
+ * Functions are told apart by their Func node rather than their name, since nested functions in
+ * different parents may share one.
+ *
+ * Usage:
+ *   Budget budget("dse", limit);
+ *   budget.start(func);                // on entering a function
+ *   if(!budget.spend(size)) ...        // for each round of a fixpoint; false once spent
+ */
+
+class Budget
+{
+    private:
+        const char* m_pass;
+        long m_limit;
+        Func* m_func;
+        map<Func*, long> m_used;    // steps spent so far, by function
+        set<Func*> m_reported;      // functions already warned about
+
+    public:
+        Budget(const char* pass, long limit)
+        {
+            m_pass = pass;
+            m_limit = limit;
+            m_func = NULL;
+        }
+
+        // Charge the following steps to func. A function keeps what it already spent, so a
+        // pass that comes back to a function (after a nested one, or on a later run) can't
+        // start over; it gets one budget for the whole pass.
+        void start(Func* func)
+        {
+            m_func = func;
+        }
+
+        // The function being charged, to restore after a nested one
+        Func* current()
+        {
+            return m_func;
+        }
+
+        // Its name, for messages
+        const char* name()
+        {
+            return m_func != NULL ? m_func->m_symname->spelling() : "";
+        }
+
+        // Charge n steps to the current function. Returns false once its budget is spent.
+        bool spend(long n)
+        {
+            long& used = m_used[m_func];
+            if (used <= m_limit)
+                used += n;
+            if (used <= m_limit)
+                return true;
+            if (m_reported.insert(m_func).second)
+                fprintf(stderr, "warning: %s gave up on function %s after %ld steps; "
+                    "its results there are conservative (raise with --budget=N)\n",
+                    m_pass, name(), m_limit);
+            return false;
+        }
+};
+
+#endif //BUDGET_HPP
@@ -0,0 +1,365 @@
+#ifndef CALLGRAPH_HPP
+#define CALLGRAPH_HPP
+
+#include "ast.h"
+#include "symtab.h"
+#include "primitive.h"
+#include "attribute.h"
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+
+using namespace std;
+
+/*
+ * The call graph of the whole program, built from Call and ArrayCall nodes.
+ *
+ * Every Func (top level or nested inside a Function_block) gets a FuncInfo. Calls are
+ * resolved through the symbol table from the scope of the call statement, so a nested
+ * function shadowing an outer one resolves the same way typecheck did.
+ *
+ * On top of the graph we keep mod/ref side-effect summaries: for each function, the set
+ * of variables NOT local to it (i.e. living in an enclosing function's scope) that it may
+ * write (m_mod) or read (m_ref), including everything its callees may write or read.
+ * The summaries are computed once, bottom-up over the strongly connected components of
+ * the graph, so every callee outside a recursive cycle is finished before its callers.
+ * A function whose mod set comes out empty is marked pure: whatever it does only touches
+ * its own frame (and those of the functions it calls), so a call to it has no side effects.
+ *
+ * Usage:
+ *   CallGraph* cg = new CallGraph(st);
+ *   cg->build(ast);
+ *   FuncInfo* f = cg->resolve(call->m_attribute.m_scope, call->m_symname_2->spelling());
+ *   forall(iter, &f->m_mod) ... // variables that call may have written
+ */
+
+struct FuncInfo
+{
+    Func* m_func;
+    Symbol* m_symbol;           // the function's own symbol (in the enclosing scope)
+    SymScope* m_scope;          // the scope holding the params and locals
+    FuncInfo* m_parent;         // enclosing function for nested functions, NULL at top level
+    int m_index;                // position in program order
+
+    set<FuncInfo*> m_callees;   // functions called directly from this body
+    vector<Stat*> m_call_sites; // Call/ArrayCall nodes in this body (not in nested funcs)
+
+    set<Symbol*> m_direct_mod;  // non-local variables written directly in this body
+    set<Symbol*> m_direct_ref;  // non-local variables read directly in this body
+    set<Symbol*> m_mod;         // m_direct_mod plus everything the callees may write
+    set<Symbol*> m_ref;         // m_direct_ref plus everything the callees may read
+
+    int m_scc;                  // index into CallGraph::m_sccs
+    bool m_recursive;           // calls itself, directly or through its SCC
+    bool m_pure;                // m_mod is empty: calling it can't change any of the caller's state
+
+    FuncInfo()
+    {
+        m_func = NULL;
+        m_symbol = NULL;
+        m_scope = NULL;
+        m_parent = NULL;
+        m_index = -1;
+        m_scc = -1;
+        m_recursive = false;
+        m_pure = false;
+    }
+};
+
+class CallGraph : public Visitor
+{
+    private:
+        SymTab* m_st;
+        FuncInfo* m_cur;            // function whose body we are walking
+        map<Symbol*, const char*> m_names; // symbols don't know their names, so remember them
+
+        // Tarjan bookkeeping
+        int m_tarjan_index;
+        map<FuncInfo*, int> m_tarjan_num;
+        map<FuncInfo*, int> m_tarjan_low;
+        vector<FuncInfo*> m_tarjan_stack;
+        set<FuncInfo*> m_on_stack;
+
+        Symbol* lookup_var(Visitable* p, SymName* name)
+        {
+            Symbol* s = m_st->lookup(p->m_attribute.m_scope, name->spelling());
+            if (s != NULL)
+                m_names[s] = name->spelling();
+            return s;
+        }
+
+        void note_write(Visitable* p, SymName* name)
+        {
+            Symbol* s = lookup_var(p, name);
+            if (m_cur != NULL && s != NULL && !is_local(m_cur, s))
+                m_cur->m_direct_mod.insert(s);
+        }
+
+        void note_read(Visitable* p, SymName* name)
+        {
+            Symbol* s = lookup_var(p, name);
+            if (m_cur != NULL && s != NULL && !is_local(m_cur, s))
+                m_cur->m_direct_ref.insert(s);
+        }
+
+        void note_call(Stat* p, SymName* callee)
+        {
+            if (m_cur == NULL)
+                return;
+            m_cur->m_call_sites.push_back(p);
+            FuncInfo* f = resolve(p->m_attribute.m_scope, callee->spelling());
+            if (f != NULL)
+                m_cur->m_callees.insert(f);
+        }
+
+        void strongconnect(FuncInfo* f)
+        {
+            m_tarjan_num[f] = m_tarjan_low[f] = m_tarjan_index++;
+            m_tarjan_stack.push_back(f);
+            m_on_stack.insert(f);
+
+            set<FuncInfo*>::iterator iter;
+            for (iter = f->m_callees.begin(); iter != f->m_callees.end(); iter++) {
+                FuncInfo* g = *iter;
+                if (m_tarjan_num.find(g) == m_tarjan_num.end()) {
+                    strongconnect(g);
+                    m_tarjan_low[f] = min(m_tarjan_low[f], m_tarjan_low[g]);
+                } else if (m_on_stack.count(g)) {
+                    m_tarjan_low[f] = min(m_tarjan_low[f], m_tarjan_num[g]);
+                }
+            }
+
+            // f is the root of an SCC; pop it. Tarjan finishes callees first,
+            // so m_sccs comes out in bottom-up order.
+            if (m_tarjan_low[f] == m_tarjan_num[f]) {
+                vector<FuncInfo*> scc;
+                FuncInfo* g;
+                do {
+                    g = m_tarjan_stack.back();
+                    m_tarjan_stack.pop_back();
+                    m_on_stack.erase(g);
+                    g->m_scc = m_sccs.size();
+                    scc.push_back(g);
+                } while (g != f);
+                m_sccs.push_back(scc);
+            }
+        }
+
+        void compute_sccs()
+        {
+            m_tarjan_index = 0;
+            for (unsigned int i = 0; i < m_funcs.size(); i++)
+                if (m_tarjan_num.find(m_funcs[i]) == m_tarjan_num.end())
+                    strongconnect(m_funcs[i]);
+
+            for (unsigned int i = 0; i < m_sccs.size(); i++) {
+                vector<FuncInfo*>& scc = m_sccs[i];
+                for (unsigned int j = 0; j < scc.size(); j++)
+                    scc[j]->m_recursive = scc.size() > 1 || scc[j]->m_callees.count(scc[j]);
+            }
+        }
+
+        // Add everything in "from" that is not local to f into "to". Returns true if "to" grew.
+        bool merge_nonlocal(FuncInfo* f, set<Symbol*>& to, set<Symbol*>& from)
+        {
+            bool changed = false;
+            set<Symbol*>::iterator iter;
+            for (iter = from.begin(); iter != from.end(); iter++)
+                if (!is_local(f, *iter) && to.insert(*iter).second)
+                    changed = true;
+            return changed;
+        }
+
+        // Summarize one SCC. Callees outside the SCC are already done; inside the
+        // SCC we iterate until the sets stop growing.
+        void summarize_scc(vector<FuncInfo*>& scc)
+        {
+            for (unsigned int i = 0; i < scc.size(); i++) {
+                scc[i]->m_mod = scc[i]->m_direct_mod;
+                scc[i]->m_ref = scc[i]->m_direct_ref;
+            }
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (unsigned int i = 0; i < scc.size(); i++) {
+                    FuncInfo* f = scc[i];
+                    set<FuncInfo*>::iterator iter;
+                    for (iter = f->m_callees.begin(); iter != f->m_callees.end(); iter++) {
+                        changed |= merge_nonlocal(f, f->m_mod, (*iter)->m_mod);
+                        changed |= merge_nonlocal(f, f->m_ref, (*iter)->m_ref);
+                    }
+                }
+            }
+            for (unsigned int i = 0; i < scc.size(); i++)
+                scc[i]->m_pure = scc[i]->m_mod.empty();
+        }
+
+    public:
+        vector<FuncInfo*> m_funcs;          // every function, in program order
+        vector<vector<FuncInfo*> > m_sccs;  // strongly connected components, callees first
+        map<Symbol*, FuncInfo*> m_by_symbol;
+        map<Func*, FuncInfo*> m_by_func;
+
+        CallGraph(SymTab* st)
+        {
+            m_st = st;
+            m_cur = NULL;
+            m_tarjan_index = 0;
+        }
+
+        ~CallGraph()
+        {
+            for (unsigned int i = 0; i < m_funcs.size(); i++)
+                delete m_funcs[i];
+        }
+
+        // Collect the functions in a first walk so calls to functions declared later
+        // in the program resolve, then collect calls/reads/writes and summarize.
+        void build(Program* p)
+        {
+            visit(p);
+            compute_sccs();
+            for (unsigned int i = 0; i < m_sccs.size(); i++)
+                summarize_scc(m_sccs[i]);
+        }
+
+        FuncInfo* resolve(SymScope* scope, const char* name)
+        {
+            Symbol* s = m_st->lookup(scope, name);
+            if (s == NULL || s->m_basetype != bt_function)
+                return NULL;
+            map<Symbol*, FuncInfo*>::iterator iter = m_by_symbol.find(s);
+            return iter == m_by_symbol.end() ? NULL : iter->second;
+        }
+
+        FuncInfo* info(Func* f)
+        {
+            map<Func*, FuncInfo*>::iterator iter = m_by_func.find(f);
+            return iter == m_by_func.end() ? NULL : iter->second;
+        }
+
+        // A variable is local to f if it lives in f's own scope (params and decls)
+        bool is_local(FuncInfo* f, Symbol* s)
+        {
+            return s->get_scope() == f->m_scope;
+        }
+
+        const char* name_of(Symbol* s)
+        {
+            map<Symbol*, const char*>::iterator iter = m_names.find(s);
+            return iter == m_names.end() ? NULL : iter->second;
+        }
+
+        void visitProgram(Program* p)
+        {
+            // first pass: just register the functions
+            list<Func_ptr>::iterator iter;
+            for (iter = p->m_func_list->begin(); iter != p->m_func_list->end(); iter++)
+                register_func(*iter, NULL);
+            visit_children_of(p);
+        }
+
+        void register_func(Func* p, FuncInfo* parent)
+        {
+            FuncInfo* f = new FuncInfo();
+            f->m_func = p;
+            f->m_symbol = m_st->lookup(p->m_attribute.m_scope, p->m_symname->spelling());
+            f->m_scope = p->m_function_block->m_attribute.m_scope;
+            f->m_parent = parent;
+            f->m_index = m_funcs.size();
+            m_funcs.push_back(f);
+            m_by_func[p] = f;
+            if (f->m_symbol != NULL)
+                m_by_symbol[f->m_symbol] = f;
+
+            list<Func_ptr>::iterator iter;
+            list<Func_ptr>* nested = p->m_function_block->m_func_list;
+            for (iter = nested->begin(); iter != nested->end(); iter++)
+                register_func(*iter, f);
+        }
+
+        void visitFunc(Func* p)
+        {
+            FuncInfo* saved = m_cur;
+            m_cur = info(p);
+            visit_children_of(p);
+            m_cur = saved;
+        }
+
+        void visitFunction_block(Function_block* p) { visit_children_of(p); }
+        void visitNested_block(Nested_block* p) { visit_children_of(p); }
+        void visitParam(Param* p) {}
+        void visitDecl(Decl* p) {}
+        void visitReturn(Return* p) { visit_children_of(p); }
+
+        void visitAssignment(Assignment* p)
+        {
+            note_write(p, p->m_symname);
+            visit(p->m_expr);
+        }
+
+        void visitArrayAssignment(ArrayAssignment* p)
+        {
+            note_write(p, p->m_symname);
+            visit(p->m_expr_1);
+            visit(p->m_expr_2);
+        }
+
+        void visitCall(Call* p)
+        {
+            note_write(p, p->m_symname_1);
+            note_call(p, p->m_symname_2);
+            visit_list(p->m_expr_list);
+        }
+
+        void visitArrayCall(ArrayCall* p)
+        {
+            note_write(p, p->m_symname_1);
+            note_call(p, p->m_symname_2);
+            visit(p->m_expr_1);
+            visit_list(p->m_expr_list_2);
+        }
+
+        void visitIfNoElse(IfNoElse* p) { visit_children_of(p); }
+        void visitIfWithElse(IfWithElse* p) { visit_children_of(p); }
+        void visitWhileLoop(WhileLoop* p) { visit_children_of(p); }
+
+        void visitTInt(TInt* p) {}
+        void visitTBool(TBool* p) {}
+        void visitTIntArray(TIntArray* p) {}
+
+        void visitAnd(And* p) { visit_children_of(p); }
+        void visitDiv(Div* p) { visit_children_of(p); }
+        void visitCompare(Compare* p) { visit_children_of(p); }
+        void visitGt(Gt* p) { visit_children_of(p); }
+        void visitGteq(Gteq* p) { visit_children_of(p); }
+        void visitLt(Lt* p) { visit_children_of(p); }
+        void visitLteq(Lteq* p) { visit_children_of(p); }
+        void visitMinus(Minus* p) { visit_children_of(p); }
+        void visitNoteq(Noteq* p) { visit_children_of(p); }
+        void visitOr(Or* p) { visit_children_of(p); }
+        void visitPlus(Plus* p) { visit_children_of(p); }
+        void visitTimes(Times* p) { visit_children_of(p); }
+        void visitNot(Not* p) { visit_children_of(p); }
+        void visitUminus(Uminus* p) { visit_children_of(p); }
+        void visitMagnitude(Magnitude* p) { visit_children_of(p); }
+
+        void visitIdent(Ident* p)
+        {
+            note_read(p, p->m_symname);
+        }
+
+        void visitArrayAccess(ArrayAccess* p)
+        {
+            note_read(p, p->m_symname);
+            visit(p->m_expr);
+        }
+
+        void visitIntLit(IntLit* p) {}
+        void visitBoolLit(BoolLit* p) {}
+        void visitSymName(SymName* p) {}
+        void visitPrimitive(Primitive* p) {}
+};
+
+#endif //CALLGRAPH_HPP
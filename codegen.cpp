@@ -4,13 +4,14 @@
 #include "symtab.h"
 #include "primitive.h"
 #include "assert.h"
+#include "astutil.h"
+#include "ir.h"
+#include "regalloc.h"
+#include "peephole.h"
+#include <vector>
+#include <string>
 
 #pragma GCC diagnostic ignored "-Wwrite-strings"
-#ifdef NOFOLDING
-#define FOLDING 0
-#else
-#define FOLDING 1
-#endif
 
 #ifdef TESTING
 #define TESTING 1
@@ -33,17 +34,13 @@
 #ifndef tprint
 #define tprint(...) if(TESTING) printf(__VA_ARGS__)
 #endif
-#define tdump(...) if(DUMPING) m_st->dump(stdout)
-
-#define mpr(...) fprintf(m_outputfile,__VA_ARGS__)
 
 
-class Codegen : public Visitor
+class Codegen
 {
     private:
 
         FILE * m_outputfile;
-        SymTab *m_st;
 
         // basic size of a word (integers and booleans) in bytes
         static const int wordsize = 4;
@@ -52,37 +49,86 @@ class Codegen : public Visitor
         //but we don't reach free memory till the fourth word
         static const int fFAfter = 4*wordsize;
 
-        enum { STACK, EAX, EBX, ECX, EDX};
-
         int label_count; //access with new_label
-        int DEST_LOCATION;
+
+        IRFunction* m_func;             // being emitted
+        int m_stack_space;              // what its prologue took off %esp
+        vector<int> m_uses;             // how many instructions read each of its temporaries
+        RegisterAllocator* m_alloc;     // NULL with --disable=regalloc
+        MachineCode m_code;             // what was emitted since the last flush()
+        Peephole* m_peephole;           // NULL with --disable=peephole
+        int m_instructions;             // printed so far, for --stats
 
         // ********** Helper functions ********************************
 
         // this is used to get new unique labels (cleverly named label1, label2, ...)
         int new_label() { return label_count++; }
 
-        // this mode is used for the code
-        void set_text_mode() { fprintf( m_outputfile, ".text\n\n"); }
-
-        // PART 1:
-        // 1) get arithmetic expressions on integers working:
-        //    you wont really be able to run your code,
-        //    but you can visually inspect it to see that the correct
-        //    chains of opcodes are being generated.
-        // 2) get function calls working:
-        //    if you want to see at least a very simple program compile
-        //    and link successfully against gcc-produced code, you
-        //    need to get at least this far
-        // 3) get boolean operation working
-        //    before we can implement any of the conditional control flow 
-        //    stuff, we need to have booleans worked out.  
-        // 4) control flow:
-        //    we need a way to have if-elses and while loops in our language. 
-        //
-        // Hint: Symbols have an associated member variable called m_offset
-        //    That offset can be used to figure out where in the activation 
-        //    record you should look for a particuar variable
+        // Add an instruction with the given operands (AT&T order) to m_code
+        void instr(const char* op)
+        {
+            m_code.push_back(MachineInstr(op));
+        }
+
+        void instr(const char* op, const MachineOperand& a)
+        {
+            instr(op);
+            m_code.back().m_args.push_back(a);
+        }
+
+        void instr(const char* op, const MachineOperand& a, const MachineOperand& b)
+        {
+            instr(op, a);
+            m_code.back().m_args.push_back(b);
+        }
+
+        void instr(const char* op, const MachineOperand& a, const MachineOperand& b, const MachineOperand& c)
+        {
+            instr(op, a, b);
+            m_code.back().m_args.push_back(c);
+        }
+
+        void place_label(const string& name)
+        {
+            m_code.push_back(MachineInstr::make_label(name));
+        }
+
+        // A directive, with operands written as they are
+        void directive(const char* op, bool indented, const string& a, const string& b = "")
+        {
+            m_code.push_back(MachineInstr::make_directive(op, indented));
+            m_code.back().m_args.push_back(MachineOperand::make_name(a));
+            if(!b.empty())
+                m_code.back().m_args.push_back(MachineOperand::make_name(b));
+        }
+
+        static MachineOperand reg_op(MachineReg r) { return MachineOperand::make_reg(r); }
+        static MachineOperand imm_op(int value) { return MachineOperand::make_imm(value); }
+        static MachineOperand name_op(const string& name) { return MachineOperand::make_name(name); }
+
+        // offset(%ebp)
+        static MachineOperand frame_op(int offset) { return MachineOperand::make_mem(offset, r_ebp); }
+
+        // prefix followed by n, as in B3 or MemoMiss0
+        static string numbered(const char* prefix, int n)
+        {
+            char buffer[32];
+            sprintf(buffer, "%s%d", prefix, n);
+            return buffer;
+        }
+
+        // Print m_code, after the peephole optimizer has been over it if optimize
+        void flush(bool optimize)
+        {
+            if(optimize && m_peephole != NULL)
+                m_peephole->run(m_code);
+            for(unsigned i = 0; i < m_code.size(); i++){
+                fprintf(m_outputfile, "%s\n", m_code[i].text().c_str());
+                if(m_code[i].m_kind == MachineInstr::instr)
+                    m_instructions++;
+            }
+            m_code.clear();
+        }
 
         ///////////////////////////////////////////////////////////////////////////////
         //
@@ -143,27 +189,27 @@ class Codegen : public Visitor
         //
         //////////////////////////////////////////////////////////////////////////////
 
-        int emit_prologue(SymName *name, unsigned int size_locals, unsigned int num_args)
+        int emit_prologue(const char *name, unsigned int size_locals, unsigned int num_args)
         {
-            tprint("// Function %s, with %d bytes of locals, and %d args\n",name->spelling(),size_locals,num_args);
-            if(strcmp("Main",name->spelling())==0){
-                mpr("_Main:\n");
+            tprint("// Function %s, with %d bytes of locals, and %d args\n",name,size_locals,num_args);
+            if(strcmp("Main",name)==0){
+                place_label("_Main");
             }
-            mpr("%s:\n",name->spelling());
+            place_label(name);
             tprint("// Store caller EBP\n");
-            mpr("    push %%ebp\n");
-            mpr("    mov %%esp, %%ebp\n");
+            instr("push",reg_op(r_ebp));
+            instr("mov",reg_op(r_esp),reg_op(r_ebp));
             tprint("// Store other caller regs\n");
-            mpr("    push %%ebx\n");
-            mpr("    push %%esi\n");
-            mpr("    push %%edi\n");
+            instr("push",reg_op(r_ebx));
+            instr("push",reg_op(r_esi));
+            instr("push",reg_op(r_edi));
             int stackSpace = 0;
             if(num_args>0){
                 tprint("// Copy function args to local space. Saved regs + return addr take up %d space before %%ebp\n",fFBefore);
                 int offset = fFBefore;
                 while(num_args>0){
                     tprint("// Copying arg to local: offset %d\n",offset);
-                    mpr("    pushl %d(%%ebp)\n",offset);
+                    instr("pushl",frame_op(offset));
                     offset+=wordsize;
                     num_args--;
                     stackSpace+=wordsize;
@@ -172,7 +218,7 @@ class Codegen : public Visitor
             }
             if(size_locals>0){
                 tprint("// Decrement the stack pointer to make space for locals\n");
-                mpr("    sub $%d, %%esp\n",size_locals);
+                instr("sub",imm_op(size_locals),reg_op(r_esp));
                 stackSpace+=size_locals;
             }
             return stackSpace;
@@ -182,793 +228,471 @@ class Codegen : public Visitor
         {
             tprint("// Starting function epilogue. Pop the three basic regs\n");
             tprint("// Then call leave, which does mov ebp esp, then pop ebp, then ret\n");
-            if(stackSpace>0) mpr("    add $%d, %%esp\n",stackSpace);
-            mpr("    pop %%edi\n");
-            mpr("    pop %%esi\n");
-            mpr("    pop %%ebx\n");
-            mpr("    leave\n");
-            mpr("    ret\n");
+            if(stackSpace>0) instr("add",imm_op(stackSpace),reg_op(r_esp));
+            instr("pop",reg_op(r_edi));
+            instr("pop",reg_op(r_esi));
+            instr("pop",reg_op(r_ebx));
+            instr("leave");
+            instr("ret");
             tprint("// Done with Epilogue\n");
         }
 
-        // HERE: more functions to emit code
-        // Used inside binary expr to just handle the conditional part!
+        ///////////////////////////////////////////////////////////////////////////////
         //
-        void emit_dest_move(const char* dest){
-            if(strcmp(dest,"%eax")!=0){
-                mpr("    mov %%eax, %s\n",dest);
-            }
-        }
-
-        const char* get_dest_reg_string(){
-            switch(DEST_LOCATION){
-                case STACK:
-                case EAX:
-                    return "%eax";
-                    break;
-                case EBX:
-                    return "%ebx";
-                    break;
-                case ECX:
-                    return "%ecx";
-                    break;
-                case EDX:
-                    return "%edx";
-                    break;
-                default:
-                    return "THISSHOULDN'THAPPEN";
-                    break;
-            }
-        }
-
-        void emit_conditional(char* labelName, char* instr, int labelNum)
-        {
-            tprint("// %s:: Perform the cmparison, jump, otherwise set 0, and jump to done\n",labelName);
-            mpr("    cmp %%ebx, %%eax\n");
-            mpr("    %s %s%d\n",instr,labelName,labelNum);
-            mpr("    mov $0, %%eax\n");
-            mpr("    jmp %sDone%d\n",labelName,labelNum);
-            mpr("%s%d:\n",labelName,labelNum);
-            mpr("    mov $1, %%eax\n");
-            mpr("%sDone%d:\n",labelName,labelNum);
-        }
-
-        void emit_binary_expr(Expr* e1, Expr* e2, LatticeElem& lE, char op, char* desc)
-        {
-            const char* dest = get_dest_reg_string();
-            int myDest = DEST_LOCATION;
-            DEST_LOCATION = STACK;
-            tprint("//Dat dest %s\n",dest);
-
-            if(!FOLDING || lE == TOP){
-                LatticeElem& lEL = e1->m_attribute.m_lattice_elem;
-                LatticeElem& lER = e2->m_attribute.m_lattice_elem;
-                //lC = leftIsConstant, rC = rightIsConstant
-                bool lC = lEL != TOP;
-                bool rC = lER != TOP;
-                unsigned char foldingMode = FOLDING?( lC?1:(0 + rC)?2:0):0;
-                tprint("// Visit %s\n",desc);
-                switch(foldingMode){
-                    //NotFolding or !lC && !rC
-                    case 0:
-                        tprint("// In foldingMode switch, case 0.\n");
-                        visit(e2);
-                        DEST_LOCATION = EAX;
-                        visit(e1);
-                        mpr("    pop %%ebx\n");
-                        switch(op){
-                            case '*':
-                                mpr("    imul %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '/':
-                                mpr("    cdq\n");
-                                mpr("    idiv %%ebx\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '+':
-                                mpr("    leal (%%eax, %%ebx), %s\n",dest);
-                                break;
-                            case '-':
-                                mpr("    sub %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '&':
-                                mpr("    and %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '|':
-                                mpr("    or %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '<':
-                                emit_conditional(desc,"jl", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '>':
-                                emit_conditional(desc,"jg", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            // This is <=
-                            case '(':
-                                emit_conditional(desc,"jle", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            // This is >=
-                            case ')':
-                                emit_conditional(desc,"jge", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '=':
-                                emit_conditional(desc,"je", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '!':
-                                emit_conditional(desc,"jne", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            default:
-                                fprintf(stderr,"Op not defined in emit_binary_expr!\n");
-                                throw "Op not defined in emit_binary_expr!";
-                        }
+        //  Memoization
+        //
+        //  Functions lower.cpp decided to memoize (IRFunction::m_memo_range > 0) look
+        //  their arguments up right after the prologue, and a hit returns without running
+        //  the body:
+        //
+        //      index = arg 1 * range + arg 2 ...   (args still sit above %ebp, untouched)
+        //      if every arg is in [0, range) and name_memo_set[index]:
+        //          return name_memo[index]
+        //      body
+        //      name_memo[index] = %eax; name_memo_set[index] = 1; return
+        //
+        //  Calls with an argument out of range, negative ones included, just run the body.
+        //  Each table costs 5 bytes an entry of .bss.
+        //
+        //////////////////////////////////////////////////////////////////////////////
 
-                        break;
-                    //Left Folded
-                    case 1:
-                        tprint("// In foldingMode switch, case 1.\n");
-                        visit(e2);
-                        mpr("    pop %%ebx\n");
-                        switch(op){
-                            case '*':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                mpr("    imul %%ebx\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '/':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                mpr("    cdq\n");
-                                mpr("    idiv %%ebx\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '+':
-                                mpr("    leal %d(%%ebx), %s\n",lEL.value,dest);
-                                break;
-                            case '-':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                mpr("    sub %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '&':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                mpr("    and %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '|':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                mpr("    or %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '<':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                emit_conditional(desc,"jl", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '>':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                emit_conditional(desc,"jg", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            // This is <=
-                            case '(':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                emit_conditional(desc,"jle", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            // This is >=
-                            case ')':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                emit_conditional(desc,"jge", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '=':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                emit_conditional(desc,"je", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '!':
-                                mpr("    mov $%d, %%eax\n",lEL.value);
-                                emit_conditional(desc,"jne", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            default:
-                                fprintf(stderr,"Op not defined in emit_binary_expr!\n");
-                                throw "Op not defined in emit_binary_expr!";
-                        }
-                        break;
-                    //Right Folded
-                    case 2:
-                        tprint("// In foldingMode switch, case 2.\n");
-                        visit(e1);
-                        mpr("    pop %%eax\n");
-                        switch(op){
-                            case '*':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                mpr("    imul %%ebx\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '/':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                mpr("    cdq\n");
-                                mpr("    idiv %%ebx\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '+':
-                                mpr("    leal %d(%%eax), %s\n",lER.value,dest);
-                                break;
-                            case '-':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                mpr("    sub %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '&':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                mpr("    and %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '|':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                mpr("    or %%ebx, %%eax\n");
-                                emit_dest_move(dest);
-                                break;
-                            case '<':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                emit_conditional(desc,"jl", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '>':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                emit_conditional(desc,"jg", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            // This is <=
-                            case '(':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                emit_conditional(desc,"jle", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            // This is >=
-                            case ')':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                emit_conditional(desc,"jge", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '=':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                emit_conditional(desc,"je", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            case '!':
-                                mpr("    mov $%d, %%ebx\n",lER.value);
-                                emit_conditional(desc,"jne", new_label());
-                                emit_dest_move(dest);
-                                break;
-                            default:
-                                fprintf(stderr,"Op not defined in emit_binary_expr!\n");
-                                throw "Op not defined in emit_binary_expr!";
-                        }
-                        break;
-                    default:
-                        fprintf(stderr,"Reached unreachable statement in emit_binary_expr\n");
-                        throw "Reached unreachable statement in emit_binary_expr";
-                        break;
+        // Leave the table index for the arguments in reg (clobbering %edx), or jump to miss
+        void emit_memo_index(MachineReg reg, int num_args, int range, const char* miss, int label)
+        {
+            for(int i = 0; i < num_args; i++){
+                MachineReg to = i == 0 ? reg : r_edx;
+                instr("movl",frame_op(fFBefore + i*wordsize),reg_op(to));
+                instr("cmpl",imm_op(range),reg_op(to));
+                instr("jae",name_op(numbered(miss,label)));
+                if(i > 0){
+                    instr("imull",imm_op(range),reg_op(reg),reg_op(reg));
+                    instr("addl",reg_op(r_edx),reg_op(reg));
                 }
-                if(myDest == STACK){
-                    mpr("    push %%eax\n");
-                }
-            } else{
-                emit_integer_push(desc,lE.value," - FOLDED");
-            }
-            DEST_LOCATION=STACK;
-        }
-
-        void emit_non_folded_mov(int offset){
-            mpr("    mov %%eax, -%d(%%ebp)\n",offset+fFAfter);
-        }
-
-        void emit_folded_mov(int val, int offset){
-            mpr("    movl $%d, -%d(%%ebp)\n",val,offset+fFAfter);
-        }
-
-        int get_folded_array_offset(const char* str, Symbol* s, int index){
-            int result = s->get_offset() + (s->arr_length - 1 - index) * wordsize + fFAfter;
-            tprint("//Array index expr was folded!\n");
-            tprint("//Generated folded array offset (%s[%d] for %s is %d\n",str,index,str,result);
-            tprint("//Values used, offset: %d, wordsize: %d, arr_length: %d, index: %d\n",
-                s->get_offset(),wordsize,s->arr_length,index);
-            return result;
-        }
-
-        int get_non_folded_array_offset(const char* str, Symbol* s){
-            int result = s->get_offset() + (s->arr_length - 1) * wordsize + fFAfter;
-            tprint("//Generated array offset (%s[0]) for %s is %d\n",str,str,result);
-            tprint("//Values used, offset: %d, wordsize: %d, arr_length: %d\n",
-                s->get_offset(),wordsize,s->arr_length);
-            return result;
-        }
-
-        void emit_generic_array_assign_epilogue(const char* arr_name, bool arr_c,
-            LatticeElem& arr_le, Symbol* arr_s, Expr* arr_expr, bool val_c,
-            LatticeElem& val_le,bool isCall = false){
-            if(!FOLDING || (!arr_c && !val_c)){
-                if(!isCall) mpr("    pop %%eax\n");
-                mpr("    pop %%ebx\n");
-                mpr("    mov %%eax, -%d(%%ebp,%%ebx,%d)\n",
-                    get_non_folded_array_offset(arr_name,arr_s),wordsize);
-            } else if (arr_c && !val_c){
-                tprint("// Visit array%s assign index folded\n",isCall?"Call ":"");
-                if(!isCall) mpr("    pop %%eax\n");
-                mpr("    mov %%eax, -%d(%%ebp)\n",
-                    get_folded_array_offset(arr_name,arr_s,arr_le.value));
-            } else if (!arr_c && val_c){
-                tprint("// Visit array%s assign value folded\n",isCall?"Call ":"");
-                mpr("    pop %%ebx\n");
-                mpr("    movl $%d, -%d(%%ebp,%%ebx,%d)\n", val_le.value,
-                    get_non_folded_array_offset(arr_name,arr_s),wordsize);
-            } else{
-                tprint("// Visit array%s assign completely folded\n",isCall?"Call ":"");
-                mpr("    movl $%d, -%d(%%ebp)\n", val_le.value,
-                    get_folded_array_offset(arr_name,arr_s,arr_le.value));
             }
         }
 
-        int emit_call(char* callType, Symbol* f, const char* f_name, list<Expr_ptr>* expr_list){
-            int dec = 0;
-            int count = 0;
-            list<Expr_ptr>::reverse_iterator exprItr;
-
-            tprint("// %s: %s\n",callType,f_name);
-            tprint("// Visiting args. Each will be pushed onto stack in reverse order.\n");
-            tprint("// reverse order is x86 calling convention, as per http://www.delorie.com/djgpp/doc/ug/asm/calling.html\n");
-            forallrev(exprItr,expr_list){
-                DEST_LOCATION=STACK;
-                visit((*exprItr));
-                count++;
-                dec+=wordsize;
-            }
-            tprint("// %s: %s -- finished setting up arguments\n",callType,f_name);
-            mpr("    call %s\n",f_name);
-            tprint("// After call, result is in eax\n");
-            return dec;
-        }
-
-        void emit_integer_push(const char* str, int val, const char* str2 = ""){
-            tprint("//  %s%s int push( %d ) \n",str,str2,val);
-            if(DEST_LOCATION !=STACK){
-                tprint("// Moving directly into requested dest reg!\n");
-                mpr("    movl $%d, %s\n",val,get_dest_reg_string());
-            } else{
-                mpr("    pushl $%d\n",val);
-            }
-        }
-
-        void emit_memory_push(const char* str, int val, const char* str2 = ""){
-            tprint("//  %s%s  Memory push offset( %d ) \n",str,str2,val);
-            if(DEST_LOCATION !=STACK){
-                tprint("// Moving directly into requested dest reg!\n");
-                mpr("    movl -%d(%%ebp), %s\n",val,get_dest_reg_string());
-            } else{
-                mpr("    pushl -%d(%%ebp)\n",val);
-            }
+        void emit_memo_lookup(const char* name, int num_args, int range, int stackSpace)
+        {
+            tprint("// Memoized: look the arguments up\n");
+            int label = new_label();
+            emit_memo_index(r_eax,num_args,range,"MemoMiss",label);
+            string table = name;
+            instr("cmpb",imm_op(0),MachineOperand::make_mem(0,r_eax,r_none,1,table + "_memo_set"));
+            instr("je",name_op(numbered("MemoMiss",label)));
+            instr("movl",MachineOperand::make_mem(0,r_none,r_eax,wordsize,table + "_memo"),reg_op(r_eax));
+            emit_epilogue(stackSpace);
+            place_label(numbered("MemoMiss",label));
         }
 
-        ////////////////////////////////////////////////////////////////////////////////
-
-    public:
-
-        Codegen(FILE * outputfile, SymTab * st)
+        void emit_memo_store(const char* name, int num_args, int range)
         {
-            m_outputfile = outputfile;
-            m_st = st;
-            label_count = 0;
+            tprint("// Memoized: remember the result in %%eax\n");
+            int label = new_label();
+            emit_memo_index(r_ecx,num_args,range,"MemoDone",label);
+            string table = name;
+            instr("movl",reg_op(r_eax),MachineOperand::make_mem(0,r_none,r_ecx,wordsize,table + "_memo"));
+            instr("movb",imm_op(1),MachineOperand::make_mem(0,r_ecx,r_none,1,table + "_memo_set"));
+            place_label(numbered("MemoDone",label));
         }
 
-        void visitProgram(Program * p)
-        {
-            DEST_LOCATION = STACK;
-            mpr(".globl _Main\n");
-            mpr(".globl Main\n");
-            /*list<Func_ptr>::iterator listItr;
-            mpr(".globl");
-            forall(listItr,p->m_func_list){
-                mpr(" ");
-                lpr((*listItr)->m_symname->spelling());
-            }
-            mpr("\n");*/ // This isn't actually what you do!
-            visit_children_of(p);
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //  Instruction selection
+        //
+        //  The register allocator (regalloc.h) puts what it can of the temporaries and
+        //  scalar variables in %ebx, %esi, %edi, %ecx and %edx. The rest are in the
+        //  frame: variables at their symbol's offset and temporaries in slots below the
+        //  variables. Without the allocator (--disable=regalloc) every temporary has a
+        //  slot. %eax is the scratch register: x86 takes one memory operand, so
+        //      %2 = sub x, %1    =>    subl %1, %esi       (x and %2 in %esi)
+        //                        or    movl x, %eax        (all of them in memory)
+        //                              subl %1, %eax
+        //                              movl %eax, %2
+        //  A comparison whose only use is the branch right after it sets the flags for
+        //  the branch instead of materializing 0 or 1.
+        //
+        //////////////////////////////////////////////////////////////////////////////
 
-        }
-        void visitFunc(Func * p)
-        {
-            int scopeSize = m_st->scopesize(p->m_function_block->m_attribute.m_scope);
-            int numParams = p->m_param_list->size();
-            int stackSpace = emit_prologue(p->m_symname,scopeSize-(wordsize*numParams),numParams);
-            tprint("// There are %d bytes after ebp used for storing caller regs\n",fFAfter);
-            visit(p->m_function_block);
-            emit_epilogue(stackSpace);
-        }
-        void visitFunction_block(Function_block * p)
+        // The register o is in, or r_none
+        MachineReg reg(const IROperand& o)
         {
-            visit_children_of(p);
+            // by RegisterAllocator's numbering
+            static const MachineReg registers[] = { r_ebx, r_esi, r_edi, r_ecx, r_edx };
+            if(m_alloc == NULL || o.is_none() || o.is_imm())
+                return r_none;
+            int r = m_alloc->reg(o);
+            return r < 0 ? r_none : registers[r];
         }
-        void visitNested_block(Nested_block * p)
+
+        bool in_memory(const IROperand& o)
         {
-            visit_children_of(p);
+            return !o.is_imm() && reg(o) == r_none;
         }
-        void visitAssignment(Assignment * p)
-        {
-            const char* name = p->m_symname->spelling();
-            Symbol* s = m_st->lookup(p->m_attribute.m_scope,name);
-            assert(s!=NULL);
-            Expr* expr = p->m_expr;
-            LatticeElem& lE = expr->m_attribute.m_lattice_elem;
 
-            tprint("// Visiting assign %s\n",name);
-            tprint("// Pop off stack, then save to loc with offset %d\n",s->get_offset());
-            if(!FOLDING || lE == TOP){
-                visit(p->m_expr);
-                mpr("    pop %%eax\n");
-                emit_non_folded_mov(s->get_offset());
-            } else{
-                tprint("// Assign FOLDED!\n");
-                emit_folded_mov(lE.value,s->get_offset());
-            }
-            tprint("// Done with visit assign\n");
-        }
-        void visitArrayAssignment(ArrayAssignment * p)
+        // Where o is, as an instruction operand
+        MachineOperand operand(const IROperand& o)
         {
-            tdump();
-
-            const char* arr_name = p->m_symname->spelling();
-            Symbol* arr_s = m_st->lookup(p->m_attribute.m_scope,arr_name);
-            assert(arr_s!=NULL);
-            Expr* arr_index_expr = p->m_expr_1;
-            LatticeElem& arr_index_lE = arr_index_expr->m_attribute.m_lattice_elem;
-            bool arr_index_const = arr_index_lE != TOP;
-
-            Expr* val_expr = p->m_expr_2;
-            LatticeElem& val_lE = val_expr->m_attribute.m_lattice_elem;
-            bool val_const = val_lE != TOP;
-
-            if(!FOLDING || !arr_index_const){
-                visit(arr_index_expr);
-            }
-            if(!FOLDING || !val_const){
-                visit(val_expr);
+            MachineReg r = reg(o);
+            if(r != r_none)
+                return reg_op(r);
+            switch(o.m_kind){
+                case IROperand::imm:
+                    return imm_op(o.m_value);
+                case IROperand::var:
+                    return frame_op(-(o.m_symbol->get_offset()+fFAfter));
+                case IROperand::temp:
+                    return frame_op(-(m_func->m_frame+fFAfter+slot(o)*wordsize));
+                default:
+                    assert(false);
+                    return MachineOperand();
             }
-            tprint("// Visiting array assign to %s\n", arr_name);
-            emit_generic_array_assign_epilogue(arr_name,arr_index_const,
-                arr_index_lE, arr_s, arr_index_expr, val_const,
-                val_lE);
-            tprint("// Done with visit array assign\n");
         }
-        void visitCall(Call * p)
-        {
-            const char* var_name = p->m_symname_1->spelling();
-            Symbol* var_s = m_st->lookup(p->m_attribute.m_scope,var_name);
-            assert(var_s!=NULL);
 
-            const char* f_name = p->m_symname_2->spelling();
-            Symbol* f = m_st->lookup(p->m_attribute.m_scope,f_name);
-
-            int argsBytes = emit_call("visitCall",f,f_name,p->m_expr_list);
-
-            tprint("// Call assign: save eax to loc with offset %d\n",var_s->get_offset());
-            emit_non_folded_mov(var_s->get_offset());
-            tprint("// Now we have to clean up stack from our arguments. We pushed %d bytes on\n",argsBytes);
-            if(argsBytes>0) mpr("    add $%d, %%esp\n",argsBytes);
-            else tprint("// No cleanup needed as argsBytes == 0\n");
-        }
-        void visitArrayCall(ArrayCall *p)
+        int slot(const IROperand& o)
         {
-            const char* arr_name = p->m_symname_1->spelling();
-            Symbol* arr_s = m_st->lookup(p->m_attribute.m_scope,arr_name);
-            assert(arr_s!=NULL);
-            Expr* arr_index_expr = p->m_expr_1;
-            LatticeElem& arr_index_lE = arr_index_expr->m_attribute.m_lattice_elem;
-            bool arr_index_const = arr_index_lE != TOP;
-
-            const char* f_name = p->m_symname_2->spelling();
-            Symbol* f = m_st->lookup(p->m_attribute.m_scope,f_name);
-
-            if(!FOLDING || !arr_index_const){
-                tprint("// visitArrayCall, evaling index expr\n");
-                visit(arr_index_expr);
-            }
-
-            int argsBytes = emit_call("visitArrayCall",f,f_name,p->m_expr_list_2);
-            tprint("// visitArrayCall: now we need to save eax to the array\n");
-            tprint("// Now we have to clean up stack from our arguments.\n");
-            tprint("// We do this before the assign so we can find ebx\n");
-            tprint("// We pushed %d bytes on\n",argsBytes);
-            if(argsBytes>0) mpr("    add $%d, %%esp\n",argsBytes);
-            else tprint("// No cleanup needed as argsBytes == 0\n");
-            emit_generic_array_assign_epilogue(arr_name,arr_index_const,
-                arr_index_lE, arr_s, arr_index_expr, false,
-                arr_index_lE,true);
-        }
-
-        void visitReturn(Return * p)
-        {   tprint("// Starting return statement\n");
-            if(!FOLDING || p->m_expr->m_attribute.m_lattice_elem == TOP){
-                visit(p->m_expr);
-                tprint("// Finished the expr of return, now pop to eax\n");
-                mpr("    pop %%eax\n");
-            } else{
-                tprint("// Return FOLDED!\n");
-                mpr("    movl $%d, %%eax\n",p->m_expr->m_attribute.m_lattice_elem.value);
-            }
-            tprint("// End of return statement\n");
-        }
-
-        // control flow
-        void visitIfNoElse(IfNoElse * p)
-        {
-            if(!FOLDING || p->m_expr->m_attribute.m_lattice_elem == TOP){
-                int label = new_label();
-                visit(p->m_expr);
-                tprint("// IfNoElse\n");
-                mpr("    pop %%eax\n");
-                mpr("    cmp $1, %%eax\n");
-                tprint("// IfNoElse:: Compare with 1, but jump if not equal\n");
-                mpr("    jne IfNoElseDone%d\n",label);
-                visit(p->m_nested_block);
-                mpr("IfNoElseDone%d:\n",label);
-                tprint("// Done with IfNoElse\n");
-            } else if(p->m_expr->m_attribute.m_lattice_elem.value == 1){
-                tprint("// IfNoElse - FOLDED to TRUE\n");
-                visit(p->m_nested_block);
-            } else{
-                tprint("// IfNoElse - FOLDED to FALSE. Eliminated all code.\n");
-            }
-        }
-        void visitIfWithElse(IfWithElse * p)
-        {
-            if(!FOLDING || p->m_expr->m_attribute.m_lattice_elem == TOP){
-                int label = new_label();
-                int donelabel = new_label();
-                visit(p->m_expr);
-                tprint("// IfWithElse\n");
-                mpr("    pop %%eax\n");
-                mpr("    cmp $1, %%eax\n");
-                tprint("// IfWithElse:: Compare with 1, but jump if not equal\n");
-                mpr("    jne IfWithElse%d\n",label);
-                tprint("// IfWithElse:: If block\n");
-                visit(p->m_nested_block_1);
-                mpr("    jmp IfWithElseDone%d\n",donelabel);
-                tprint("// IfWithElse:: Else block\n");
-                mpr("IfWithElse%d:\n",label);
-                visit(p->m_nested_block_2);
-                mpr("IfWithElseDone%d:\n",donelabel);
-                tprint("// Done with IfWithElse\n");
-            } else if(p->m_expr->m_attribute.m_lattice_elem.value == 1){
-                tprint("// IfWithElse - FOLDED to TRUE\n");
-                visit(p->m_nested_block_1);
-            } else{
-                tprint("// IfWithElse - FOLDED to FALSE\n");
-                visit(p->m_nested_block_2);
-            }
+            return m_alloc != NULL ? m_alloc->slot(o) : o.m_value;
         }
-        void visitWhileLoop(WhileLoop * p)
-        {
-            if(!FOLDING || p->m_expr->m_attribute.m_lattice_elem == TOP || p->m_expr->m_attribute.m_lattice_elem.value == 1){
-                int label = new_label();
-                tprint("// While\n");
-                mpr("While%d:\n",label);
-                visit(p->m_expr);
-                mpr("    pop %%eax\n");
-                mpr("    cmp $1, %%eax\n");
-                tprint("// While:: Compare with 1, but jump if not equal\n");
-                mpr("    jne WhileDone%d\n",label);
-                visit(p->m_nested_block);
-                mpr("    jmp While%d\n",label);
-                mpr("WhileDone%d:\n",label);
-                tprint("// Done with While\n");
+
+        void emit_move(const IROperand& from, const IROperand& to)
+        {
+            MachineOperand a = operand(from), d = operand(to);
+            if(a == d)
+                return;
+            if(in_memory(from) && in_memory(to)){
+                instr("movl",a,reg_op(r_eax));
+                instr("movl",reg_op(r_eax),d);
             } else {
-                tprint("// While - FOLDED to FALSE. Eliminated all code.\n");
+                instr("movl",a,d);
             }
         }
 
-        // variable declarations (no code generation needed)
-        void visitDecl(Decl * p)
+        void emit_load(const IROperand& o, MachineReg r)
         {
-            visit_children_of(p);
-        }
-        void visitParam(Param *p)
-        {
-            visit_children_of(p);
-        }
-        void visitTInt(TInt * p)
-        {
-            visit_children_of(p);
-        }
-        void visitTBool(TBool * p)
-        {
-            visit_children_of(p);
-        }
-        void visitTIntArray(TIntArray * p)
-        {
-            visit_children_of(p);
+            MachineOperand a = operand(o);
+            if(!a.is_reg(r)) instr("movl",a,reg_op(r));
         }
 
-        // comparison operations
-        void visitCompare(Compare * p)
-        {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '=',"Compare");
-        }
-        void visitNoteq(Noteq * p)
-        {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '!',"NotEq");
-        }
-        void visitGt(Gt * p)
-        {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '>',"GreaterThan");
-        }
-        void visitGteq(Gteq * p)
+        void emit_store(MachineReg r, const IROperand& o)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                ')',"GreaterThanEq");
+            MachineOperand d = operand(o);
+            if(!d.is_reg(r)) instr("movl",reg_op(r),d);
         }
-        void visitLt(Lt * p)
+
+        // The register to compute in->m_dst in: its own, or %eax to store afterwards
+        MachineReg work_register(IRInstr* in)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '<',"LessThan");
+            MachineReg r = reg(in->m_dst);
+            return r != r_none ? r : r_eax;
         }
-        void visitLteq(Lteq * p)
+
+        // Element index of array s: fixed if the index is an immediate, else indexed by the
+        // register the index is in (index_reg)
+        MachineOperand element(Symbol* s, const IROperand& index, MachineReg index_reg)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '(',"LessThanEqual");
+            int last = s->get_offset() + (s->arr_length - 1) * wordsize + fFAfter;
+            if(index.is_imm())
+                return frame_op(-(last - index.m_value*wordsize));
+            return MachineOperand::make_mem(-last,r_ebp,index_reg,wordsize);
         }
 
-        // arithmetic and logic operations
-        void visitAnd(And * p)
+        // The register the index operand of in is in, loading it into %eax if it is in memory
+        MachineReg emit_index(IRInstr* in)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '&',"And");
+            if(in->m_a.is_imm())
+                return r_none;
+            MachineReg r = reg(in->m_a);
+            if(r != r_none)
+                return r;
+            emit_load(in->m_a,r_eax);
+            return r_eax;
         }
-        void visitOr(Or * p)
+
+        // The condition code of a comparison, or of its negation
+        static const char* condition(IROp op, bool negate)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '|',"Or");
+            static const char* codes[] = { "l", "g", "le", "ge", "e", "ne" };
+            static const char* negated[] = { "ge", "le", "g", "l", "ne", "e" };
+            return negate ? negated[op - ir_lt] : codes[op - ir_lt];
         }
-        void visitMinus(Minus * p)
+
+        // op followed by the condition code of a comparison or its negation, as in jl or setge
+        static string conditional(const char* op, IROp cmp, bool negate)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '-',"Minus");
+            return string(op) + condition(cmp,negate);
         }
-        void visitPlus(Plus * p)
+
+        static MachineOperand block_label(IRBlock* b)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '+',"Plus");
+            return name_op(numbered("B",b->m_id));
         }
-        void visitTimes(Times * p)
+
+        // Jump to if_true if the condition (cc, flags set) holds, else to if_false, falling
+        // through where we can
+        void emit_cond_jump(IROp cmp, IRBlock* if_true, IRBlock* if_false, IRBlock* next)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '*',"Times");
+            if(if_false == next){
+                instr(conditional("j",cmp,false).c_str(),block_label(if_true));
+            } else {
+                instr(conditional("j",cmp,true).c_str(),block_label(if_false));
+                if(if_true != next) instr("jmp",block_label(if_true));
+            }
         }
-        void visitDiv(Div * p)
+
+        void emit_jump(IRBlock* target, IRBlock* next)
         {
-            emit_binary_expr(p->m_expr_1,p->m_expr_2,p->m_attribute.m_lattice_elem,
-                '/',"Div");
+            if(target != next) instr("jmp",block_label(target));
         }
-        void visitNot(Not * p)
+
+        // dst = a op b for add, sub, mul, and and or
+        void emit_arithmetic(IRInstr* in)
         {
-            if(!FOLDING || p->m_attribute.m_lattice_elem == TOP){
-                visit(p->m_expr);
-                // Sourced from http://www.pagetable.com/?p=13
-                tprint("// Not\n");
-                mpr("    pop %%eax\n");
-                // get the negative version of what is in eax
-                // This also sets carry flag to 0 if eax is 0, 1 otherwise
-                mpr("    neg %%eax\n");
-                // Perform (eax) - (eax+carryFlag). This gives us the value (- carry flag) inside eax.
-                mpr("    sbb %%eax, %%eax\n");
-                // Since carry flag is 0 if eax is 0, and 1 otherwise, we now have 0 -> 0. and 1 -> -1. So lets increment
-                mpr("    inc %%eax\n");
-                mpr("    push %%eax\n");
-            } else{
-                emit_integer_push("Not - FOLDED",p->m_attribute.m_lattice_elem.value);
-            }
-        }
-        void visitUminus(Uminus * p)
-        {
-            if(!FOLDING || p->m_attribute.m_lattice_elem == TOP){
-                const char* dest = get_dest_reg_string();
-                int myDest = DEST_LOCATION;
-                DEST_LOCATION = EAX;
-                visit(p->m_expr);
-                tprint("// Uminus\n");
-                //mpr("    pop %%eax\n");
-                mpr("    neg %%eax\n");
-                emit_dest_move(dest);
-                if(myDest==STACK){
-                    mpr("    push %%eax\n");
+            static const char* names[] = { "addl", "subl", "imull", "", "andl", "orl" };
+            const char* name = names[in->m_op - ir_add];
+            MachineReg d = reg(in->m_dst);
+            MachineReg b_reg = reg(in->m_b);
+            MachineOperand a = operand(in->m_a), b = operand(in->m_b);
+            if(d != r_none && b_reg == d && a != b){
+                // b is about to be overwritten by a; if the order doesn't matter, start from b
+                if(in->m_op != ir_sub){
+                    instr(name,a,reg_op(d));
+                    return;
                 }
-                DEST_LOCATION = STACK;
-            } else{
-                emit_integer_push("Uminus - FOLDED",p->m_attribute.m_lattice_elem.value);
+                d = r_none;
             }
+            MachineReg r = d != r_none ? d : r_eax;
+            emit_load(in->m_a,r);
+            instr(name,b,reg_op(r));
+            emit_store(r,in->m_dst);
         }
-        void visitMagnitude(Magnitude * p)
-        {
-            // From: http://stackoverflow.com/questions/2639173/x86-assembly-abs-implementation
-            if(!FOLDING || p->m_attribute.m_lattice_elem == TOP){
-                const char* dest = get_dest_reg_string();
-                int myDest = DEST_LOCATION;
-                DEST_LOCATION = EAX;
-                visit(p->m_expr);
-                tprint("// Magnitude\n");
-                mpr("    mov %%eax, %%ebx\n");
-                mpr("    neg %%eax\n");
-                mpr("    cmovl %%ebx, %%eax\n");
-                emit_dest_move(dest);
-                if(myDest==STACK){
-                    mpr("    push %%eax\n");
+
+        // in is instrs[i] of a block laid out before next (NULL for the last)
+        void emit_instr(vector<IRInstr*>& instrs, unsigned& i, IRBlock* next)
+        {
+            IRInstr* in = instrs[i];
+            MachineOperand a = in->m_a.is_none() ? MachineOperand() : operand(in->m_a);
+            MachineOperand b = in->m_b.is_none() ? MachineOperand() : operand(in->m_b);
+            switch(in->m_op){
+                case ir_copy:
+                    emit_move(in->m_a,in->m_dst);
+                    break;
+                case ir_add:
+                case ir_sub:
+                case ir_mul:
+                case ir_and:
+                case ir_or:
+                    emit_arithmetic(in);
+                    break;
+                case ir_div:
+                    // the allocator keeps %ecx and %edx free here
+                    emit_load(in->m_a,r_eax);
+                    instr("cdq");
+                    // idiv has no immediate form
+                    if(in->m_b.is_imm()){
+                        emit_load(in->m_b,r_ecx);
+                        instr("idivl",reg_op(r_ecx));
+                    } else {
+                        instr("idivl",b);
+                    }
+                    emit_store(r_eax,in->m_dst);
+                    break;
+                case ir_lt:
+                case ir_gt:
+                case ir_le:
+                case ir_ge:
+                case ir_eq:
+                case ir_ne:
+                {
+                    if(in->m_a.is_imm() || (in_memory(in->m_a) && in_memory(in->m_b))){
+                        emit_load(in->m_a,r_eax);
+                        a = reg_op(r_eax);
+                    }
+                    instr("cmpl",b,a);
+                    IRInstr* after = i + 1 < instrs.size() ? instrs[i + 1] : NULL;
+                    if(after != NULL && after->m_op == ir_branch && after->m_a == in->m_dst &&
+                       in->m_dst.is_temp() && m_uses[in->m_dst.m_value] == 1){
+                        tprint("// Compare and branch\n");
+                        emit_cond_jump(in->m_op,after->m_target,after->m_target2,next);
+                        i++;
+                        break;
+                    }
+                    instr(conditional("set",in->m_op,false).c_str(),reg_op(r_al));
+                    MachineReg r = work_register(in);
+                    instr("movzbl",reg_op(r_al),reg_op(r));
+                    emit_store(r,in->m_dst);
+                    break;
+                }
+                case ir_neg:
+                {
+                    MachineReg r = work_register(in);
+                    emit_load(in->m_a,r);
+                    instr("negl",reg_op(r));
+                    emit_store(r,in->m_dst);
+                    break;
                 }
-                DEST_LOCATION = STACK;
-            } else{
-                emit_integer_push("Magnitude - FOLDED",p->m_attribute.m_lattice_elem.value);
+                case ir_not:
+                {
+                    // Sourced from http://www.pagetable.com/?p=13
+                    // neg sets the carry flag unless the value is 0, sbb turns that into 0 or -1
+                    MachineReg r = work_register(in);
+                    emit_load(in->m_a,r);
+                    instr("negl",reg_op(r));
+                    instr("sbbl",reg_op(r),reg_op(r));
+                    instr("incl",reg_op(r));
+                    emit_store(r,in->m_dst);
+                    break;
+                }
+                case ir_abs:
+                    // From: http://stackoverflow.com/questions/2639173/x86-assembly-abs-implementation
+                    // (the allocator keeps %ecx free here)
+                    emit_load(in->m_a,r_eax);
+                    instr("movl",reg_op(r_eax),reg_op(r_ecx));
+                    instr("negl",reg_op(r_eax));
+                    instr("cmovl",reg_op(r_ecx),reg_op(r_eax));
+                    emit_store(r_eax,in->m_dst);
+                    break;
+                case ir_load:
+                {
+                    MachineOperand e = element(in->m_array,in->m_a,emit_index(in));
+                    MachineReg r = work_register(in);
+                    instr("movl",e,reg_op(r));
+                    emit_store(r,in->m_dst);
+                    break;
+                }
+                case ir_store:
+                    if(!in_memory(in->m_b) || in->m_a.is_imm() || reg(in->m_a) != r_none){
+                        bool through_eax = in_memory(in->m_b);
+                        if(through_eax) emit_load(in->m_b,r_eax);
+                        MachineOperand e = element(in->m_array,in->m_a,emit_index(in));
+                        instr("movl",through_eax ? reg_op(r_eax) : b,e);
+                    } else {
+                        // both in memory, and %eax holds the index: move the value through the stack
+                        MachineOperand e = element(in->m_array,in->m_a,emit_index(in));
+                        instr("pushl",b);
+                        instr("popl",e);
+                    }
+                    break;
+                case ir_check:
+                    // one unsigned compare checks both ends
+                    if(in->m_a.is_imm()){
+                        if(in->m_a.m_value < 0 || in->m_a.m_value >= in->m_array->arr_length)
+                            instr("jmp",name_op("BoundsError"));
+                    } else {
+                        instr("cmpl",imm_op(in->m_array->arr_length),a);
+                        instr("jae",name_op("BoundsError"));
+                    }
+                    break;
+                case ir_param:
+                    instr("pushl",a);
+                    break;
+                case ir_call:
+                    instr("call",name_op(in->m_func));
+                    if(in->m_args > 0) instr("add",imm_op(in->m_args*wordsize),reg_op(r_esp));
+                    emit_store(r_eax,in->m_dst);
+                    break;
+                case ir_jump:
+                    emit_jump(in->m_target,next);
+                    break;
+                case ir_branch:
+                    if(in->m_a.is_imm()){
+                        emit_jump(in->m_a.m_value ? in->m_target : in->m_target2,next);
+                    } else {
+                        instr("cmpl",imm_op(0),a);
+                        emit_cond_jump(ir_ne,in->m_target,in->m_target2,next);
+                    }
+                    break;
+                case ir_return:
+                    emit_load(in->m_a,r_eax);
+                    if(m_func->m_memo_range > 0)
+                        emit_memo_store(m_func->m_name,m_func->m_params.size(),m_func->m_memo_range);
+                    emit_epilogue(m_stack_space);
+                    break;
             }
         }
 
-        // variable and constant access
-        void visitIdent(Ident * p)
+        ////////////////////////////////////////////////////////////////////////////////
+
+    public:
+
+        // With a register allocator, temporaries and scalar variables are kept in registers
+        // where it can; without, everything is in the frame
+        // With a peephole optimizer, each function's code goes through it before it is printed
+        Codegen(FILE * outputfile, RegisterAllocator * alloc = NULL, Peephole * peephole = NULL)
         {
-            if(!FOLDING || p->m_attribute.m_lattice_elem == TOP){
-                Symbol* s = m_st->lookup(p->m_attribute.m_scope,p->m_symname->spelling());
-                assert(s!=NULL);
-                emit_memory_push("Ident ",s->get_offset()+fFAfter, p->m_symname->spelling());
-            } else{
-                emit_integer_push("Ident - FOLDED",p->m_attribute.m_lattice_elem.value);
-            }
+            m_peephole = peephole;
+            m_outputfile = outputfile;
+            label_count = 0;
+            m_func = NULL;
+            m_stack_space = 0;
+            m_alloc = alloc;
+            m_instructions = 0;
         }
-        void visitIntLit(IntLit * p)
+
+        // Instructions, not counting labels and directives: what the passes before codegen are
+        // measured by (see bench/size.sh)
+        void print_stats(FILE* out)
         {
-            emit_integer_push("IntLit",p->m_attribute.m_lattice_elem.value);
+            fprintf(out, "codegen: %d instructions\n", m_instructions);
         }
-        void visitBoolLit(BoolLit * p)
-        {
-            emit_integer_push("IntLit",p->m_attribute.m_lattice_elem.value);
 
-        }
-        void visitArrayAccess(ArrayAccess * p)
+        void emit(IRProgram * p)
         {
-            const char* arr_name = p->m_symname->spelling();
-            Symbol* arr_s = m_st->lookup(p->m_attribute.m_scope,arr_name);
-            assert(arr_s!=NULL);
-            Expr* arr_index_expr = p->m_expr;
-            LatticeElem& arr_index_lE = arr_index_expr->m_attribute.m_lattice_elem;
-
-            tprint("// ArrayAccess %s\n", arr_name);
-            if( !FOLDING || arr_index_lE == TOP){
-                visit(arr_index_expr);
-                mpr("    pop %%ebx\n");
-                mpr("    pushl -%d(%%ebp,%%ebx,%d)\n",
-                    get_non_folded_array_offset(arr_name,arr_s),wordsize);
-            } else{
-                emit_memory_push("ArrayAccess - Folded",get_folded_array_offset(arr_name,arr_s,arr_index_lE.value));
+            directive(".globl",false,"_Main");
+            directive(".globl",false,"Main");
+            flush(false);
+            for(unsigned i = 0; i < p->m_funcs.size(); i++)
+                emit(p->m_funcs[i]);
+            if(p->m_bounds_checked){
+                tprint("// Failed bounds checks end up here: stop with an illegal instruction\n");
+                place_label("BoundsError");
+                instr("ud2");
             }
-            tprint("// End Array Access\n");
+            flush(false);
         }
 
-        // special cases
-        void visitSymName(SymName * p)
-        {
-        }
-        void visitPrimitive(Primitive * p)
+        void emit(IRFunction * f)
         {
+            m_func = f;
+            m_uses.assign(f->m_temps,0);
+            for(unsigned i = 0; i < f->m_blocks.size(); i++){
+                vector<IRInstr*>& instrs = f->m_blocks[i]->m_instrs;
+                for(unsigned j = 0; j < instrs.size(); j++){
+                    vector<const IROperand*> used;
+                    instrs[j]->uses(used);
+                    for(unsigned k = 0; k < used.size(); k++)
+                        if(used[k]->is_temp()) m_uses[used[k]->m_value]++;
+                }
+            }
+            if(m_alloc != NULL)
+                m_alloc->allocate(f);
+            int slots = m_alloc != NULL ? m_alloc->slots() : f->m_temps;
+
+            int numParams = f->m_params.size();
+            m_stack_space = emit_prologue(f->m_name,f->m_frame-(wordsize*numParams)+slots*wordsize,numParams);
+            tprint("// There are %d bytes after ebp used for storing caller regs\n",fFAfter);
+            if(f->m_memo_range > 0)
+                emit_memo_lookup(f->m_name,numParams,f->m_memo_range,m_stack_space);
+            for(int i = 0; i < numParams; i++){
+                MachineReg r = reg(f->m_params[i]);
+                if(r != r_none)
+                    instr("movl",frame_op(fFBefore + i*wordsize),reg_op(r));
+            }
+            for(unsigned i = 0; i < f->m_blocks.size(); i++){
+                IRBlock* b = f->m_blocks[i];
+                IRBlock* next = i + 1 < f->m_blocks.size() ? f->m_blocks[i + 1] : NULL;
+                if(!b->m_preds.empty()) place_label(numbered("B",b->m_id));
+                for(unsigned j = 0; j < b->m_instrs.size(); j++)
+                    emit_instr(b->m_instrs,j,next);
+            }
+            if(f->m_memo_range > 0){
+                int entries = 1;
+                for(int i = 0; i < numParams; i++)
+                    entries *= f->m_memo_range;
+                string table = f->m_name;
+                directive(".lcomm",true,table + "_memo",numbered("",entries*wordsize));
+                directive(".lcomm",true,table + "_memo_set",numbered("",entries));
+            }
+            flush(true);
+            m_func = NULL;
         }
 };
 
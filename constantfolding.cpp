@@ -2,6 +2,12 @@
 #include "primitive.h"
 #include "attribute.h"
 #include "symtab.h"
+#include "callgraph.h"
+#include "evaluator.h"
+#include "astutil.h"
+#include "effects.h"
+#include "budget.h"
+#include "remarks.h"
 #include <iostream>
 
 #define forall(iterator,listptr) \
@@ -77,13 +83,23 @@ using namespace std;
  * The rules of our constant folding are:
  *   * All variables are uninitialized at the beginning of a function (TOP by default)
  *   * All assignments force the left hand side variable to the value of the right hand side
- *   * We are doing an intraprocedural analysis. This means that we do our analysis for each function
- *     separately, not minding other functions. As a consequence:
- *       + We assume each function always returns TOP. We will not assume anything more precise.
+ *   * We are doing an interprocedural analysis over the call graph (see "callgraph.h"):
+ *       + Each parameter starts out as the join of the arguments passed at every call site. A function with no
+ *         (live) call sites gets TOP parameters.
+ *       + Each call's result is the join of the values the callee's Return expression can take.
+ *       + Both of these summaries depend on the analysis of other functions, so visitProgram re-runs the analysis
+ *         of the whole program with the summaries of the previous run until a run reproduces the summaries it
+ *         started from. If that doesn't happen within a bounded number of runs we give up and fall back to TOP
+ *         parameters and results everywhere.
  *       + We don't assume anything about global variables; therefore they're (initially) TOP, and nothing one function
 *         does to a global affects the same global in other functions.
-*       + We assume that any function may alter any visible var's state. To simplify the analysis ALL variables should 
-*         be set to TOP after each call statement.
+*       + A call may only alter the variables in its callee's mod summary (see "callgraph.h"): the enclosing-scope
+*         variables the callee, or anything it calls, writes. Only those, plus the variable receiving the result,
+*         are set to TOP after each call statement. Top level functions can't see any of the caller's variables,
+*         so calls to them only kill the result variable.
+*       + A call to a pure function (see "callgraph.h") whose arguments are all constant is run at compile time by
+*         the Evaluator (see "evaluator.h"). If that succeeds within its limits, the result variable gets the returned
+*         constant, and once the analysis is done the call is replaced by an assignment of that constant.
 *   * We are not keeping track of IntArrays. Any array element is assumed to be TOP at all times.
 * Also:
 *   * Anything multiplied by 0 is 0
@@ -95,24 +111,575 @@ using namespace std;
 * analysis posted here; no more and no less.
 */
 
+/*
+ * FoldRewriter turns the facts ConstantFolding found into changes to the tree, once the analysis
+ * is done:
+ *   * Every expression with a constant LatticeElem is replaced by an IntLit or BoolLit.
+ *   * An If whose condition is constant is replaced by the statements of the branch that is taken
+ *     (or by nothing), and a While whose condition is false on entry is removed.
+ *   * Calls that were evaluated at compile time become assignments of their result.
+ * With --remarks it reports each of these, and each expression it couldn't fold along with what
+ * made it TOP (see why_top).
+ *
+ * Later passes therefore never have to look at m_lattice_elem; a constant is simply a literal.
+ */
+
+// What made e TOP: the cause ConstantFolding recorded on e or, for an operator (which doesn't
+// record one), on the first of its operands that is TOP. 0 if there is none.
+inline int why_top(Expr* e)
+{
+    LatticeElem& le = e->m_attribute.m_lattice_elem;
+    if(le != TOP)
+        return 0;
+    if(le.why != 0)
+        return le.why;
+    Expr** ops[2];
+    int n = expr_operands(e, ops);
+    for(int i = 0; i < n; i++){
+        if(int why = why_top(*ops[i]))
+            return why;
+    }
+    return 0;
+}
+
+class FoldRewriter : public Visitor {
+    private:
+        SymTab* m_st;
+        CallGraph* m_cg;
+        map<Stat*, int>& m_evaluated_calls;
+        map<Stat*, const char*>& m_failed_calls;
+
+        // remarks (NULL when off), with the causes the why of a LatticeElem indexes
+        Remarks* m_remarks;
+        vector<string>& m_causes;
+        const char* m_func;
+        int m_depth;            // of fold() calls; 0 for an expression a statement holds
+
+        // What visiting a statement replaced it with. m_stat_replaced is false if the statement stays as it
+        // is; otherwise it is replaced by m_stat_splice (moved out of a branch), or by m_stat_result if that
+        // is NULL (NULL meaning it is removed altogether).
+        bool m_stat_replaced;
+        Stat* m_stat_result;
+        list<Stat_ptr>* m_stat_splice;
+
+        Expr* fold(Expr* e)
+        {
+            LatticeElem& le = e->m_attribute.m_lattice_elem;
+            if(le == TOP || le == BOTTOM || is_literal(e)){
+                if(m_remarks != NULL && m_depth == 0 && le == TOP && !uses_temporary(e))
+                    m_remarks->missed("folding", e->m_attribute.lineno, m_func, "%s not folded: %s",
+                        Remarks::text(e).c_str(), m_causes[why_top(e)].c_str());
+                m_depth++;
+                visit(e);
+                m_depth--;
+                return e;
+            }
+            Expr* literal = make_literal(e->m_attribute.m_basetype, le.value, e);
+            if(m_remarks != NULL && !uses_temporary(e))
+                m_remarks->passed("folding", e->m_attribute.lineno, m_func, "%s folded to %s",
+                    Remarks::text(e).c_str(), Remarks::text(literal).c_str());
+            delete e;
+            return literal;
+        }
+
+        // Why a call to a pure function with constant arguments wasn't run at compile time
+        void remark_not_evaluated(Stat* p, SymName* target, SymName* callee, list<Expr_ptr>* args)
+        {
+            FuncInfo* f = m_cg->resolve(p->m_attribute.m_scope, callee->spelling());
+            if(m_remarks == NULL || f == NULL || !f->m_pure || is_temporary(target->spelling()))
+                return;
+            list<Expr_ptr>::iterator iter;
+            forall(iter,args){
+                if(uses_temporary(*iter))
+                    return;
+            }
+            int i = 1;
+            forall(iter,args){
+                if((*iter)->m_attribute.m_lattice_elem == TOP){
+                    m_remarks->missed("folding", p->m_attribute.lineno, m_func, "call to %s not evaluated: argument %d (%s) not constant: %s",
+                        callee->spelling(), i, Remarks::text(*iter).c_str(), m_causes[why_top(*iter)].c_str());
+                    return;
+                }
+                if((*iter)->m_attribute.m_lattice_elem == BOTTOM)
+                    return;     // never reached
+                i++;
+            }
+            map<Stat*, const char*>::iterator failed = m_failed_calls.find(p);
+            if(failed != m_failed_calls.end())
+                m_remarks->missed("folding", p->m_attribute.lineno, m_func, "call to %s not evaluated: %s",
+                    callee->spelling(), failed->second);
+        }
+
+        void fold_list(list<Expr_ptr>* exprs)
+        {
+            list<Expr_ptr>::iterator expr_iter;
+            forall(expr_iter,exprs){
+                *expr_iter = fold(*expr_iter);
+            }
+        }
+
+        void replace_stat(Stat* result)
+        {
+            m_stat_replaced = true;
+            m_stat_result = result;
+            m_stat_splice = NULL;
+        }
+
+        void splice_stat(Nested_block* block)
+        {
+            m_stat_replaced = true;
+            m_stat_result = NULL;
+            m_stat_splice = block->m_stat_list;
+        }
+
+        void rewrite_stats(list<Stat_ptr>* stats, Attribute* parent)
+        {
+            list<Stat_ptr>::iterator stat_iter = stats->begin();
+            while(stat_iter != stats->end()){
+                Stat* s = *stat_iter;
+                m_stat_replaced = false;
+                visit(s);
+                if(!m_stat_replaced){
+                    stat_iter++;
+                    continue;
+                }
+                if(m_stat_splice != NULL){
+                    list<Stat_ptr>::iterator moved_iter;
+                    forall(moved_iter,m_stat_splice){
+                        (*moved_iter)->m_parent_attribute = parent;
+                    }
+                    stats->splice(stat_iter, *m_stat_splice);
+                } else if(m_stat_result != NULL){
+                    m_stat_result->m_parent_attribute = parent;
+                    stats->insert(stat_iter, m_stat_result);
+                }
+                stat_iter = stats->erase(stat_iter);
+                delete s;
+            }
+        }
+
+    public:
+        FoldRewriter(SymTab* st, CallGraph* cg, map<Stat*, int>& evaluated_calls, map<Stat*, const char*>& failed_calls,
+                Remarks* remarks, vector<string>& causes)
+            : m_evaluated_calls(evaluated_calls), m_failed_calls(failed_calls), m_causes(causes)
+        {
+            m_st = st;
+            m_cg = cg;
+            m_remarks = remarks;
+            m_func = "";
+            m_depth = 0;
+            m_stat_replaced = false;
+            m_stat_result = NULL;
+            m_stat_splice = NULL;
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            const char* saved_func = m_func;
+            m_func = p->m_symname->spelling();
+            visit(p->m_function_block);
+            m_func = saved_func;
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            rewrite_stats(p->m_stat_list, &p->m_attribute);
+            visit(p->m_return);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            rewrite_stats(p->m_stat_list, &p->m_attribute);
+            // the block's last statement may have been replaced; that must not
+            // look like a replacement of the If or While that holds the block
+            m_stat_replaced = false;
+            m_stat_result = NULL;
+            m_stat_splice = NULL;
+        }
+
+        void visitReturn(Return *p)
+        {
+            p->m_expr = fold(p->m_expr);
+        }
+
+        void visitAssignment(Assignment *p)
+        {
+            p->m_expr = fold(p->m_expr);
+        }
+
+        void visitArrayAssignment(ArrayAssignment *p)
+        {
+            p->m_expr_1 = fold(p->m_expr_1);
+            p->m_expr_2 = fold(p->m_expr_2);
+        }
+
+        void visitCall(Call *p)
+        {
+            map<Stat*, int>::iterator iter = m_evaluated_calls.find(p);
+            if(iter == m_evaluated_calls.end()){
+                remark_not_evaluated(p, p->m_symname_1, p->m_symname_2, p->m_expr_list);
+                fold_list(p->m_expr_list);
+                return;
+            }
+            if(m_remarks != NULL && !is_temporary(p->m_symname_1->spelling()))
+                m_remarks->passed("folding", p->m_attribute.lineno, m_func, "call to %s evaluated at compile time: %s = %d",
+                    p->m_symname_2->spelling(), p->m_symname_1->spelling(), iter->second);
+            // the result has the type of the variable it is assigned to
+            Symbol* target = m_st->lookup(p->m_attribute.m_scope, p->m_symname_1->spelling());
+            Stat* result = new Assignment(p->m_symname_1, make_literal(target->m_basetype, iter->second, p));
+            copy_attribute(result, p);
+            p->m_symname_1 = NULL;
+            replace_stat(result);
+        }
+
+        void visitArrayCall(ArrayCall *p)
+        {
+            p->m_expr_1 = fold(p->m_expr_1);
+            map<Stat*, int>::iterator iter = m_evaluated_calls.find(p);
+            if(iter == m_evaluated_calls.end()){
+                remark_not_evaluated(p, p->m_symname_1, p->m_symname_2, p->m_expr_list_2);
+                fold_list(p->m_expr_list_2);
+                return;
+            }
+            if(m_remarks != NULL && !is_temporary(p->m_symname_1->spelling()))
+                m_remarks->passed("folding", p->m_attribute.lineno, m_func, "call to %s evaluated at compile time: %s[...] = %d",
+                    p->m_symname_2->spelling(), p->m_symname_1->spelling(), iter->second);
+            Stat* result = new ArrayAssignment(p->m_symname_1, p->m_expr_1, make_literal(bt_integer, iter->second, p));
+            copy_attribute(result, p);
+            p->m_symname_1 = NULL;
+            p->m_expr_1 = NULL;
+            replace_stat(result);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            p->m_expr = fold(p->m_expr);
+            int cond;
+            if(!is_literal(p->m_expr, &cond)){
+                visit(p->m_nested_block);
+                return;
+            }
+            if(m_remarks != NULL)
+                m_remarks->passed("folding", p->m_attribute.lineno, m_func, "if condition is always %s: %s",
+                    cond ? "true" : "false", cond ? "test removed" : "if removed");
+            if(cond){
+                visit(p->m_nested_block);
+                splice_stat(p->m_nested_block);
+            } else {
+                replace_stat(NULL);
+            }
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            p->m_expr = fold(p->m_expr);
+            int cond;
+            if(!is_literal(p->m_expr, &cond)){
+                visit(p->m_nested_block_1);
+                visit(p->m_nested_block_2);
+                return;
+            }
+            if(m_remarks != NULL)
+                m_remarks->passed("folding", p->m_attribute.lineno, m_func, "if condition is always %s: %s branch removed",
+                    cond ? "true" : "false", cond ? "else" : "then");
+            // the branch that isn't taken was never analyzed, so don't touch it
+            Nested_block* taken = cond ? p->m_nested_block_1 : p->m_nested_block_2;
+            visit(taken);
+            splice_stat(taken);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            p->m_expr = fold(p->m_expr);
+            int cond;
+            if(is_literal(p->m_expr, &cond) && !cond){
+                if(m_remarks != NULL)
+                    m_remarks->passed("folding", p->m_attribute.lineno, m_func, "while condition is false on entry: loop removed");
+                replace_stat(NULL);
+                return;
+            }
+            visit(p->m_nested_block);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+
+        void visitAnd(And *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitDiv(Div *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitCompare(Compare *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitGt(Gt *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitGteq(Gteq *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitLt(Lt *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitLteq(Lteq *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitMinus(Minus *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitNoteq(Noteq *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitOr(Or *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitPlus(Plus *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitTimes(Times *p) { p->m_expr_1 = fold(p->m_expr_1); p->m_expr_2 = fold(p->m_expr_2); }
+        void visitNot(Not *p) { p->m_expr = fold(p->m_expr); }
+        void visitUminus(Uminus *p) { p->m_expr = fold(p->m_expr); }
+        void visitMagnitude(Magnitude *p) { p->m_expr = fold(p->m_expr); }
+        void visitArrayAccess(ArrayAccess *p) { p->m_expr = fold(p->m_expr); }
+        void visitIdent(Ident *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
+
 class ConstantFolding : public CFVisitor {
     private:
         FILE* m_errorfile;
         SymTab* m_st;
+        CallGraph* m_cg;
+
+        typedef map<FuncInfo*, vector<LatticeElem> > ParamSummaries;
+        typedef map<FuncInfo*, LatticeElem> ReturnSummaries;
+
+        // Summaries from the previous whole-program run (read) and the current one (written)
+        ParamSummaries m_params, m_next_params;
+        ReturnSummaries m_returns, m_next_returns;
+        bool m_use_summaries;
+        FuncInfo* m_cur_func;
+
+        // Compile-time evaluation of pure calls. Results are cached across runs (a failed
+        // evaluation is cached too, with the evaluator's reason, so we never retry one that hit a limit).
+        static const int eval_step_limit = 1000000;
+        static const int eval_memory_limit = 1 << 20;
+        typedef pair<FuncInfo*, vector<int> > EvalKey;
+        Evaluator* m_evaluator;
+        map<EvalKey, pair<const char*, int> > m_eval_cache;   // why it gave up (NULL if it didn't), and the result
+        map<Stat*, int> m_evaluated_calls;     // calls of the current run that evaluated, and their result
+        map<Stat*, const char*> m_failed_calls;        // calls of the current run the evaluator gave up on, and why
+
+        // Rounds of loop fixpoints, charged by the size of the loop body
+        Budget m_budget;
+
+        // For remarks: why variables went TOP, indexed by LatticeElem::why (0 is unknown)
+        Remarks* m_remarks;
+        vector<string> m_causes;
+        map<string, int> m_cause_index;
+
+        int cause(const char* format, ...)
+        {
+            char buffer[256];
+            va_list args;
+            va_start(args, format);
+            vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            map<string, int>::iterator iter = m_cause_index.find(buffer);
+            if(iter != m_cause_index.end())
+                return iter->second;
+            m_causes.push_back(buffer);
+            return m_cause_index[buffer] = m_causes.size() - 1;
+        }
+
+        // Give the entries that a join just made TOP a cause: where their values met
+        void blame_join(LatticeElemMap *map, const char* format, int line)
+        {
+            LatticeElemMap::iterator iter;
+            forall(iter,map){
+                if(iter->second == TOP && iter->second.why == 0)
+                    iter->second.why = cause(format, iter->first, line);
+            }
+        }
+
+        // Join the call's argument values into the callee's parameter summary
+        void record_call_args(FuncInfo *f, list<Expr_ptr> *args)
+        {
+            if(f == NULL) return;
+            vector<LatticeElem>& summary = m_next_params[f];
+            if(summary.size() != args->size())
+                summary.assign(args->size(), LatticeElem(BOTTOM));
+            list<Expr_ptr>::iterator arg_iter;
+            int i = 0;
+            forall(arg_iter,args){
+                summary[i++].join((*arg_iter)->m_attribute.m_lattice_elem);
+            }
+        }
+
+        // The value a call to f returns, according to the previous run
+        LatticeElem call_result(FuncInfo *f)
+        {
+            if(f == NULL || !m_use_summaries) return LatticeElem(TOP);
+            ReturnSummaries::iterator iter = m_returns.find(f);
+            // BOTTOM means we haven't seen f return yet; don't build on that
+            if(iter == m_returns.end() || iter->second == BOTTOM) return LatticeElem(TOP);
+            return iter->second;
+        }
+
+        // Overwrite the parameters' TOP with what every call site agreed on
+        void seed_params(Func *p, FuncInfo *f, LatticeElemMap *in)
+        {
+            if(f == NULL || !m_use_summaries) return;
+            ParamSummaries::iterator iter = m_params.find(f);
+            if(iter == m_params.end()) return;
+            list<Param_ptr>::iterator param_iter;
+            unsigned int i = 0;
+            forall(param_iter,p->m_param_list){
+                if(i >= iter->second.size()) break;
+                LatticeElem& e = iter->second[i++];
+                const char* name = (*param_iter)->m_symname->spelling();
+                if(e != BOTTOM)
+                    (*in)[name]=e;
+                if(e == TOP)
+                    (*in)[name].why=cause("%s: the calls to %s pass it different values", name, p->m_symname->spelling());
+            }
+        }
+
+        // Run f at compile time if it is pure and all of the arguments are known. On success,
+        // *result is what the call returns.
+        // *reason is set to why the evaluator gave up, or NULL if it wasn't run or succeeded
+        bool evaluate_call(FuncInfo *f, list<Expr_ptr> *args, int *result, const char** reason)
+        {
+            *reason = NULL;
+            if(f == NULL || !f->m_pure) return false;
+            vector<int> values;
+            list<Expr_ptr>::iterator arg_iter;
+            forall(arg_iter,args){
+                LatticeElem& e = (*arg_iter)->m_attribute.m_lattice_elem;
+                if(e == TOP || e == BOTTOM) return false;
+                values.push_back(e.value);
+            }
+            EvalKey key(f, values);
+            map<EvalKey, pair<const char*, int> >::iterator iter = m_eval_cache.find(key);
+            if(iter == m_eval_cache.end()){
+                pair<const char*, int> outcome;
+                m_evaluator->evaluate(f, values, &outcome.second);
+                outcome.first = m_evaluator->abort_reason();
+                iter = m_eval_cache.insert(make_pair(key, outcome)).first;
+            }
+            *result = iter->second.second;
+            *reason = iter->second.first;
+            return *reason == NULL;
+        }
+
+        void record_failed_call(Stat* p, const char* reason)
+        {
+            if(reason != NULL)
+                m_failed_calls[p]=reason;
+            else
+                m_failed_calls.erase(p);
+        }
+
+        bool summaries_equal()
+        {
+            if(m_params.size() != m_next_params.size() || m_returns.size() != m_next_returns.size())
+                return false;
+            ParamSummaries::iterator p_iter;
+            forall(p_iter,(&m_params)){
+                ParamSummaries::iterator other = m_next_params.find(p_iter->first);
+                if(other == m_next_params.end() || other->second.size() != p_iter->second.size())
+                    return false;
+                for(unsigned int i = 0; i < p_iter->second.size(); i++)
+                    if(other->second[i] != p_iter->second[i])
+                        return false;
+            }
+            ReturnSummaries::iterator r_iter;
+            forall(r_iter,(&m_returns)){
+                ReturnSummaries::iterator other = m_next_returns.find(r_iter->first);
+                if(other == m_next_returns.end() || other->second != r_iter->second)
+                    return false;
+            }
+            return true;
+        }
+
+        // Set every variable the callee may modify to TOP. We match by name, since that's
+        // how the LatticeElemMap is keyed; a shadowed variable of the same name just gets
+        // killed too, which is safe. Unresolvable calls fall back to killing everything.
+        void kill_call_effects(Stat *p, FuncInfo *f, LatticeElemMap *in)
+        {
+            LatticeElemMap::iterator lem_iter;
+            if(f == NULL){
+                int why = cause("killed by a call at line %d", p->m_attribute.lineno);
+                forall(lem_iter,in){
+                    lem_iter->second=TOP;
+                    lem_iter->second.why=why;
+                }
+                return;
+            }
+            set<Symbol*>::iterator mod_iter;
+            forall(mod_iter,(&f->m_mod)){
+                const char* name = m_cg->name_of(*mod_iter);
+                if(name == NULL) continue;
+                lem_iter = in->find(name);
+                if(lem_iter != in->end()){
+                    lem_iter->second=TOP;
+                    lem_iter->second.why=cause("%s killed by call to %s at line %d", name,
+                        f->m_func->m_symname->spelling(), p->m_attribute.lineno);
+                }
+            }
+        }
 
     public:
         LatticeElemMap* visitProgram(Program *p, LatticeElemMap *in)
         {
-            in = visit_children_of(p, in);
+            // Every run can only make use of the summaries the previous one produced, so
+            // keep going until a run hands back exactly what it was given. Run 0 has no
+            // summaries (every parameter and call result is TOP), and a summary may move
+            // either way between runs, since what one run learns can make calls and
+            // branches appear or disappear in the next. Nothing makes that converge, so
+            // max_runs is what bounds the loop. If it is reached, the summaries are
+            // thrown away and one more run treats every parameter and call result as
+            // TOP, which assumes nothing about other functions and so is always sound.
+            int max_runs = 4;
+            for(unsigned int i = 0; i < m_cg->m_funcs.size(); i++)
+                max_runs += 2 * (1 + m_cg->m_funcs[i]->m_func->m_param_list->size());
+
+            m_use_summaries = true;
+            for(int run = 0; ; run++){
+                m_next_params.clear();
+                m_next_returns.clear();
+                m_evaluated_calls.clear();
+                m_failed_calls.clear();
+                in = visit_children_of(p, in);
+                bool stable = summaries_equal();
+                m_params.swap(m_next_params);
+                m_returns.swap(m_next_returns);
+                if(stable)
+                    break;
+                if(run == max_runs){
+                    // didn't settle; redo everything with TOP parameters and results
+                    m_use_summaries = false;
+                    m_evaluated_calls.clear();
+                    m_failed_calls.clear();
+                    in = visit_children_of(p, in);
+                    break;
+                }
+            }
+
+            // Only the last run's facts hold, so rewrite the tree according to those
+            FoldRewriter rewriter(m_st, m_cg, m_evaluated_calls, m_failed_calls, m_remarks, m_causes);
+            rewriter.visit(p);
             return in;
         }
 
         LatticeElemMap* visitFunc(Func *p, LatticeElemMap *in)
         {
-            // Intraprocedural; so let's start a new analysis for each function with a blank LatticeElemMap
+            // Every function starts with a blank LatticeElemMap; the only facts that flow
+            // in from outside are the parameter summaries.
+            FuncInfo* saved_func = m_cur_func;
+            m_cur_func = m_cg->info(p);
+            Func* saved_budget = m_budget.current();
+            m_budget.start(p);
+
             LatticeElemMap* newMap = new LatticeElemMap();
-            newMap = visit_children_of(p, newMap);
+            newMap = visit_list(p->m_param_list, newMap);
+            seed_params(p, m_cur_func, newMap);
+            newMap = visit(p->m_function_block, newMap);
             delete newMap;
+
+            m_cur_func = saved_func;
+            m_budget.start(saved_budget);
             return in;
         }
 
@@ -153,6 +720,8 @@ class ConstantFolding : public CFVisitor {
             //end testing block
             //tprint("\tAdding element with value top\n");
             (*in)[p->m_symname->spelling()]=TOP;
+            (*in)[p->m_symname->spelling()].why=cause("%s is a parameter of %s",
+                p->m_symname->spelling(), m_budget.name());
             //tprint("\tSanity check, value is found: %s\n",(in->find(p->m_symname->spelling()) != in->end())?"true":"false");
             return in;
 
@@ -185,6 +754,7 @@ class ConstantFolding : public CFVisitor {
                 //end testing block
                 //tprint("\tAdding element with value top\n");
                 (*in)[(*symname_iter)->spelling()]=TOP;
+                (*in)[(*symname_iter)->spelling()].why=cause("%s is read before it is assigned", (*symname_iter)->spelling());
                 //tprint("\tSanity check, value is found: %s\n",(in->find(strdup((*symname_iter)->spelling())) != in->end())?"true":"false");
             }
             return in;
@@ -193,13 +763,18 @@ class ConstantFolding : public CFVisitor {
         LatticeElemMap* visitReturn(Return *p, LatticeElemMap *in)
         {
             in = visit_children_of(p, in);
+            if(m_cur_func != NULL)
+                m_next_returns[m_cur_func].join(p->m_expr->m_attribute.m_lattice_elem);
             return in;
         }
 
         LatticeElemMap* visitAssignment(Assignment *p, LatticeElemMap *in)
         {
             in = visit_children_of(p, in);
-            (*in)[p->m_symname->spelling()]=p->m_expr->m_attribute.m_lattice_elem;
+            LatticeElem& e = (*in)[p->m_symname->spelling()];
+            e=p->m_expr->m_attribute.m_lattice_elem;
+            if(e == TOP)
+                e.why=why_top(p->m_expr);
             return in;
         }
 
@@ -212,9 +787,23 @@ class ConstantFolding : public CFVisitor {
         LatticeElemMap* visitCall(Call *p, LatticeElemMap *in)
         {
             in = visit_children_of(p, in);
-            LatticeElemMap::iterator lem_iter;
-            forall(lem_iter,in){
-                lem_iter->second=TOP;
+            FuncInfo* f = m_cg->resolve(p->m_attribute.m_scope, p->m_symname_2->spelling());
+            record_call_args(f, p->m_expr_list);
+            kill_call_effects(p, f, in);
+            int value;
+            const char* reason;
+            if(evaluate_call(f, p->m_expr_list, &value, &reason)){
+                (*in)[p->m_symname_1->spelling()]=value;
+                m_evaluated_calls[p]=value;
+                m_failed_calls.erase(p);
+            } else {
+                LatticeElem& e = (*in)[p->m_symname_1->spelling()];
+                e=call_result(f);
+                if(e == TOP)
+                    e.why=cause("%s is the result of a call to %s at line %d, which isn't constant",
+                        p->m_symname_1->spelling(), p->m_symname_2->spelling(), p->m_attribute.lineno);
+                m_evaluated_calls.erase(p);
+                record_failed_call(p, reason);
             }
             return in;
         }
@@ -222,9 +811,17 @@ class ConstantFolding : public CFVisitor {
         LatticeElemMap* visitArrayCall(ArrayCall *p, LatticeElemMap *in)
         {
             in = visit_children_of(p, in);
-            LatticeElemMap::iterator lem_iter;
-            forall(lem_iter,in){
-                lem_iter->second=TOP;
+            FuncInfo* f = m_cg->resolve(p->m_attribute.m_scope, p->m_symname_2->spelling());
+            record_call_args(f, p->m_expr_list_2);
+            kill_call_effects(p, f, in);
+            int value;
+            const char* reason;
+            if(evaluate_call(f, p->m_expr_list_2, &value, &reason)){
+                m_evaluated_calls[p]=value;
+                m_failed_calls.erase(p);
+            } else {
+                m_evaluated_calls.erase(p);
+                record_failed_call(p, reason);
             }
             return in;
         }
@@ -243,6 +840,7 @@ class ConstantFolding : public CFVisitor {
                 // Join the original "in" lattice_elem_map with the clone,
                 // storing the result in the clone
                 join_lattice_elem_maps(clone, in);
+                blame_join(clone, "%s may or may not be changed by the if at line %d", p->m_attribute.lineno);
 
                 // Make "in" point to the clone, deleting in
                 delete in;
@@ -265,6 +863,7 @@ class ConstantFolding : public CFVisitor {
                 // Join the original "in" lattice_elem_map with the clone,
                 // storing the result in the clone
                 join_lattice_elem_maps(clone, in);
+                blame_join(clone, "%s gets different values in the branches of the if at line %d", p->m_attribute.lineno);
 
                 // Make "in" point to the clone, deleting in
                 delete in;
@@ -303,7 +902,24 @@ class ConstantFolding : public CFVisitor {
             }
 
             // And then, as many times as needed,
+            int size = SideEffects::list_size(p->m_nested_block->m_stat_list);
             while(true) {
+                // Out of budget: nothing is known past the loop head. One more visit with every
+                // variable TOP leaves the attributes in the loop matching that.
+                if (!m_budget.spend(size)) {
+                    int why = cause("the analysis budget for %s ran out at the loop at line %d",
+                        m_budget.name(), p->m_attribute.lineno);
+                    LatticeElemMap::iterator iter;
+                    forall(iter,in){
+                        iter->second=TOP;
+                        iter->second.why=why;
+                    }
+                    LatticeElemMap* clone = new LatticeElemMap(*in);
+                    clone = visit(p->m_nested_block, clone);
+                    delete clone;
+                    return visit(p->m_expr,in);
+                }
+
                 // Copy this lattice elem map into another
                 LatticeElemMap* clone = new LatticeElemMap(*in);
 
@@ -316,6 +932,7 @@ class ConstantFolding : public CFVisitor {
                 // Join the original "in" lattice_elem_map with the clone,
                 // storing the result in the clone
                 join_lattice_elem_maps(clone, in);
+                blame_join(clone, "%s changes in the loop at line %d", p->m_attribute.lineno);
 
                 // Compare them
                 bool equal = lattice_maps_equal(in, clone);
@@ -376,8 +993,8 @@ class ConstantFolding : public CFVisitor {
             LatticeElem &e1 = p->m_expr_1->m_attribute.m_lattice_elem;
             LatticeElem &e2 = p->m_expr_2->m_attribute.m_lattice_elem;
 
-            // If it's TOP, then we cannot know anything about this expression; it should be TOP as well
-            if (e1.value || e2.value){
+            // TOP's value is nonzero too, so check for it first: TOP || false is TOP, not true
+            if ((e1 != TOP && e1.value) || (e2 != TOP && e2.value)){
                 p->m_attribute.m_lattice_elem = true;
             } else if (e1 == TOP || e2 == TOP){
                 p->m_attribute.m_lattice_elem = TOP;
@@ -628,6 +1245,7 @@ class ConstantFolding : public CFVisitor {
             in = visit_children_of(p, in);
             if(in->find(p->m_symname->spelling()) == in->end()){
                 p->m_attribute.m_lattice_elem = TOP;
+                p->m_attribute.m_lattice_elem.why = cause("%s belongs to an enclosing function", p->m_symname->spelling());
             } else{
                 p->m_attribute.m_lattice_elem = (*in)[p->m_symname->spelling()];
             }
@@ -638,6 +1256,7 @@ class ConstantFolding : public CFVisitor {
         {
             in = visit_children_of(p, in);
             p->m_attribute.m_lattice_elem = TOP;
+            p->m_attribute.m_lattice_elem.why = cause("the elements of %s aren't tracked", p->m_symname->spelling());
             return in;
         }
 
@@ -666,13 +1285,20 @@ class ConstantFolding : public CFVisitor {
             return in;
         }
 
-        ConstantFolding(FILE* errorfile, SymTab* st) 
+        ConstantFolding(FILE* errorfile, SymTab* st, CallGraph* cg, long budget, Remarks* remarks = NULL)
+            : m_budget("folding", budget)
         {
+            m_remarks = remarks;
+            m_causes.push_back("not constant");
             m_errorfile = errorfile;
             m_st = st; 
+            m_cg = cg;
+            m_use_summaries = true;
+            m_cur_func = NULL;
+            m_evaluator = new Evaluator(st, cg, eval_step_limit, eval_memory_limit);
         }
 
-        ~ConstantFolding() {}
+        ~ConstantFolding() { delete m_evaluator; }
 };
 
 
@@ -0,0 +1,133 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include <stdio.h>
+#include <string.h>
+#include <set>
+#include <vector>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Dead function elimination. Only functions reachable from Main through the call graph can
+ * ever run, so every other Func (top level or nested) is taken out of the tree before codegen.
+ * Inlining and folding leave many of these behind: a helper whose calls were all inlined or
+ * evaluated at compile time is still in the program otherwise.
+ *
+ * The removed functions are kept (detached) until the pass is deleted, so main.cpp can measure
+ * the code they would have produced. A nested function inside a removed function goes with it.
+ */
+
+class DeadFunctions : public Visitor {
+    private:
+        CallGraph* m_cg;
+        set<FuncInfo*> m_live;
+        vector<Func*> m_removed;
+
+        void mark(FuncInfo* f)
+        {
+            if(!m_live.insert(f).second)
+                return;
+            set<FuncInfo*>::iterator iter;
+            forall(iter,(&f->m_callees)){
+                mark(*iter);
+            }
+        }
+
+        void sweep(list<Func_ptr>* funcs)
+        {
+            list<Func_ptr>::iterator iter = funcs->begin();
+            while(iter != funcs->end()){
+                FuncInfo* f = m_cg->info(*iter);
+                if(f != NULL && !m_live.count(f)){
+                    m_removed.push_back(*iter);
+                    iter = funcs->erase(iter);
+                } else {
+                    sweep((*iter)->m_function_block->m_func_list);
+                    iter++;
+                }
+            }
+        }
+
+    public:
+        DeadFunctions(CallGraph* cg)
+        {
+            m_cg = cg;
+        }
+
+        ~DeadFunctions()
+        {
+            for(unsigned i = 0; i < m_removed.size(); i++)
+                delete m_removed[i];
+        }
+
+        // The functions taken out of the tree
+        const vector<Func*>& removed()
+        {
+            return m_removed;
+        }
+
+        void print_stats(FILE* out, long bytes)
+        {
+            fprintf(out, "deadfuncs: %d functions removed (%ld bytes of assembly)", (int) m_removed.size(), bytes);
+            for(unsigned i = 0; i < m_removed.size(); i++)
+                fprintf(out, "%s %s", i == 0 ? ":" : ",", m_removed[i]->m_symname->spelling());
+            fprintf(out, "\n");
+        }
+
+        void visitProgram(Program *p)
+        {
+            list<Func_ptr>::iterator iter;
+            forall(iter,p->m_func_list){
+                if(strcmp((*iter)->m_symname->spelling(), "Main") == 0)
+                    mark(m_cg->info(*iter));
+            }
+            // no Main, nothing can run; leave the program alone rather than emit nothing
+            if(m_live.empty())
+                return;
+            sweep(p->m_func_list);
+        }
+
+        void visitFunc(Func *p) {}
+        void visitFunction_block(Function_block *p) {}
+        void visitNested_block(Nested_block *p) {}
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitIfNoElse(IfNoElse *p) {}
+        void visitIfWithElse(IfWithElse *p) {}
+        void visitWhileLoop(WhileLoop *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
@@ -0,0 +1,347 @@
+#ifndef EFFECTS_HPP
+#define EFFECTS_HPP
+
+#include "ast.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include <list>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+/*
+ * What statements may write and expressions read, and where expressions are evaluated, for the
+ * passes that move expressions around: value numbering, partial redundancy elimination and the
+ * loop passes. What a call may write comes from the callee's mod summary in "callgraph.h".
+ */
+
+class SideEffects {
+    private:
+        SymTab* m_st;
+        CallGraph* m_cg;
+        bool m_bounds_check;    // array indexes are checked (--bounds-check), so accesses may trap
+
+    public:
+        SideEffects(SymTab* st, CallGraph* cg, bool bounds_check)
+        {
+            m_st = st;
+            m_cg = cg;
+            m_bounds_check = bounds_check;
+        }
+
+        // may_trap from "astutil.h", with array indexes checked or not as the pass was told
+        bool may_trap(Expr* e)
+        {
+            return ::may_trap(e, m_st, m_bounds_check);
+        }
+
+        bool may_trap(ArrayAssignment* p)
+        {
+            return ::may_trap(p, m_st, m_bounds_check);
+        }
+
+        Symbol* lookup(Visitable* p, SymName* name)
+        {
+            return m_st->lookup(p->m_attribute.m_scope, name->spelling());
+        }
+
+        void reads(Expr* e, set<Symbol*>& reads)
+        {
+            if(Ident* id = dynamic_cast<Ident*>(e))
+                reads.insert(lookup(id, id->m_symname));
+            else if(ArrayAccess* aa = dynamic_cast<ArrayAccess*>(e))
+                reads.insert(lookup(aa, aa->m_symname));
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            for(int i = 0; i < n; i++)
+                this->reads(*ops[i], reads);
+        }
+
+        void call_mods(Stat* p, SymName* callee, set<Symbol*>& mods)
+        {
+            // typecheck made sure every call resolves
+            FuncInfo* f = m_cg->resolve(p->m_attribute.m_scope, callee->spelling());
+            if(f != NULL)
+                mods.insert(f->m_mod.begin(), f->m_mod.end());
+        }
+
+        // Everything s may write
+        void stat_mods(Stat* s, set<Symbol*>& mods)
+        {
+            if(Assignment* a = dynamic_cast<Assignment*>(s)){
+                mods.insert(lookup(a, a->m_symname));
+            } else if(ArrayAssignment* aa = dynamic_cast<ArrayAssignment*>(s)){
+                mods.insert(lookup(aa, aa->m_symname));
+            } else if(Call* c = dynamic_cast<Call*>(s)){
+                mods.insert(lookup(c, c->m_symname_1));
+                call_mods(c, c->m_symname_2, mods);
+            } else if(ArrayCall* ac = dynamic_cast<ArrayCall*>(s)){
+                mods.insert(lookup(ac, ac->m_symname_1));
+                call_mods(ac, ac->m_symname_2, mods);
+            } else if(IfNoElse* i = dynamic_cast<IfNoElse*>(s)){
+                list_mods(i->m_nested_block->m_stat_list, mods);
+            } else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(s)){
+                list_mods(ie->m_nested_block_1->m_stat_list, mods);
+                list_mods(ie->m_nested_block_2->m_stat_list, mods);
+            } else if(WhileLoop* w = dynamic_cast<WhileLoop*>(s)){
+                list_mods(w->m_nested_block->m_stat_list, mods);
+            }
+        }
+
+        void list_mods(list<Stat_ptr>* stats, set<Symbol*>& mods)
+        {
+            list<Stat_ptr>::iterator iter;
+            for(iter = stats->begin(); iter != stats->end(); iter++){
+                stat_mods(*iter, mods);
+            }
+        }
+
+        static bool intersect(const set<Symbol*>& a, const set<Symbol*>& b)
+        {
+            set<Symbol*>::const_iterator iter;
+            for(iter = a.begin(); iter != a.end(); iter++)
+                if(b.count(*iter) != 0)
+                    return true;
+            return false;
+        }
+
+        // The fields holding the expressions s evaluates before doing anything else, in the order
+        // it evaluates them (not those in its nested blocks)
+        static void expr_slots(Stat* s, vector<Expr**>& slots)
+        {
+            list<Expr_ptr>* args = NULL;
+            if(Assignment* a = dynamic_cast<Assignment*>(s)){
+                slots.push_back(&a->m_expr);
+            } else if(ArrayAssignment* aa = dynamic_cast<ArrayAssignment*>(s)){
+                slots.push_back(&aa->m_expr_1);
+                slots.push_back(&aa->m_expr_2);
+            } else if(Call* c = dynamic_cast<Call*>(s)){
+                args = c->m_expr_list;
+            } else if(ArrayCall* ac = dynamic_cast<ArrayCall*>(s)){
+                slots.push_back(&ac->m_expr_1);
+                args = ac->m_expr_list_2;
+            } else if(IfNoElse* i = dynamic_cast<IfNoElse*>(s)){
+                slots.push_back(&i->m_expr);
+            } else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(s)){
+                slots.push_back(&ie->m_expr);
+            } else if(WhileLoop* w = dynamic_cast<WhileLoop*>(s)){
+                slots.push_back(&w->m_expr);
+            }
+            if(args != NULL){
+                list<Expr_ptr>::iterator iter;
+                for(iter = args->begin(); iter != args->end(); iter++){
+                    slots.push_back(&*iter);
+                }
+            }
+        }
+
+        void evaluated(Stat* s, vector<Expr*>& exprs)
+        {
+            vector<Expr**> slots;
+            expr_slots(s, slots);
+            for(unsigned i = 0; i < slots.size(); i++)
+                exprs.push_back(*slots[i]);
+        }
+
+        // The blocks nested in s, and their statement lists
+        static void nested_blocks(Stat* s, vector<Nested_block*>& blocks)
+        {
+            if(IfNoElse* i = dynamic_cast<IfNoElse*>(s)){
+                blocks.push_back(i->m_nested_block);
+            } else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(s)){
+                blocks.push_back(ie->m_nested_block_1);
+                blocks.push_back(ie->m_nested_block_2);
+            } else if(WhileLoop* w = dynamic_cast<WhileLoop*>(s)){
+                blocks.push_back(w->m_nested_block);
+            }
+        }
+
+        static void nested_lists(Stat* s, vector<list<Stat_ptr>*>& lists)
+        {
+            vector<Nested_block*> blocks;
+            nested_blocks(s, blocks);
+            for(unsigned i = 0; i < blocks.size(); i++)
+                lists.push_back(blocks[i]->m_stat_list);
+        }
+
+        // Number of statements and expression nodes in stats, as a measure of code size
+        static int list_size(list<Stat_ptr>* stats)
+        {
+            int result = 0;
+            list<Stat_ptr>::iterator iter;
+            for(iter = stats->begin(); iter != stats->end(); iter++){
+                result++;
+                vector<Expr**> slots;
+                expr_slots(*iter, slots);
+                for(unsigned i = 0; i < slots.size(); i++)
+                    result += expr_size(*slots[i]);
+                vector<list<Stat_ptr>*> lists;
+                nested_lists(*iter, lists);
+                for(unsigned i = 0; i < lists.size(); i++)
+                    result += list_size(lists[i]);
+            }
+            return result;
+        }
+
+        // A copy of s, typechecked like s (see copy_expr in "astutil.h")
+        static Stat* copy_stat(Stat* s)
+        {
+            Stat* copy = s->clone();
+            copy_stat_attributes(copy, s);
+            return copy;
+        }
+
+        static void copy_stat_attributes(Stat* to, Stat* from)
+        {
+            to->m_attribute = from->m_attribute;
+            to->m_parent_attribute = from->m_parent_attribute;
+            vector<Expr**> slots_to, slots_from;
+            expr_slots(to, slots_to);
+            expr_slots(from, slots_from);
+            for(unsigned i = 0; i < slots_to.size(); i++){
+                copy_attributes_deep(*slots_to[i], *slots_from[i]);
+                (*slots_to[i])->m_parent_attribute = &to->m_attribute;
+            }
+            vector<Nested_block*> blocks_to, blocks_from;
+            nested_blocks(to, blocks_to);
+            nested_blocks(from, blocks_from);
+            for(unsigned i = 0; i < blocks_to.size(); i++){
+                blocks_to[i]->m_attribute = blocks_from[i]->m_attribute;
+                blocks_to[i]->m_parent_attribute = &to->m_attribute;
+                list<Stat_ptr>::iterator t = blocks_to[i]->m_stat_list->begin();
+                list<Stat_ptr>::iterator f = blocks_from[i]->m_stat_list->begin();
+                for(; t != blocks_to[i]->m_stat_list->end(); t++, f++){
+                    copy_stat_attributes(*t, *f);
+                    (*t)->m_parent_attribute = &blocks_to[i]->m_attribute;
+                }
+            }
+        }
+
+        // The fields holding every expression evaluated anywhere in stats
+        void expr_slots_anywhere(list<Stat_ptr>* stats, vector<Expr**>& slots)
+        {
+            list<Stat_ptr>::iterator iter;
+            for(iter = stats->begin(); iter != stats->end(); iter++){
+                expr_slots(*iter, slots);
+                vector<list<Stat_ptr>*> lists;
+                nested_lists(*iter, lists);
+                for(unsigned i = 0; i < lists.size(); i++)
+                    expr_slots_anywhere(lists[i], slots);
+            }
+        }
+
+        void evaluated_anywhere(list<Stat_ptr>* stats, vector<Expr*>& exprs)
+        {
+            vector<Expr**> slots;
+            expr_slots_anywhere(stats, slots);
+            for(unsigned i = 0; i < slots.size(); i++)
+                exprs.push_back(*slots[i]);
+        }
+
+        // Everything s may read, including what the functions it calls may read
+        void stat_reads(Stat* s, set<Symbol*>& read)
+        {
+            list<Stat_ptr> single(1, s);
+            vector<Expr**> slots;
+            expr_slots_anywhere(&single, slots);
+            for(unsigned i = 0; i < slots.size(); i++)
+                reads(*slots[i], read);
+            calls_reads(&single, read);
+        }
+
+        void calls_reads(list<Stat_ptr>* stats, set<Symbol*>& read)
+        {
+            list<Stat_ptr>::iterator iter;
+            for(iter = stats->begin(); iter != stats->end(); iter++){
+                FuncInfo* f = NULL;
+                if(Call* c = dynamic_cast<Call*>(*iter))
+                    f = m_cg->resolve(c->m_attribute.m_scope, c->m_symname_2->spelling());
+                else if(ArrayCall* ac = dynamic_cast<ArrayCall*>(*iter))
+                    f = m_cg->resolve(ac->m_attribute.m_scope, ac->m_symname_2->spelling());
+                if(f != NULL)
+                    read.insert(f->m_ref.begin(), f->m_ref.end());
+                vector<list<Stat_ptr>*> lists;
+                nested_lists(*iter, lists);
+                for(unsigned i = 0; i < lists.size(); i++)
+                    calls_reads(lists[i], read);
+            }
+        }
+
+        // Might s not get to the statement after it, other than by trapping?
+        static bool may_not_return(Stat* s)
+        {
+            if(dynamic_cast<Call*>(s) || dynamic_cast<ArrayCall*>(s) || dynamic_cast<WhileLoop*>(s))
+                return true;
+            vector<list<Stat_ptr>*> lists;
+            nested_lists(s, lists);
+            for(unsigned i = 0; i < lists.size(); i++){
+                list<Stat_ptr>::iterator iter;
+                for(iter = lists[i]->begin(); iter != lists[i]->end(); iter++){
+                    if(may_not_return(*iter))
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        // Add the int and bool subexpressions of e with at least min_size nodes to out, operands first
+        static void subexpressions(Expr* e, int min_size, vector<Expr*>& out)
+        {
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            for(int i = 0; i < n; i++)
+                subexpressions(*ops[i], min_size, out);
+            Basetype type = e->m_attribute.m_basetype;
+            if((type == bt_integer || type == bt_boolean) && expr_size(e) >= min_size)
+                out.push_back(e);
+        }
+
+        static int count_equal(vector<Expr*>& exprs, Expr* e)
+        {
+            int n = 0;
+            vector<Expr*>::iterator iter;
+            for(iter = exprs.begin(); iter != exprs.end(); iter++){
+                if(expr_equal(*iter, e))
+                    n++;
+            }
+            return n;
+        }
+
+        // Every occurrence of a subexpression (as in subexpressions) computed between from and to,
+        // and then in ret if it isn't NULL, before any of its operands may be written. Divisions
+        // only count if traps is true and nothing before them might not return.
+        void anticipated(list<Stat_ptr>::iterator from, list<Stat_ptr>::iterator to, Expr* ret,
+            bool traps, int min_size, vector<Expr*>& out)
+        {
+            set<Symbol*> mods;
+            bool may_stop = false;
+            for(list<Stat_ptr>::iterator iter = from; ; iter++){
+                vector<Expr*> exprs;
+                if(iter != to)
+                    evaluated(*iter, exprs);
+                else if(ret != NULL)
+                    exprs.push_back(ret);
+                vector<Expr*> subs;
+                vector<Expr*>::iterator e;
+                for(e = exprs.begin(); e != exprs.end(); e++){
+                    subexpressions(*e, min_size, subs);
+                }
+                for(e = subs.begin(); e != subs.end(); e++){
+                    if(may_trap(*e) && (!traps || may_stop))
+                        continue;
+                    set<Symbol*> read;
+                    reads(*e, read);
+                    if(!intersect(read, mods))
+                        out.push_back(*e);
+                }
+                if(iter == to)
+                    break;
+                stat_mods(*iter, mods);
+                may_stop |= may_not_return(*iter);
+            }
+        }
+};
+
+#endif //EFFECTS_HPP
@@ -0,0 +1,393 @@
+#ifndef EVALUATOR_HPP
+#define EVALUATOR_HPP
+
+#include "ast.h"
+#include "symtab.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "callgraph.h"
+#include <vector>
+#include <map>
+#include <limits.h>
+
+using namespace std;
+
+/*
+ * An interpreter for the AST, used to run pure functions at compile time.
+ *
+ * It follows the semantics of the code Codegen emits: 32 bit wrap-around arithmetic,
+ * division truncating toward zero, booleans as 0/1, and both operands of && and || are
+ * always evaluated. Anything the generated code would trap on or that depends on the
+ * machine state (division by zero, an out of bounds index, reading a variable before it
+ * was written) makes the evaluation give up instead of guessing.
+ *
+ * Evaluation is bounded by a step limit (statements plus expression nodes executed), a
+ * memory limit (words of live variables across all frames) and a call depth limit. Running
+ * out of any of them also makes it give up; a failed evaluation never affects the program.
+ *
+ * Usage:
+ *   Evaluator ev(st, cg, step_limit, memory_limit);
+ *   int result;
+ *   if (ev.evaluate(func_info, args, &result)) ... // result is what the call returns
+ */
+
+struct EvalAbort
+{
+    const char* m_reason;
+    EvalAbort(const char* reason) : m_reason(reason) {}
+};
+
+struct EvalCell
+{
+    vector<int> m_value;
+    vector<char> m_init;    // nothing may be read before it was written
+};
+
+struct EvalFrame
+{
+    FuncInfo* m_func;
+    EvalFrame* m_parent;    // frame of the lexically enclosing function (static link)
+    map<Symbol*, EvalCell> m_cells;
+    int m_words;
+};
+
+class Evaluator : public Visitor
+{
+    private:
+        SymTab* m_st;
+        CallGraph* m_cg;
+
+        int m_step_limit;
+        int m_memory_limit;
+        static const int depth_limit = 2000;
+
+        int m_steps;
+        int m_words;
+        int m_depth;
+        EvalFrame* m_frame;
+        int m_value;            // result of the last expression visited
+        const char* m_abort_reason;     // why the last evaluate() gave up, NULL on success
+
+        void step()
+        {
+            if (++m_steps > m_step_limit)
+                throw EvalAbort("step limit exceeded");
+        }
+
+        static int wrap(unsigned int v) { return (int) v; }
+
+        EvalCell& cell(Visitable* p, SymName* name)
+        {
+            Symbol* s = m_st->lookup(p->m_attribute.m_scope, name->spelling());
+            if (s == NULL)
+                throw EvalAbort("unknown variable");
+            EvalFrame* f = m_frame;
+            while (f != NULL && f->m_func->m_scope != s->get_scope())
+                f = f->m_parent;
+            if (f == NULL)
+                throw EvalAbort("access to a variable of an enclosing function");
+            map<Symbol*, EvalCell>::iterator iter = f->m_cells.find(s);
+            if (iter == f->m_cells.end())
+                throw EvalAbort("unknown variable");
+            return iter->second;
+        }
+
+        int read(EvalCell& c, int index)
+        {
+            if (index < 0 || index >= (int) c.m_value.size())
+                throw EvalAbort("array index out of bounds");
+            if (!c.m_init[index])
+                throw EvalAbort("read of an uninitialized variable");
+            return c.m_value[index];
+        }
+
+        void write(EvalCell& c, int index, int value)
+        {
+            if (index < 0 || index >= (int) c.m_value.size())
+                throw EvalAbort("array index out of bounds");
+            c.m_value[index] = value;
+            c.m_init[index] = 1;
+        }
+
+        int eval(Expr* e)
+        {
+            visit(e);
+            return m_value;
+        }
+
+        void declare(EvalFrame* f, Symbol* s, int words)
+        {
+            m_words += words;
+            f->m_words += words;
+            if (m_words > m_memory_limit)
+                throw EvalAbort("memory limit exceeded");
+            EvalCell& c = f->m_cells[s];
+            c.m_value.assign(words, 0);
+            c.m_init.assign(words, 0);
+        }
+
+        int call(Stat* p, SymName* callee, list<Expr_ptr>* args)
+        {
+            FuncInfo* f = m_cg->resolve(p->m_attribute.m_scope, callee->spelling());
+            if (f == NULL)
+                throw EvalAbort("unknown function");
+            vector<int> values;
+            list<Expr_ptr>::iterator iter;
+            for (iter = args->begin(); iter != args->end(); iter++)
+                values.push_back(eval(*iter));
+
+            // the callee's static link is the closest activation of its enclosing function
+            EvalFrame* parent = m_frame;
+            while (parent != NULL && parent->m_func != f->m_parent)
+                parent = parent->m_parent;
+            if (f->m_parent != NULL && parent == NULL)
+                throw EvalAbort("call outside of the evaluated functions");
+            return run(f, parent, values);
+        }
+
+        int run(FuncInfo* f, EvalFrame* parent, vector<int>& args)
+        {
+            if (++m_depth > depth_limit)
+                throw EvalAbort("call depth limit exceeded");
+
+            EvalFrame frame;
+            frame.m_func = f;
+            frame.m_parent = parent;
+            frame.m_words = 0;
+            EvalFrame* saved = m_frame;
+            m_frame = &frame;
+
+            try {
+                Func* p = f->m_func;
+                Function_block* body = p->m_function_block;
+                list<Param_ptr>::iterator param_iter;
+                unsigned int i = 0;
+                for (param_iter = p->m_param_list->begin(); param_iter != p->m_param_list->end(); param_iter++) {
+                    Symbol* s = m_st->lookup_single(f->m_scope, (*param_iter)->m_symname->spelling());
+                    declare(&frame, s, 1);
+                    if (i < args.size())
+                        write(frame.m_cells[s], 0, args[i]);
+                    i++;
+                }
+                list<Decl_ptr>::iterator decl_iter;
+                for (decl_iter = body->m_decl_list->begin(); decl_iter != body->m_decl_list->end(); decl_iter++) {
+                    list<SymName_ptr>::iterator name_iter;
+                    list<SymName_ptr>* names = (*decl_iter)->m_symname_list;
+                    for (name_iter = names->begin(); name_iter != names->end(); name_iter++) {
+                        Symbol* s = m_st->lookup_single(f->m_scope, (*name_iter)->spelling());
+                        declare(&frame, s, s->m_basetype == bt_intarray ? s->arr_length : 1);
+                    }
+                }
+                visit_list(body->m_stat_list);
+                int result = eval(body->m_return->m_expr);
+
+                m_words -= frame.m_words;
+                m_frame = saved;
+                m_depth--;
+                return result;
+            } catch (EvalAbort&) {
+                m_words -= frame.m_words;
+                m_frame = saved;
+                m_depth--;
+                throw;
+            }
+        }
+
+    public:
+        Evaluator(SymTab* st, CallGraph* cg, int step_limit, int memory_limit)
+        {
+            m_st = st;
+            m_cg = cg;
+            m_step_limit = step_limit;
+            m_memory_limit = memory_limit;
+            m_steps = m_words = m_depth = 0;
+            m_frame = NULL;
+            m_value = 0;
+            m_abort_reason = NULL;
+        }
+
+        // Run f on the given arguments. Returns false if the evaluation had to give up.
+        bool evaluate(FuncInfo* f, vector<int>& args, int* result)
+        {
+            m_steps = m_words = m_depth = 0;
+            m_frame = NULL;
+            m_abort_reason = NULL;
+            try {
+                *result = run(f, NULL, args);
+                return true;
+            } catch (EvalAbort& e) {
+                m_abort_reason = e.m_reason;
+                return false;
+            }
+        }
+
+        int steps() { return m_steps; }
+        const char* abort_reason() { return m_abort_reason; }
+
+        void visitProgram(Program* p) {}
+        void visitFunc(Func* p) {}
+        void visitFunction_block(Function_block* p) {}
+        void visitParam(Param* p) {}
+        void visitDecl(Decl* p) {}
+        void visitReturn(Return* p) {}
+
+        void visitNested_block(Nested_block* p)
+        {
+            visit_list(p->m_stat_list);
+        }
+
+        void visitAssignment(Assignment* p)
+        {
+            step();
+            int v = eval(p->m_expr);
+            write(cell(p, p->m_symname), 0, v);
+        }
+
+        void visitArrayAssignment(ArrayAssignment* p)
+        {
+            step();
+            int index = eval(p->m_expr_1);
+            int v = eval(p->m_expr_2);
+            write(cell(p, p->m_symname), index, v);
+        }
+
+        void visitCall(Call* p)
+        {
+            step();
+            int v = call(p, p->m_symname_2, p->m_expr_list);
+            write(cell(p, p->m_symname_1), 0, v);
+        }
+
+        void visitArrayCall(ArrayCall* p)
+        {
+            step();
+            int index = eval(p->m_expr_1);
+            int v = call(p, p->m_symname_2, p->m_expr_list_2);
+            write(cell(p, p->m_symname_1), index, v);
+        }
+
+        void visitIfNoElse(IfNoElse* p)
+        {
+            step();
+            if (eval(p->m_expr))
+                visit(p->m_nested_block);
+        }
+
+        void visitIfWithElse(IfWithElse* p)
+        {
+            step();
+            if (eval(p->m_expr))
+                visit(p->m_nested_block_1);
+            else
+                visit(p->m_nested_block_2);
+        }
+
+        void visitWhileLoop(WhileLoop* p)
+        {
+            step();
+            while (eval(p->m_expr)) {
+                step();
+                visit(p->m_nested_block);
+            }
+        }
+
+        void visitTInt(TInt* p) {}
+        void visitTBool(TBool* p) {}
+        void visitTIntArray(TIntArray* p) {}
+
+        void visitAnd(And* p)
+        {
+            step();
+            int a = eval(p->m_expr_1);
+            int b = eval(p->m_expr_2);
+            m_value = a && b;
+        }
+
+        void visitOr(Or* p)
+        {
+            step();
+            int a = eval(p->m_expr_1);
+            int b = eval(p->m_expr_2);
+            m_value = a || b;
+        }
+
+        void visitDiv(Div* p)
+        {
+            step();
+            int a = eval(p->m_expr_1);
+            int b = eval(p->m_expr_2);
+            // idiv traps on both of these
+            if (b == 0)
+                throw EvalAbort("division by zero");
+            if (a == INT_MIN && b == -1)
+                throw EvalAbort("division overflow");
+            m_value = a / b;
+        }
+
+        void visitCompare(Compare* p) { step(); int a = eval(p->m_expr_1); m_value = a == eval(p->m_expr_2); }
+        void visitNoteq(Noteq* p) { step(); int a = eval(p->m_expr_1); m_value = a != eval(p->m_expr_2); }
+        void visitGt(Gt* p) { step(); int a = eval(p->m_expr_1); m_value = a > eval(p->m_expr_2); }
+        void visitGteq(Gteq* p) { step(); int a = eval(p->m_expr_1); m_value = a >= eval(p->m_expr_2); }
+        void visitLt(Lt* p) { step(); int a = eval(p->m_expr_1); m_value = a < eval(p->m_expr_2); }
+        void visitLteq(Lteq* p) { step(); int a = eval(p->m_expr_1); m_value = a <= eval(p->m_expr_2); }
+
+        void visitMinus(Minus* p)
+        {
+            step();
+            unsigned int a = eval(p->m_expr_1);
+            m_value = wrap(a - (unsigned int) eval(p->m_expr_2));
+        }
+
+        void visitPlus(Plus* p)
+        {
+            step();
+            unsigned int a = eval(p->m_expr_1);
+            m_value = wrap(a + (unsigned int) eval(p->m_expr_2));
+        }
+
+        void visitTimes(Times* p)
+        {
+            step();
+            unsigned int a = eval(p->m_expr_1);
+            m_value = wrap(a * (unsigned int) eval(p->m_expr_2));
+        }
+
+        void visitNot(Not* p)
+        {
+            step();
+            m_value = !eval(p->m_expr);
+        }
+
+        void visitUminus(Uminus* p)
+        {
+            step();
+            m_value = wrap(0u - (unsigned int) eval(p->m_expr));
+        }
+
+        void visitMagnitude(Magnitude* p)
+        {
+            step();
+            int v = eval(p->m_expr);
+            m_value = v < 0 ? wrap(0u - (unsigned int) v) : v;
+        }
+
+        void visitIdent(Ident* p)
+        {
+            step();
+            m_value = read(cell(p, p->m_symname), 0);
+        }
+
+        void visitArrayAccess(ArrayAccess* p)
+        {
+            step();
+            int index = eval(p->m_expr);
+            m_value = read(cell(p, p->m_symname), index);
+        }
+
+        void visitIntLit(IntLit* p) { step(); m_value = p->m_primitive->m_data; }
+        void visitBoolLit(BoolLit* p) { step(); m_value = p->m_primitive->m_data; }
+        void visitSymName(SymName* p) {}
+        void visitPrimitive(Primitive* p) {}
+};
+
+#endif //EVALUATOR_HPP
@@ -0,0 +1,462 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "effects.h"
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <vector>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Moves statements and expressions from one function's scope to another. The variables local to
+ * the old scope are renamed to temporaries of the new one, made the first time each is seen unless
+ * renames already has one; every other name must mean the same thing in both, which check()
+ * verifies without changing anything. Moved nodes take the given line, so what later passes say
+ * about inlined code points at the call it came from rather than into the callee.
+ */
+
+class Rebinder : public Visitor {
+    private:
+        SymTab* m_st;
+        SymScope* m_from;
+        SymScope* m_to;
+        map<Symbol*, const char*>* m_renames;   // NULL: just check
+        int m_line;
+        bool m_ok;
+
+        void rebind(Visitable* p, SymName** name)
+        {
+            Symbol* s = m_st->lookup(p->m_attribute.m_scope, (*name)->spelling());
+            if(s != NULL && s->get_scope() == m_from){
+                if(m_renames != NULL){
+                    if(m_renames->find(s) == m_renames->end())
+                        (*m_renames)[s] = new_temporary(m_st, m_to, s->m_basetype, s->arr_length);
+                    delete *name;
+                    *name = new SymName(copy_spelling((*m_renames)[s]));
+                    (*name)->m_parent_attribute = &p->m_attribute;
+                }
+            } else if(m_st->lookup(m_to, (*name)->spelling()) != s){
+                m_ok = false;
+            }
+        }
+
+        void move(Visitable* p)
+        {
+            if(m_renames != NULL){
+                p->m_attribute.m_scope = m_to;
+                p->m_attribute.lineno = m_line;
+            }
+        }
+
+    public:
+        Rebinder(SymTab* st, SymScope* from, SymScope* to, map<Symbol*, const char*>* renames, int line = 0)
+        {
+            m_st = st;
+            m_from = from;
+            m_to = to;
+            m_renames = renames;
+            m_line = line;
+            m_ok = true;
+        }
+
+        // Does every name p uses that isn't local to from mean the same in to?
+        bool check(Visitable* p)
+        {
+            p->accept(this);
+            return m_ok;
+        }
+
+        void visitProgram(Program *p) {}
+        void visitFunc(Func *p) {}
+        void visitFunction_block(Function_block *p) {}
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+
+        void visitNested_block(Nested_block *p)
+        {
+            visit_list(p->m_stat_list);
+            move(p);
+        }
+
+        void visitAssignment(Assignment *p)
+        {
+            visit(p->m_expr);
+            rebind(p, &p->m_symname);
+            move(p);
+        }
+
+        void visitArrayAssignment(ArrayAssignment *p)
+        {
+            visit(p->m_expr_1);
+            visit(p->m_expr_2);
+            rebind(p, &p->m_symname);
+            move(p);
+        }
+
+        void visitCall(Call *p)
+        {
+            visit_list(p->m_expr_list);
+            rebind(p, &p->m_symname_1);
+            rebind(p, &p->m_symname_2);
+            move(p);
+        }
+
+        void visitArrayCall(ArrayCall *p)
+        {
+            visit(p->m_expr_1);
+            visit_list(p->m_expr_list_2);
+            rebind(p, &p->m_symname_1);
+            rebind(p, &p->m_symname_2);
+            move(p);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            visit(p->m_expr);
+            visit(p->m_nested_block);
+            move(p);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            visit(p->m_expr);
+            visit(p->m_nested_block_1);
+            visit(p->m_nested_block_2);
+            move(p);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            visit(p->m_expr);
+            visit(p->m_nested_block);
+            move(p);
+        }
+
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+
+        void visitAnd(And *p) { visit_children_of(p); move(p); }
+        void visitDiv(Div *p) { visit_children_of(p); move(p); }
+        void visitCompare(Compare *p) { visit_children_of(p); move(p); }
+        void visitGt(Gt *p) { visit_children_of(p); move(p); }
+        void visitGteq(Gteq *p) { visit_children_of(p); move(p); }
+        void visitLt(Lt *p) { visit_children_of(p); move(p); }
+        void visitLteq(Lteq *p) { visit_children_of(p); move(p); }
+        void visitMinus(Minus *p) { visit_children_of(p); move(p); }
+        void visitNoteq(Noteq *p) { visit_children_of(p); move(p); }
+        void visitOr(Or *p) { visit_children_of(p); move(p); }
+        void visitPlus(Plus *p) { visit_children_of(p); move(p); }
+        void visitTimes(Times *p) { visit_children_of(p); move(p); }
+        void visitNot(Not *p) { visit_children_of(p); move(p); }
+        void visitUminus(Uminus *p) { visit_children_of(p); move(p); }
+        void visitMagnitude(Magnitude *p) { visit_children_of(p); move(p); }
+
+        void visitIdent(Ident *p)
+        {
+            rebind(p, &p->m_symname);
+            move(p);
+        }
+
+        void visitArrayAccess(ArrayAccess *p)
+        {
+            visit(p->m_expr);
+            rebind(p, &p->m_symname);
+            move(p);
+        }
+
+        void visitIntLit(IntLit *p) { move(p); }
+        void visitBoolLit(BoolLit *p) { move(p); }
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
+
+/*
+ * Inlining. A call costs pushing the arguments, the call, a prologue saving the callee-saved
+ * registers and setting up the frame, and the epilogue undoing it, which for a one-line helper is
+ * most of the work. A call
+ *     x = f(a, b);
+ * to a function f(int p, int q) { var int v; S; return e; } becomes
+ *     _t0 = a; _t1 = b; S'; x = e';
+ * where S' and e' are S and e with p, q and v renamed to temporaries _t0, _t1 and _t2 of the
+ * caller. For an ArrayCall, the index is computed into a temporary first, as codegen does.
+ *
+ * Nested functions are inlined the same way: their other variables are the enclosing functions'
+ * and mean the same in the caller, which is checked for every call (a call from somewhere else,
+ * where one of those names is shadowed, isn't inlined). Functions with nested functions of their
+ * own, recursive functions and functions with array parameters aren't inlined.
+ *
+ * The size of a function is its statements and expression nodes. A call is inlined if:
+ *   * the callee is at most small_size, about what the call itself costs, or
+ *   * it is the only call of the callee (whose own code is then never used), up to single_size, or
+ *   * it is in a loop, up to loop_size,
+ * and the caller has grown by less than max_growth. Functions are handled callees first, so a
+ * callee has its own calls inlined before it is inlined in turn.
+ *
+ * Inlining makes the arguments' values visible to the body, so main.cpp runs constant folding
+ * again afterwards.
+ */
+
+class Inliner : public Visitor {
+    private:
+        SymTab* m_st;
+        CallGraph* m_cg;
+        map<FuncInfo*, int> m_calls;    // call sites of each function
+
+        static const int small_size = 12;
+        static const int single_size = 96;
+        static const int loop_size = 40;
+        static const int max_growth = 256;
+
+        // statistics
+        int m_inlined;
+        set<FuncInfo*> m_functions;
+        int m_growth;
+
+        static Function_block* body_of(FuncInfo* f)
+        {
+            return f->m_func->m_function_block;
+        }
+
+        int size(FuncInfo* f)
+        {
+            Function_block* b = body_of(f);
+            return SideEffects::list_size(b->m_stat_list) + expr_size(b->m_return->m_expr) +
+                f->m_func->m_param_list->size();
+        }
+
+        bool can_inline(FuncInfo* caller, FuncInfo* callee, bool in_loop, int budget)
+        {
+            if(callee == NULL || callee == caller || callee->m_recursive)
+                return false;
+            Function_block* b = body_of(callee);
+            if(!b->m_func_list->empty())
+                return false;
+            list<Param_ptr>::iterator param;
+            forall(param,callee->m_func->m_param_list){
+                Basetype type = (*param)->m_type->m_attribute.m_basetype;
+                if(type != bt_integer && type != bt_boolean)
+                    return false;
+            }
+            int n = size(callee);
+            bool worth = n <= small_size || (m_calls[callee] == 1 && n <= single_size) ||
+                (in_loop && n <= loop_size);
+            if(!worth || n > budget)
+                return false;
+            Rebinder check(m_st, callee->m_scope, caller->m_scope, NULL);
+            list<Stat_ptr>::iterator iter;
+            forall(iter,b->m_stat_list){
+                if(!check.check(*iter))
+                    return false;
+            }
+            return check.check(b->m_return->m_expr);
+        }
+
+        Stat* make_assignment(const char* name, Expr* e, Stat* like)
+        {
+            Stat* s = new Assignment(new SymName(copy_spelling(name)), e);
+            copy_attribute(s, like);
+            e->m_parent_attribute = &s->m_attribute;
+            return s;
+        }
+
+        // Replace the call at pos in stats by the body of callee; returns the position after it
+        list<Stat_ptr>::iterator inline_call(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos,
+            FuncInfo* caller, FuncInfo* callee)
+        {
+            Stat* call = *pos;
+            Function_block* b = body_of(callee);
+            list<Stat_ptr> out;
+
+            // a temporary in the caller for each parameter of the callee (the rebinder adds the locals)
+            map<Symbol*, const char*> renames;
+            vector<const char*> params;
+            list<Param_ptr>::iterator param;
+            forall(param,callee->m_func->m_param_list){
+                Symbol* s = m_st->lookup_single(callee->m_scope, (*param)->m_symname->spelling());
+                renames[s] = new_temporary(m_st, caller->m_scope, s->m_basetype);
+                params.push_back(renames[s]);
+            }
+
+            // the index first (for an ArrayCall), then the arguments
+            list<Expr_ptr>* args;
+            Expr* index = NULL;
+            if(ArrayCall* ac = dynamic_cast<ArrayCall*>(call)){
+                index = ac->m_expr_1;
+                ac->m_expr_1 = NULL;
+                if(!is_literal(index)){
+                    const char* name = new_temporary(m_st, caller->m_scope, bt_integer);
+                    out.push_back(make_assignment(name, index, call));
+                    Ident* id = new Ident(new SymName(copy_spelling(name)));
+                    copy_attribute(id, index);
+                    id->m_attribute.m_basetype = bt_integer;
+                    id->m_attribute.m_lattice_elem = TOP;
+                    index = id;
+                }
+                args = ac->m_expr_list_2;
+            } else {
+                args = ((Call*) call)->m_expr_list;
+            }
+            list<Expr_ptr>::iterator arg;
+            unsigned i = 0;
+            forall(arg,args){
+                out.push_back(make_assignment(params[i++], *arg, call));
+            }
+            args->clear();
+
+            Rebinder rebinder(m_st, callee->m_scope, caller->m_scope, &renames, call->m_attribute.lineno);
+            list<Stat_ptr>::iterator iter;
+            forall(iter,b->m_stat_list){
+                Stat* copy = SideEffects::copy_stat(*iter);
+                copy->accept(&rebinder);
+                copy->m_parent_attribute = call->m_parent_attribute;
+                out.push_back(copy);
+            }
+            Expr* result = copy_expr(b->m_return->m_expr);
+            result->accept(&rebinder);
+
+            Stat* store;
+            if(Call* c = dynamic_cast<Call*>(call)){
+                store = make_assignment(c->m_symname_1->spelling(), result, call);
+            } else {
+                ArrayCall* ac = (ArrayCall*) call;
+                store = new ArrayAssignment(new SymName(copy_spelling(ac->m_symname_1->spelling())), index, result);
+                copy_attribute(store, call);
+                index->m_parent_attribute = result->m_parent_attribute = &store->m_attribute;
+            }
+            out.push_back(store);
+
+            stats->splice(pos, out);
+            list<Stat_ptr>::iterator next = stats->erase(pos);
+            delete call;
+
+            m_inlined++;
+            m_functions.insert(callee);
+            return next;
+        }
+
+        FuncInfo* callee_of(Stat* s)
+        {
+            if(Call* c = dynamic_cast<Call*>(s))
+                return m_cg->resolve(c->m_attribute.m_scope, c->m_symname_2->spelling());
+            if(ArrayCall* ac = dynamic_cast<ArrayCall*>(s))
+                return m_cg->resolve(ac->m_attribute.m_scope, ac->m_symname_2->spelling());
+            return NULL;
+        }
+
+        void count_calls(list<Stat_ptr>* stats)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                if(FuncInfo* callee = callee_of(*iter))
+                    m_calls[callee]++;
+                vector<list<Stat_ptr>*> lists;
+                SideEffects::nested_lists(*iter, lists);
+                for(unsigned l = 0; l < lists.size(); l++)
+                    count_calls(lists[l]);
+            }
+        }
+
+        void process_stats(list<Stat_ptr>* stats, FuncInfo* caller, bool in_loop, int* budget)
+        {
+            list<Stat_ptr>::iterator iter = stats->begin();
+            while(iter != stats->end()){
+                FuncInfo* callee = callee_of(*iter);
+                if(callee != NULL && can_inline(caller, callee, in_loop, *budget)){
+                    int n = size(callee);
+                    *budget -= n;
+                    m_growth += n;
+                    iter = inline_call(stats, iter, caller, callee);
+                    continue;
+                }
+                vector<list<Stat_ptr>*> lists;
+                SideEffects::nested_lists(*iter, lists);
+                bool loop = in_loop || dynamic_cast<WhileLoop*>(*iter) != NULL;
+                for(unsigned l = 0; l < lists.size(); l++)
+                    process_stats(lists[l], caller, loop, budget);
+                iter++;
+            }
+        }
+
+    public:
+        Inliner(SymTab* st, CallGraph* cg)
+        {
+            m_st = st;
+            m_cg = cg;
+            m_inlined = m_growth = 0;
+        }
+
+        // Did we inline anything?
+        bool changed()
+        {
+            return m_inlined != 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "inline: %d calls inlined (of %d functions), adding %d statements and expression nodes\n",
+                m_inlined, (int) m_functions.size(), m_growth);
+        }
+
+        void visitProgram(Program *p)
+        {
+            // folding may have removed calls since the call graph was built, so count them afresh
+            for(unsigned i = 0; i < m_cg->m_funcs.size(); i++)
+                count_calls(body_of(m_cg->m_funcs[i])->m_stat_list);
+            // callees first
+            for(unsigned i = 0; i < m_cg->m_sccs.size(); i++){
+                for(unsigned j = 0; j < m_cg->m_sccs[i].size(); j++){
+                    FuncInfo* f = m_cg->m_sccs[i][j];
+                    int budget = max_growth;
+                    process_stats(body_of(f)->m_stat_list, f, false, &budget);
+                }
+            }
+        }
+
+        void visitFunc(Func *p) {}
+        void visitFunction_block(Function_block *p) {}
+        void visitNested_block(Nested_block *p) {}
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitIfNoElse(IfNoElse *p) {}
+        void visitIfWithElse(IfWithElse *p) {}
+        void visitWhileLoop(WhileLoop *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
@@ -0,0 +1,450 @@
+#ifndef IR_HPP
+#define IR_HPP
+
+#include "symtab.h"
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * A three-address intermediate representation between the AST and the assembly. lower.cpp
+ * builds it from the optimized AST and codegen.cpp turns it into x86.
+ *
+ * A program is a list of functions (nested ones included; they are just functions here). A
+ * function is a list of basic blocks, the first of which is the entry. A block is a list of
+ * instructions of the form
+ *     dst = op a, b
+ * ending in exactly one terminator: jump, branch or return. The successors and predecessors of
+ * each block (the CFG) are computed from the terminators by build_cfg().
+ *
+ * Operands are
+ *   * immediates (integers, and booleans as 0 and 1),
+ *   * variables: the source program's ints and bools, by their Symbol, which has the stack slot,
+ *   * temporaries %0, %1, ...: values the lowering introduces for the inner nodes of expressions.
+ * Arrays appear only as the array of a load, store or check, by Symbol.
+ *
+ * Temporaries follow stricter rules than variables, which the verifier checks:
+ *   * each is defined by exactly one instruction, and
+ *   * used only after that in the same block.
+ * So a temporary never lives across a block boundary, while a variable may be assigned anywhere.
+ *
+ * Calls take their arguments from param instructions just before them in the same block, last
+ * argument first as they are pushed on the stack, which is how the backend passes them.
+ *
+ * dump() prints a function like this:
+ *     function fib(n) frame 8
+ *     B0:
+ *         %0 = lt n, 2
+ *         branch %0, B1, B2
+ *     B1:
+ *         a = n
+ *         jump B3
+ *     ...
+ */
+
+enum IROp
+{
+    ir_copy,        // dst = a
+    ir_add, ir_sub, ir_mul, ir_div, ir_and, ir_or,
+    ir_lt, ir_gt, ir_le, ir_ge, ir_eq, ir_ne,
+    ir_neg, ir_not, ir_abs,
+    ir_load,        // dst = array[a]
+    ir_store,       // array[a] = b
+    ir_check,       // trap unless 0 <= a < the length of array
+    ir_param,       // pass a to the next call
+    ir_call,        // dst = func(the params before it)
+
+    // terminators
+    ir_jump,        // goto target
+    ir_branch,      // if a goto target else goto target2
+    ir_return       // return a
+};
+
+struct IROperand
+{
+    enum Kind { none, imm, var, temp };
+
+    Kind m_kind;
+    int m_value;            // the immediate, or the number of the temporary
+    Symbol* m_symbol;       // the variable
+    const char* m_name;     // the variable's name, for dumps
+
+    IROperand() : m_kind(none), m_value(0), m_symbol(NULL), m_name(NULL) {}
+
+    static IROperand make_imm(int value)
+    {
+        IROperand o;
+        o.m_kind = imm;
+        o.m_value = value;
+        return o;
+    }
+
+    static IROperand make_var(Symbol* s, const char* name)
+    {
+        IROperand o;
+        o.m_kind = var;
+        o.m_symbol = s;
+        o.m_name = name;
+        return o;
+    }
+
+    static IROperand make_temp(int number)
+    {
+        IROperand o;
+        o.m_kind = temp;
+        o.m_value = number;
+        return o;
+    }
+
+    bool is_imm() const { return m_kind == imm; }
+    bool is_var() const { return m_kind == var; }
+    bool is_temp() const { return m_kind == temp; }
+    bool is_none() const { return m_kind == none; }
+
+    bool operator == (const IROperand& other) const
+    {
+        return m_kind == other.m_kind && m_value == other.m_value && m_symbol == other.m_symbol;
+    }
+
+    string to_string() const
+    {
+        char buffer[32];
+        switch(m_kind){
+            case imm: sprintf(buffer, "%d", m_value); return buffer;
+            case temp: sprintf(buffer, "%%%d", m_value); return buffer;
+            case var: return m_name;
+            default: return "?";
+        }
+    }
+};
+
+class IRBlock;
+
+struct IRInstr
+{
+    IROp m_op;
+    IROperand m_dst, m_a, m_b;
+    Symbol* m_array;            // load, store, check
+    const char* m_array_name;
+    const char* m_func;         // call
+    int m_args;                 // call: how many params it takes
+    IRBlock* m_target;          // jump, branch
+    IRBlock* m_target2;         // branch, when a is false
+    int m_line;                 // of the AST node it came from
+
+    IRInstr(IROp op, int line)
+    {
+        m_op = op;
+        m_array = NULL;
+        m_array_name = NULL;
+        m_func = NULL;
+        m_args = 0;
+        m_target = m_target2 = NULL;
+        m_line = line;
+    }
+
+    bool is_terminator() const
+    {
+        return m_op == ir_jump || m_op == ir_branch || m_op == ir_return;
+    }
+
+    // Does this instruction compute a value into m_dst?
+    bool has_dst() const
+    {
+        return m_op != ir_store && m_op != ir_check && m_op != ir_param && !is_terminator();
+    }
+
+    // The operands it reads
+    void uses(vector<const IROperand*>& out) const
+    {
+        if(!m_a.is_none()) out.push_back(&m_a);
+        if(!m_b.is_none()) out.push_back(&m_b);
+    }
+
+    static const char* op_name(IROp op)
+    {
+        static const char* names[] = {
+            "copy", "add", "sub", "mul", "div", "and", "or",
+            "lt", "gt", "le", "ge", "eq", "ne",
+            "neg", "not", "abs",
+            "load", "store", "check", "param", "call",
+            "jump", "branch", "return"
+        };
+        return names[op];
+    }
+};
+
+class IRBlock
+{
+    public:
+        int m_id;                   // unique in the program; the label is B<id>
+        vector<IRInstr*> m_instrs;
+        vector<IRBlock*> m_succs;
+        vector<IRBlock*> m_preds;
+
+        IRBlock(int id) : m_id(id) {}
+
+        ~IRBlock()
+        {
+            for(unsigned i = 0; i < m_instrs.size(); i++)
+                delete m_instrs[i];
+        }
+
+        IRInstr* terminator()
+        {
+            return m_instrs.empty() || !m_instrs.back()->is_terminator() ? NULL : m_instrs.back();
+        }
+};
+
+class IRFunction
+{
+    public:
+        const char* m_name;
+        vector<IROperand> m_params;  // the parameters, as variables
+        int m_frame;                // bytes of variables in the frame, parameters included
+        int m_memo_range;           // > 0 if calls are memoized (see codegen.cpp)
+        int m_temps;                // temporaries are %0 to %(m_temps - 1)
+        vector<IRBlock*> m_blocks;  // m_blocks[0] is the entry; this is also the layout order
+
+        IRFunction(const char* name)
+        {
+            m_name = name;
+            m_frame = 0;
+            m_memo_range = 0;
+            m_temps = 0;
+        }
+
+        ~IRFunction()
+        {
+            for(unsigned i = 0; i < m_blocks.size(); i++)
+                delete m_blocks[i];
+        }
+
+        void build_cfg()
+        {
+            for(unsigned i = 0; i < m_blocks.size(); i++){
+                m_blocks[i]->m_succs.clear();
+                m_blocks[i]->m_preds.clear();
+            }
+            for(unsigned i = 0; i < m_blocks.size(); i++){
+                IRInstr* t = m_blocks[i]->terminator();
+                if(t == NULL) continue;
+                if(t->m_target != NULL) m_blocks[i]->m_succs.push_back(t->m_target);
+                if(t->m_target2 != NULL && t->m_target2 != t->m_target) m_blocks[i]->m_succs.push_back(t->m_target2);
+                for(unsigned j = 0; j < m_blocks[i]->m_succs.size(); j++)
+                    m_blocks[i]->m_succs[j]->m_preds.push_back(m_blocks[i]);
+            }
+        }
+
+        void dump(FILE* out)
+        {
+            fprintf(out, "function %s(", m_name);
+            for(unsigned i = 0; i < m_params.size(); i++)
+                fprintf(out, "%s%s", i == 0 ? "" : ", ", m_params[i].m_name);
+            fprintf(out, ") frame %d", m_frame);
+            if(m_memo_range > 0)
+                fprintf(out, " memoized %d", m_memo_range);
+            fprintf(out, "\n");
+            for(unsigned i = 0; i < m_blocks.size(); i++){
+                IRBlock* b = m_blocks[i];
+                fprintf(out, "B%d:", b->m_id);
+                if(!b->m_preds.empty()){
+                    fprintf(out, "%*s; preds", b->m_id < 10 ? 30 : 29, "");
+                    for(unsigned j = 0; j < b->m_preds.size(); j++)
+                        fprintf(out, " B%d", b->m_preds[j]->m_id);
+                }
+                fprintf(out, "\n");
+                for(unsigned j = 0; j < b->m_instrs.size(); j++)
+                    fprintf(out, "    %s\n", to_string(b->m_instrs[j]).c_str());
+            }
+            fprintf(out, "\n");
+        }
+
+        static string to_string(IRInstr* in)
+        {
+            char buffer[32];
+            string out;
+            if(in->has_dst())
+                out = in->m_dst.to_string() + " = ";
+            switch(in->m_op){
+                case ir_copy:
+                    return out + in->m_a.to_string();
+                case ir_load:
+                    return out + in->m_array_name + "[" + in->m_a.to_string() + "]";
+                case ir_store:
+                    return string(in->m_array_name) + "[" + in->m_a.to_string() + "] = " + in->m_b.to_string();
+                case ir_check:
+                    sprintf(buffer, "%d", in->m_array->arr_length);
+                    return "check " + in->m_a.to_string() + " < " + buffer + " (" + in->m_array_name + ")";
+                case ir_call:
+                    sprintf(buffer, "%d", in->m_args);
+                    return out + "call " + in->m_func + ", " + buffer;
+                case ir_jump:
+                    sprintf(buffer, "jump B%d", in->m_target->m_id);
+                    return buffer;
+                case ir_branch:
+                    sprintf(buffer, ", B%d, B%d", in->m_target->m_id, in->m_target2->m_id);
+                    return "branch " + in->m_a.to_string() + buffer;
+                default:
+                    out += IRInstr::op_name(in->m_op);
+                    out += " " + in->m_a.to_string();
+                    if(!in->m_b.is_none())
+                        out += ", " + in->m_b.to_string();
+                    return out;
+            }
+        }
+};
+
+class IRProgram
+{
+    public:
+        vector<IRFunction*> m_funcs;
+        bool m_bounds_checked;      // whether check instructions need the trap handler
+
+        IRProgram() : m_bounds_checked(false) {}
+
+        ~IRProgram()
+        {
+            for(unsigned i = 0; i < m_funcs.size(); i++)
+                delete m_funcs[i];
+        }
+
+        void dump(FILE* out)
+        {
+            for(unsigned i = 0; i < m_funcs.size(); i++)
+                m_funcs[i]->dump(out);
+        }
+};
+
+/*
+ * Checks the rules above, printing a line to errorfile for every violation. Lowering and any
+ * pass over the IR should leave it valid, so a failure is a compiler bug.
+ */
+class IRVerifier
+{
+    private:
+        FILE* m_errorfile;
+        IRFunction* m_func;
+        int m_errors;
+
+        void error(IRBlock* b, IRInstr* in, const char* what)
+        {
+            fprintf(m_errorfile, "IR verifier: %s, B%d: %s%s%s\n", m_func->m_name, b->m_id, what,
+                in != NULL ? ": " : "", in != NULL ? IRFunction::to_string(in).c_str() : "");
+            m_errors++;
+        }
+
+        void check_operands(IRBlock* b, IRInstr* in, set<int>& defined)
+        {
+            vector<const IROperand*> used;
+            in->uses(used);
+            for(unsigned i = 0; i < used.size(); i++){
+                const IROperand* o = used[i];
+                if(o->is_temp() && !defined.count(o->m_value))
+                    error(b, in, "temporary used before its definition in the block");
+                if(o->is_var() && o->m_symbol == NULL)
+                    error(b, in, "variable without a symbol");
+            }
+            bool needs_a = in->m_op != ir_jump;
+            bool needs_b = (in->m_op >= ir_add && in->m_op <= ir_ne) || in->m_op == ir_store;
+            if(in->m_op == ir_call) needs_a = false;
+            if(needs_a != !in->m_a.is_none() || needs_b != !in->m_b.is_none())
+                error(b, in, "wrong number of operands");
+            if((in->m_op == ir_load || in->m_op == ir_store || in->m_op == ir_check) && in->m_array == NULL)
+                error(b, in, "no array");
+            if(in->has_dst()){
+                if(!in->m_dst.is_temp() && !in->m_dst.is_var())
+                    error(b, in, "result is not a variable or temporary");
+                if(in->m_dst.is_temp()){
+                    if(in->m_dst.m_value < 0 || in->m_dst.m_value >= m_func->m_temps)
+                        error(b, in, "temporary out of range");
+                    else if(!m_defs.insert(in->m_dst.m_value).second)
+                        error(b, in, "temporary defined twice");
+                    defined.insert(in->m_dst.m_value);
+                }
+            } else if(!in->m_dst.is_none()){
+                error(b, in, "result on an instruction without one");
+            }
+        }
+
+        set<int> m_defs;        // temporaries defined anywhere in the function
+
+    public:
+        IRVerifier(FILE* errorfile)
+        {
+            m_errorfile = errorfile;
+            m_func = NULL;
+            m_errors = 0;
+        }
+
+        // Returns whether f is valid
+        bool verify(IRFunction* f)
+        {
+            int errors = m_errors;
+            m_func = f;
+            m_defs.clear();
+            if(f->m_blocks.empty()){
+                fprintf(m_errorfile, "IR verifier: %s: no blocks\n", f->m_name);
+                return false;
+            }
+            set<IRBlock*> blocks(f->m_blocks.begin(), f->m_blocks.end());
+            for(unsigned i = 0; i < f->m_blocks.size(); i++){
+                IRBlock* b = f->m_blocks[i];
+                if(b->terminator() == NULL)
+                    error(b, NULL, "block doesn't end in a terminator");
+                set<int> defined;
+                int params = 0;
+                for(unsigned j = 0; j < b->m_instrs.size(); j++){
+                    IRInstr* in = b->m_instrs[j];
+                    if(in->is_terminator() && j + 1 != b->m_instrs.size())
+                        error(b, in, "terminator in the middle of the block");
+                    check_operands(b, in, defined);
+                    if(in->m_op == ir_param)
+                        params++;
+                    else if(in->m_op == ir_call){
+                        if(in->m_args != params)
+                            error(b, in, "call doesn't take the params before it");
+                        params = 0;
+                    }
+                    if((in->m_target != NULL && !blocks.count(in->m_target)) ||
+                       (in->m_target2 != NULL && !blocks.count(in->m_target2)))
+                        error(b, in, "jump to a block of another function");
+                    if((in->m_op == ir_jump || in->m_op == ir_branch) && in->m_target == NULL)
+                        error(b, in, "no target");
+                    if(in->m_op == ir_branch && in->m_target2 == NULL)
+                        error(b, in, "no target");
+                }
+                if(params != 0)
+                    error(b, NULL, "params without a call");
+
+                // the CFG must be up to date
+                IRInstr* t = b->terminator();
+                vector<IRBlock*> succs;
+                if(t != NULL && t->m_target != NULL) succs.push_back(t->m_target);
+                if(t != NULL && t->m_target2 != NULL && t->m_target2 != t->m_target) succs.push_back(t->m_target2);
+                if(succs != b->m_succs)
+                    error(b, NULL, "successors don't match the terminator");
+                for(unsigned j = 0; j < b->m_succs.size(); j++){
+                    vector<IRBlock*>& preds = b->m_succs[j]->m_preds;
+                    if(find(preds.begin(), preds.end(), b) == preds.end())
+                        error(b, NULL, "missing from the predecessors of a successor");
+                }
+            }
+            return m_errors == errors;
+        }
+
+        bool verify(IRProgram* p)
+        {
+            bool ok = true;
+            for(unsigned i = 0; i < p->m_funcs.size(); i++)
+                ok = verify(p->m_funcs[i]) && ok;
+            return ok;
+        }
+};
+
+#endif //IR_HPP
@@ -0,0 +1,328 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "effects.h"
+#include "budget.h"
+#include <stdio.h>
+#include <set>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Liveness analysis, and the dead-store and dead-code elimination it drives.
+ *
+ * Liveness is a backward analysis, so unlike ConstantFolding this pass walks each statement list
+ * from the last statement to the first, keeping in m_live the set of variables that may still be
+ * read before they are written. The transfer functions are:
+ *   * x = e kills x, then makes everything e reads live.
+ *   * a[i] = e doesn't kill a (only one element is written); i and e are read.
+ *   * A call reads its arguments plus whatever its callee may read from enclosing functions (the
+ *     ref summary from "callgraph.h"). A Call kills its result variable; it never kills anything
+ *     else, since the callee's mod summary only says what it MAY write.
+ *   * An If is the union of both branches plus its condition.
+ *   * A While is iterated to a fixpoint: what is live at the loop head is what is live after the
+ *     loop, plus what the condition reads, plus what is live at the start of the body when the
+ *     head's set is live at its end.
+ * At the end of a function only the Return expression's variables are live. Variables of
+ * enclosing functions are never considered dead, since the caller may read them after we return.
+ *
+ * Using that information:
+ *   * An assignment (or array assignment) to a variable local to this function which isn't live
+ *     afterwards is removed, along with the expression it stored. Removed stores don't make their
+ *     operands live, so whole chains of stores that only feed each other disappear.
+ *   * An If whose branches ended up empty is removed.
+ * Calls are always kept, since the callee may have side effects (or not terminate), and so is
+ * anything that might trap (a division by a non-constant, or, with --bounds-check, an array
+ * access or store whose index isn't a literal within the array).
+ *
+ * Removing stores in a loop can make more stores dead, so the pass is repeated until it finds
+ * nothing more to remove.
+ */
+
+class DeadStoreElimination : public Visitor {
+    private:
+        SymTab* m_st;
+        CallGraph* m_cg;
+        SideEffects m_effects;
+        Budget m_budget;        // rounds of loop fixpoints, charged by the size of the loop body
+
+        typedef set<Symbol*> LiveSet;
+        LiveSet m_live;
+        FuncInfo* m_cur_func;
+        bool m_transform;       // false while iterating a loop to its fixpoint
+        bool m_remove;          // set by a statement's visit method if it can be removed
+        bool m_changed;
+
+        static const int max_runs = 16;
+
+        // statistics
+        int m_stores_removed;
+        int m_branches_removed;
+        int m_nodes_removed;
+
+        Symbol* lookup(Visitable* p, SymName* name)
+        {
+            return m_st->lookup(p->m_attribute.m_scope, name->spelling());
+        }
+
+        // Can a store to s be dropped when s isn't live?
+        bool is_removable_target(Symbol* s)
+        {
+            return s != NULL && m_cur_func != NULL && m_cg->is_local(m_cur_func, s);
+        }
+
+        void use(Expr* e)
+        {
+            visit(e);
+        }
+
+        void use_call(Stat* p, SymName* callee, list<Expr_ptr>* args)
+        {
+            list<Expr_ptr>::iterator arg_iter;
+            forall(arg_iter,args){
+                use(*arg_iter);
+            }
+            // typecheck made sure every call resolves
+            FuncInfo* f = m_cg->resolve(p->m_attribute.m_scope, callee->spelling());
+            if(f != NULL)
+                m_live.insert(f->m_ref.begin(), f->m_ref.end());
+        }
+
+        void note_removed(int nodes)
+        {
+            if(!m_transform) return;
+            m_remove = true;
+            m_stores_removed++;
+            m_nodes_removed += nodes;
+        }
+
+        // Walk a statement list backwards, removing what its statements ask to remove
+        void process_stats(list<Stat_ptr>* stats)
+        {
+            bool saved_remove = m_remove;   // we may be inside the statement that set it
+            list<Stat_ptr>::iterator iter = stats->end();
+            while(iter != stats->begin()){
+                iter--;
+                m_remove = false;
+                visit(*iter);
+                if(m_remove){
+                    delete *iter;
+                    iter = stats->erase(iter);
+                    m_changed = true;
+                }
+            }
+            m_remove = saved_remove;
+        }
+
+        void process_block(Nested_block* block, LiveSet& live_out)
+        {
+            m_live = live_out;
+            process_stats(block->m_stat_list);
+        }
+
+    public:
+        DeadStoreElimination(SymTab* st, CallGraph* cg, bool bounds_check, long budget) : m_effects(st, cg, bounds_check), m_budget("dse", budget)
+        {
+            m_st = st;
+            m_cg = cg;
+            m_cur_func = NULL;
+            m_transform = true;
+            m_remove = false;
+            m_changed = false;
+            m_stores_removed = m_branches_removed = m_nodes_removed = 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "dse: %d dead stores removed (%d expression nodes), %d empty branches removed\n",
+                m_stores_removed, m_nodes_removed, m_branches_removed);
+        }
+
+        void visitProgram(Program *p)
+        {
+            for(int run = 0; run < max_runs; run++){
+                m_changed = false;
+                visit_list(p->m_func_list);
+                if(!m_changed) break;
+            }
+        }
+
+        void visitFunc(Func *p)
+        {
+            FuncInfo* saved_func = m_cur_func;
+            LiveSet saved_live;
+            saved_live.swap(m_live);
+            bool saved_transform = m_transform;
+            Func* saved_budget = m_budget.current();
+
+            m_cur_func = m_cg->info(p);
+            m_transform = true;
+            m_budget.start(p);
+            visit(p->m_function_block);
+
+            m_cur_func = saved_func;
+            m_budget.start(saved_budget);
+            m_live.swap(saved_live);
+            m_transform = saved_transform;
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            m_live.clear();
+            use(p->m_return->m_expr);
+            process_stats(p->m_stat_list);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+
+        void visitAssignment(Assignment *p)
+        {
+            Symbol* s = lookup(p, p->m_symname);
+            if(m_live.count(s) == 0 && is_removable_target(s) && !m_effects.may_trap(p->m_expr)){
+                note_removed(expr_size(p->m_expr));
+                return;
+            }
+            m_live.erase(s);
+            use(p->m_expr);
+        }
+
+        void visitArrayAssignment(ArrayAssignment *p)
+        {
+            Symbol* s = lookup(p, p->m_symname);
+            if(m_live.count(s) == 0 && is_removable_target(s) &&
+               !m_effects.may_trap(p)){
+                note_removed(expr_size(p->m_expr_1) + expr_size(p->m_expr_2));
+                return;
+            }
+            use(p->m_expr_1);
+            use(p->m_expr_2);
+        }
+
+        void visitCall(Call *p)
+        {
+            m_live.erase(lookup(p, p->m_symname_1));
+            use_call(p, p->m_symname_2, p->m_expr_list);
+        }
+
+        void visitArrayCall(ArrayCall *p)
+        {
+            use(p->m_expr_1);
+            use_call(p, p->m_symname_2, p->m_expr_list_2);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            LiveSet live_out = m_live;
+            process_block(p->m_nested_block, live_out);
+            if(m_transform && p->m_nested_block->m_stat_list->empty() && !m_effects.may_trap(p->m_expr)){
+                m_remove = true;
+                m_branches_removed++;
+                m_nodes_removed += expr_size(p->m_expr);
+                m_live = live_out;
+                return;
+            }
+            m_live.insert(live_out.begin(), live_out.end());
+            use(p->m_expr);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            LiveSet live_out = m_live;
+            process_block(p->m_nested_block_1, live_out);
+            LiveSet live_then;
+            live_then.swap(m_live);
+            process_block(p->m_nested_block_2, live_out);
+            if(m_transform && p->m_nested_block_1->m_stat_list->empty() &&
+               p->m_nested_block_2->m_stat_list->empty() && !m_effects.may_trap(p->m_expr)){
+                m_remove = true;
+                m_branches_removed++;
+                m_nodes_removed += expr_size(p->m_expr);
+                m_live = live_out;
+                return;
+            }
+            m_live.insert(live_then.begin(), live_then.end());
+            use(p->m_expr);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            LiveSet live_out = m_live;
+
+            // live at the head = live_out + cond + live at the start of the body given the head
+            bool saved_transform = m_transform;
+            m_transform = false;
+            LiveSet head = live_out;
+            m_live = head;
+            use(p->m_expr);
+            head = m_live;
+            int size = SideEffects::list_size(p->m_nested_block->m_stat_list);
+            while(true){
+                // Out of budget: take everything the loop might read as live at the head,
+                // which is all the fixpoint could add to it
+                if(!m_budget.spend(size)){
+                    m_effects.stat_reads(p, head);
+                    break;
+                }
+                process_block(p->m_nested_block, head);
+                m_live.insert(head.begin(), head.end());
+                if(m_live == head) break;
+                head = m_live;
+            }
+            m_transform = saved_transform;
+
+            // now with the fixpoint as what's live at the end of the body
+            process_block(p->m_nested_block, head);
+            m_live = head;
+        }
+
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+
+        // Expressions: add the variables they read to m_live
+        void visitAnd(And *p) { visit_children_of(p); }
+        void visitDiv(Div *p) { visit_children_of(p); }
+        void visitCompare(Compare *p) { visit_children_of(p); }
+        void visitGt(Gt *p) { visit_children_of(p); }
+        void visitGteq(Gteq *p) { visit_children_of(p); }
+        void visitLt(Lt *p) { visit_children_of(p); }
+        void visitLteq(Lteq *p) { visit_children_of(p); }
+        void visitMinus(Minus *p) { visit_children_of(p); }
+        void visitNoteq(Noteq *p) { visit_children_of(p); }
+        void visitOr(Or *p) { visit_children_of(p); }
+        void visitPlus(Plus *p) { visit_children_of(p); }
+        void visitTimes(Times *p) { visit_children_of(p); }
+        void visitNot(Not *p) { visit_children_of(p); }
+        void visitUminus(Uminus *p) { visit_children_of(p); }
+        void visitMagnitude(Magnitude *p) { visit_children_of(p); }
+
+        void visitIdent(Ident *p)
+        {
+            m_live.insert(lookup(p, p->m_symname));
+        }
+
+        void visitArrayAccess(ArrayAccess *p)
+        {
+            m_live.insert(lookup(p, p->m_symname));
+            visit(p->m_expr);
+        }
+
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
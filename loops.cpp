@@ -0,0 +1,1448 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "effects.h"
+#include <stdio.h>
+#include <set>
+#include <vector>
+#include <map>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Loop-invariant code motion. Codegen evaluates a loop's condition and body from scratch on
+ * every iteration, so an expression like n*4-1 or a[k] that reads nothing the loop writes is
+ * recomputed each time around. This pass computes it once, into a temporary, before the loop:
+ *     while (c) { ... e ... }   =>   _tN = e; while (c) { ... _tN ... }
+ *
+ * What the loop may write is everything assigned in its body plus the mod summaries of the
+ * functions it calls; an expression is invariant if it reads none of those (for an array access,
+ * the array is read as a whole). Only the largest invariant subtrees are hoisted, and nothing
+ * smaller than a unary operation on a variable.
+ *
+ * The loop may run zero times, so the temporaries are computed even when the original code
+ * wouldn't have computed e at all. That is harmless unless e can trap, so a division (or, with
+ * --bounds-check, an array access) is only hoisted if the loop was going to compute it anyway
+ * before anything that might not return: in the condition, or at the start of the body. Then
+ * the definitions go behind a copy of the condition, so that they only run when the loop does:
+ *     if (c) { _tN = e; while (c) { ... _tN ... } }
+ *
+ * Loops are processed innermost first, so an expression hoisted out of an inner loop can be
+ * hoisted out of the loop around it too.
+ */
+
+class LoopInvariantCodeMotion : public Visitor {
+    private:
+        SymTab* m_st;
+        SideEffects m_effects;
+        SymScope* m_scope;
+
+        static const int min_size = 2;
+
+        // statistics
+        int m_loops;
+        int m_hoisted;
+        int m_guarded;
+        int m_replaced;
+
+        bool is_invariant(Expr* e, set<Symbol*>& mods)
+        {
+            set<Symbol*> reads;
+            m_effects.reads(e, reads);
+            return !SideEffects::intersect(reads, mods);
+        }
+
+        // Add the largest invariant subtrees of e that can be hoisted to out
+        void invariant_parts(Expr* e, set<Symbol*>& mods, vector<Expr*>& safe, vector<Expr*>& out)
+        {
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            if(n == 0)
+                return;
+            if(expr_size(e) >= min_size && is_invariant(e, mods) &&
+               (!m_effects.may_trap(e) || SideEffects::count_equal(safe, e) != 0)){
+                if(SideEffects::count_equal(out, e) == 0)
+                    out.push_back(e);
+                return;
+            }
+            for(int i = 0; i < n; i++)
+                invariant_parts(*ops[i], mods, safe, out);
+        }
+
+        // Replace every occurrence of e in the expression in slot with name
+        void replace(Expr** slot, Expr* e, const char* name)
+        {
+            if(expr_equal(*slot, e)){
+                Expr* old = *slot;
+                Ident* id = new Ident(new SymName(copy_spelling(name)));
+                copy_attribute(id, old);
+                id->m_attribute.m_basetype = old->m_attribute.m_basetype;
+                id->m_attribute.m_lattice_elem = TOP;
+                *slot = id;
+                delete old;
+                m_replaced++;
+                return;
+            }
+            Expr** ops[2];
+            int n = expr_operands(*slot, ops);
+            for(int i = 0; i < n; i++)
+                replace(ops[i], e, name);
+        }
+
+        // Hoist what can be hoisted out of the loop at pos in stats
+        void hoist_from(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos)
+        {
+            WhileLoop* w = dynamic_cast<WhileLoop*>(*pos);
+            if(w == NULL)
+                return;
+            list<Stat_ptr>* body = w->m_nested_block->m_stat_list;
+
+            set<Symbol*> mods;
+            m_effects.stat_mods(w, mods);
+
+            // what may trap but the loop computes whenever it runs: in the condition, or
+            // anticipated at the start of the body (which only runs after the condition)
+            vector<Expr*> safe;
+            SideEffects::subexpressions(w->m_expr, min_size, safe);
+            m_effects.anticipated(body->begin(), body->end(), NULL, true, min_size, safe);
+
+            vector<Expr**> slots;
+            slots.push_back(&w->m_expr);
+            m_effects.expr_slots_anywhere(body, slots);
+            vector<Expr*> hoist;
+            for(unsigned i = 0; i < slots.size(); i++)
+                invariant_parts(*slots[i], mods, safe, hoist);
+            if(hoist.empty())
+                return;
+
+            // make the definitions (and the guard) before replacing anything
+            bool guard = false;
+            Expr* cond = copy_expr(w->m_expr);
+            vector<Stat*> defs;
+            vector<const char*> names;
+            for(unsigned i = 0; i < hoist.size(); i++){
+                Expr* value = copy_expr(hoist[i]);
+                const char* name = new_temporary(m_st, m_scope, value->m_attribute.m_basetype);
+                Stat* def = new Assignment(new SymName(copy_spelling(name)), value);
+                copy_attribute(def, w);
+                defs.push_back(def);
+                names.push_back(name);
+                guard |= m_effects.may_trap(value);
+            }
+            for(unsigned i = 0; i < hoist.size(); i++){
+                Expr* e = copy_expr(hoist[i]);  // hoist[i] itself is one of the occurrences
+                for(unsigned s = 0; s < slots.size(); s++)
+                    replace(slots[s], e, names[i]);
+                delete e;
+            }
+
+            m_loops++;
+            m_hoisted += hoist.size();
+            if(!guard){
+                delete cond;
+                for(unsigned i = 0; i < defs.size(); i++)
+                    stats->insert(pos, defs[i]);
+                return;
+            }
+
+            m_guarded++;
+            list<Stat_ptr>* preheader = new list<Stat_ptr>(defs.begin(), defs.end());
+            preheader->push_back(w);
+            Nested_block* block = new Nested_block(preheader);
+            copy_attribute(block, w->m_nested_block);
+            Stat* result = new IfNoElse(cond, block);
+            copy_attribute(result, w);
+            w->m_parent_attribute = &block->m_attribute;
+            *pos = result;
+        }
+
+        void process_stats(list<Stat_ptr>* stats)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                visit(*iter);   // inner loops first
+            }
+            forall(iter,stats){
+                hoist_from(stats, iter);
+            }
+        }
+
+    public:
+        LoopInvariantCodeMotion(SymTab* st, CallGraph* cg, bool bounds_check) : m_effects(st, cg, bounds_check)
+        {
+            m_st = st;
+            m_scope = NULL;
+            m_loops = m_hoisted = m_guarded = m_replaced = 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "licm: %d invariant expressions hoisted out of %d loops (%d behind a guard),"
+                " replacing %d computations\n", m_hoisted, m_loops, m_guarded, m_replaced);
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            SymScope* saved_scope = m_scope;
+            m_scope = p->m_function_block->m_attribute.m_scope;
+            visit(p->m_function_block);
+            m_scope = saved_scope;
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            process_stats(p->m_stat_list);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            visit(p->m_nested_block_1);
+            visit(p->m_nested_block_2);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
+
+/*
+ * Loop unswitching. An If in a loop whose condition reads nothing the loop writes goes the same
+ * way on every iteration, so instead of testing it every time the loop is duplicated, one copy
+ * for each outcome, and the test is done once before choosing a copy:
+ *     while (c) { ... if (flag) { A } else { B } ... }
+ *  => if (flag) { while (c) { ... A ... } } else { while (c) { ... B ... } }
+ * For an If without an else the second copy just leaves it out. Evaluating the condition before
+ * the loop means evaluating it even if the loop runs zero times or never gets to the If, so
+ * conditions that may trap stay where they are.
+ *
+ * Each unswitch adds a copy of the loop, so loops bigger than max_loop are left alone, and the
+ * copies made in a function may only add up to max_growth (statements and expression nodes).
+ * Within that the copies are unswitched again on their own invariant Ifs. Ifs in nested loops
+ * are left to those loops, which are processed first; unswitching them leaves an If in the outer
+ * loop that may be unswitched in turn.
+ *
+ * With --stats, every loop unswitched is listed, with the If it was unswitched on (by the lines
+ * they end on, which is what the parser records).
+ */
+
+class LoopUnswitching : public Visitor {
+    private:
+        SideEffects m_effects;
+        int m_growth;                   // added to the current function so far
+
+        static const int max_loop = 64;
+        static const int max_growth = 192;
+
+        // statistics
+        vector<int> m_loop_lines;
+        vector<int> m_if_lines;
+
+        // The If in stats (outside nested loops) to unswitch on, as the number of Ifs before it
+        // in the order find_if visits them
+        int find_if(list<Stat_ptr>* stats, set<Symbol*>& mods, int* counter)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                Expr* cond;
+                if(IfNoElse* i = dynamic_cast<IfNoElse*>(*iter))
+                    cond = i->m_expr;
+                else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(*iter))
+                    cond = ie->m_expr;
+                else
+                    continue;
+                int index = (*counter)++;
+                set<Symbol*> reads;
+                m_effects.reads(cond, reads);
+                if(!SideEffects::intersect(reads, mods) && !m_effects.may_trap(cond) && !is_literal(cond))
+                    return index;
+                vector<list<Stat_ptr>*> lists;
+                SideEffects::nested_lists(*iter, lists);
+                for(unsigned l = 0; l < lists.size(); l++){
+                    int found = find_if(lists[l], mods, counter);
+                    if(found >= 0)
+                        return found;
+                }
+            }
+            return -1;
+        }
+
+        // Where the If find_if numbered index is
+        bool locate(list<Stat_ptr>* stats, int* index, list<Stat_ptr>** where, list<Stat_ptr>::iterator* pos)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                if(!dynamic_cast<IfNoElse*>(*iter) && !dynamic_cast<IfWithElse*>(*iter))
+                    continue;
+                if((*index)-- == 0){
+                    *where = stats;
+                    *pos = iter;
+                    return true;
+                }
+                vector<list<Stat_ptr>*> lists;
+                SideEffects::nested_lists(*iter, lists);
+                for(unsigned l = 0; l < lists.size(); l++)
+                    if(locate(lists[l], index, where, pos))
+                        return true;
+            }
+            return false;
+        }
+
+        // Replace the If numbered index in the body of w by the branch it takes when its condition
+        // is outcome
+        void specialize(WhileLoop* w, int index, bool outcome)
+        {
+            list<Stat_ptr>* where;
+            list<Stat_ptr>::iterator pos;
+            locate(w->m_nested_block->m_stat_list, &index, &where, &pos);
+            Nested_block* branch = NULL;
+            if(IfNoElse* i = dynamic_cast<IfNoElse*>(*pos))
+                branch = outcome ? i->m_nested_block : NULL;
+            else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(*pos))
+                branch = outcome ? ie->m_nested_block_1 : ie->m_nested_block_2;
+            if(branch != NULL){
+                list<Stat_ptr>::iterator iter;
+                forall(iter,branch->m_stat_list){
+                    (*iter)->m_parent_attribute = (*pos)->m_parent_attribute;
+                }
+                where->splice(pos, *branch->m_stat_list);
+            }
+            delete *pos;
+            where->erase(pos);
+        }
+
+        Nested_block* make_block(Stat* s, Nested_block* like)
+        {
+            Nested_block* block = new Nested_block(new list<Stat_ptr>(1, s));
+            copy_attribute(block, like);
+            s->m_parent_attribute = &block->m_attribute;
+            return block;
+        }
+
+        // Unswitch the loop at pos as long as it has invariant Ifs and the budget lasts
+        void unswitch(list<Stat_ptr>::iterator pos)
+        {
+            WhileLoop* w = dynamic_cast<WhileLoop*>(*pos);
+            if(w == NULL)
+                return;
+            list<Stat_ptr>* body = w->m_nested_block->m_stat_list;
+            int size = SideEffects::list_size(body);
+            if(size > max_loop || m_growth + size > max_growth)
+                return;
+            set<Symbol*> mods;
+            m_effects.stat_mods(w, mods);
+            int counter = 0;
+            int index = find_if(body, mods, &counter);
+            if(index < 0)
+                return;
+
+            int found = index;
+            list<Stat_ptr>* where;
+            list<Stat_ptr>::iterator if_pos;
+            locate(body, &found, &where, &if_pos);
+            Expr* cond;
+            if(IfNoElse* i = dynamic_cast<IfNoElse*>(*if_pos))
+                cond = copy_expr(i->m_expr);
+            else
+                cond = copy_expr(((IfWithElse*) *if_pos)->m_expr);
+            m_loop_lines.push_back(w->m_attribute.lineno);
+            m_if_lines.push_back((*if_pos)->m_attribute.lineno);
+
+            WhileLoop* other = (WhileLoop*) SideEffects::copy_stat(w);
+            specialize(w, index, true);
+            specialize(other, index, false);
+            m_growth += size;
+
+            Nested_block* then_block = make_block(w, w->m_nested_block);
+            Nested_block* else_block = make_block(other, w->m_nested_block);
+            Stat* result = new IfWithElse(cond, then_block, else_block);
+            copy_attribute(result, w);
+            cond->m_parent_attribute = then_block->m_parent_attribute =
+                else_block->m_parent_attribute = &result->m_attribute;
+            *pos = result;
+
+            unswitch(then_block->m_stat_list->begin());
+            unswitch(else_block->m_stat_list->begin());
+        }
+
+        void process_stats(list<Stat_ptr>* stats)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                visit(*iter);   // inner loops first
+            }
+            forall(iter,stats){
+                unswitch(iter);
+            }
+        }
+
+    public:
+        LoopUnswitching(SymTab* st, CallGraph* cg, bool bounds_check) : m_effects(st, cg, bounds_check)
+        {
+            m_growth = 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "unswitch: %d loops unswitched\n", (int) m_loop_lines.size());
+            for(unsigned i = 0; i < m_loop_lines.size(); i++)
+                fprintf(out, "  loop ending at line %d, on the if ending at line %d\n", m_loop_lines[i], m_if_lines[i]);
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            int saved_growth = m_growth;
+            m_growth = 0;
+            visit(p->m_function_block);
+            m_growth = saved_growth;
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            process_stats(p->m_stat_list);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            visit(p->m_nested_block_1);
+            visit(p->m_nested_block_2);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
+
+/*
+ * Recognizing counted loops, for the passes below. A basic induction variable of a loop is an
+ * int variable the loop only writes with one "i = i + s" (s constant) at the top level of its
+ * body, so that it goes up by s every iteration.
+ */
+
+class InductionVariables {
+    private:
+        SideEffects* m_effects;
+
+    public:
+        InductionVariables(SideEffects* effects)
+        {
+            m_effects = effects;
+        }
+
+        static int wrap_add(int a, int b) { return (int) ((unsigned) a + (unsigned) b); }
+        static int wrap_mul(int a, int b) { return (int) ((unsigned) a * (unsigned) b); }
+
+        bool is_var(Expr* e, Symbol* v)
+        {
+            Ident* id = dynamic_cast<Ident*>(e);
+            return id != NULL && m_effects->lookup(id, id->m_symname) == v;
+        }
+
+        // Is e equal to c*iv + d for constants c and d?
+        bool linear(Expr* e, Symbol* iv, int* c, int* d)
+        {
+            int value;
+            if(is_literal(e, &value)){
+                *c = 0;
+                *d = value;
+                return e->m_attribute.m_basetype == bt_integer;
+            }
+            if(is_var(e, iv)){
+                *c = 1;
+                *d = 0;
+                return true;
+            }
+            if(Uminus* u = dynamic_cast<Uminus*>(e)){
+                if(!linear(u->m_expr, iv, c, d))
+                    return false;
+                *c = wrap_mul(*c, -1);
+                *d = wrap_mul(*d, -1);
+                return true;
+            }
+            BinaryOp op = binary_op(e);
+            if(op != op_plus && op != op_minus && op != op_times)
+                return false;
+            Expr** ops[2];
+            expr_operands(e, ops);
+            int c1, d1, c2, d2;
+            if(!linear(*ops[0], iv, &c1, &d1) || !linear(*ops[1], iv, &c2, &d2))
+                return false;
+            if(op == op_plus){
+                *c = wrap_add(c1, c2);
+                *d = wrap_add(d1, d2);
+            } else if(op == op_minus){
+                *c = wrap_add(c1, wrap_mul(c2, -1));
+                *d = wrap_add(d1, wrap_mul(d2, -1));
+            } else if(c1 == 0){
+                *c = wrap_mul(d1, c2);
+                *d = wrap_mul(d1, d2);
+            } else if(c2 == 0){
+                *c = wrap_mul(c1, d2);
+                *d = wrap_mul(d1, d2);
+            } else {
+                return false;   // quadratic
+            }
+            return true;
+        }
+
+        // Is s "v = v + step" (or v - step, or step + v) for an int v and a constant step?
+        bool is_update(Stat* s, Symbol** v, int* step)
+        {
+            Assignment* a = dynamic_cast<Assignment*>(s);
+            if(a == NULL)
+                return false;
+            Symbol* target = m_effects->lookup(a, a->m_symname);
+            int c, d;
+            if(target == NULL || target->m_basetype != bt_integer ||
+               !linear(a->m_expr, target, &c, &d) || c != 1 || d == 0)
+                return false;
+            // only v itself and constants: v + 1 - 1 + 2 would be linear too, but isn't worth the bother
+            if(expr_size(a->m_expr) != 3)
+                return false;
+            *v = target;
+            *step = d;
+            return true;
+        }
+
+        // The value iv has when the loop at pos is entered, if it is a constant assigned by
+        // *init, the last statement before the loop writing iv
+        bool initial_value(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos, Symbol* iv,
+            list<Stat_ptr>::iterator* init, int* value, bool* read_since)
+        {
+            *read_since = false;
+            list<Stat_ptr>::iterator iter = pos;
+            while(iter != stats->begin()){
+                iter--;
+                set<Symbol*> mods;
+                m_effects->stat_mods(*iter, mods);
+                if(mods.count(iv) != 0){
+                    Assignment* a = dynamic_cast<Assignment*>(*iter);
+                    *init = iter;
+                    return a != NULL && m_effects->lookup(a, a->m_symname) == iv &&
+                        is_literal(a->m_expr, value);
+                }
+                set<Symbol*> read;
+                m_effects->stat_reads(*iter, read);
+                if(read.count(iv) != 0)
+                    *read_since = true;
+            }
+            return false;
+        }
+
+        // The basic induction variables of the loop with the given body, and their steps
+        void basic(list<Stat_ptr>* body, vector<Symbol*>& ivs, vector<int>& steps)
+        {
+            map<Symbol*, int> writes;
+            vector<int> all_steps;
+            vector<Symbol*> updated;
+            list<Stat_ptr>::iterator iter;
+            for(iter = body->begin(); iter != body->end(); iter++){
+                set<Symbol*> mods;
+                m_effects->stat_mods(*iter, mods);
+                set<Symbol*>::iterator m;
+                for(m = mods.begin(); m != mods.end(); m++)
+                    writes[*m]++;
+                Symbol* v;
+                int step;
+                if(is_update(*iter, &v, &step)){
+                    updated.push_back(v);
+                    all_steps.push_back(step);
+                }
+            }
+            for(unsigned i = 0; i < updated.size(); i++){
+                if(writes[updated[i]] == 1){
+                    ivs.push_back(updated[i]);
+                    steps.push_back(all_steps[i]);
+                }
+            }
+        }
+
+        // The update of the basic induction variable iv in body
+        list<Stat_ptr>::iterator find_update(list<Stat_ptr>* body, Symbol* iv)
+        {
+            list<Stat_ptr>::iterator iter;
+            for(iter = body->begin(); iter != body->end(); iter++){
+                Symbol* v;
+                int step;
+                if(is_update(*iter, &v, &step) && v == iv)
+                    break;
+            }
+            return iter;
+        }
+
+        // Is cond "iv op bound" with op one of <, <=, >, >= and != and bound constant?
+        bool is_test(Expr* cond, Symbol* iv, BinaryOp* op, int* bound)
+        {
+            *op = binary_op(cond);
+            if(*op != op_lt && *op != op_le && *op != op_gt && *op != op_ge && *op != op_ne)
+                return false;
+            Expr** ops[2];
+            expr_operands(cond, ops);
+            return is_var(*ops[0], iv) && is_literal(*ops[1], bound) &&
+                (*ops[1])->m_attribute.m_basetype == bt_integer;
+        }
+};
+
+/*
+ * Strength reduction of induction variables. In
+ *     while (i < n) { a[i+1] = b[(i*2)+1]; ... i = i + 1; }
+ * i is a basic induction variable: the loop only writes it with one "i = i + s" (s constant) at
+ * the top level of its body, so it goes up by s every iteration. Expressions linear in it, like
+ * i+1 and (i*2)+1, then go up by a constant too, so instead of being recomputed from i (with a
+ * multiplication) wherever they are used, each gets a temporary of its own, set before the loop
+ * and bumped with an addition right after i's:
+ *     _t0 = i + 1; _t1 = (i*2) + 1;
+ *     while (i < n) { a[_t0] = b[_t1]; ... i = i + 1; _t0 = _t0 + 1; _t1 = _t1 + 2; }
+ * The generated code already folds the scaling of an index into the addressing mode, so this is
+ * as close to bumping a pointer as the language gets. Everything wraps around, in the generated
+ * code as here, so the temporaries stay equal to the expressions they replace.
+ *
+ * A bump costs about as much as a load, an add and a store, so a linear expression only gets a
+ * temporary if its occurrences cost more than that each iteration. That changes if i itself can
+ * go: when its only other use is the loop test "i < B" (or <=, >, >=) with B constant, i's
+ * value before the loop is known, and i is dead after the loop, the test is rewritten in terms of
+ * one of the temporaries (linear function test replacement) and i's update and initialization
+ * are removed. That needs the values i and the temporary take to be known not to overflow, which
+ * is why it only handles constant bounds.
+ */
+
+class StrengthReduction : public Visitor {
+    private:
+        SymTab* m_st;
+        CallGraph* m_cg;
+        SideEffects m_effects;
+        InductionVariables m_iv;
+        SymScope* m_scope;
+        FuncInfo* m_cur_func;
+        Expr* m_return;                 // the current function's Return expression
+
+        // the statement lists we are in, innermost last, and the statement each is at
+        struct Context
+        {
+            list<Stat_ptr>* m_stats;
+            list<Stat_ptr>::iterator m_pos;
+        };
+        vector<Context> m_context;
+
+        static const int bump_cost = 3;     // load, add, store
+
+        // statistics
+        int m_temps;
+        int m_replaced;
+        int m_tests;
+
+        // Cost of evaluating e: its nodes, less the literals codegen folds into instructions
+        int cost(Expr* e)
+        {
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            int result = is_literal(e) ? 0 : 1;
+            for(int i = 0; i < n; i++)
+                result += cost(*ops[i]);
+            return result;
+        }
+
+        struct Derived
+        {
+            int m_c, m_d;
+            vector<Expr**> m_slots;
+            int m_savings;
+        };
+
+        // Find the largest subtrees of the expression in slot that are linear in iv; count the
+        // other uses of iv in bare
+        void find_derived(Expr** slot, Symbol* iv, vector<Derived>& derived, int* bare)
+        {
+            int c, d;
+            if(m_iv.linear(*slot, iv, &c, &d) && c != 0){
+                if(c == 1 && d == 0){
+                    (*bare)++;
+                    return;
+                }
+                unsigned g;
+                for(g = 0; g < derived.size(); g++)
+                    if(derived[g].m_c == c && derived[g].m_d == d)
+                        break;
+                if(g == derived.size()){
+                    Derived nd;
+                    nd.m_c = c;
+                    nd.m_d = d;
+                    nd.m_savings = 0;
+                    derived.push_back(nd);
+                }
+                derived[g].m_slots.push_back(slot);
+                derived[g].m_savings += cost(*slot) - 1;
+                return;
+            }
+            if(m_iv.is_var(*slot, iv))
+                (*bare)++;
+            Expr** ops[2];
+            int n = expr_operands(*slot, ops);
+            for(int i = 0; i < n; i++)
+                find_derived(ops[i], iv, derived, bare);
+        }
+
+        // Is iv read after the statement the context at level is at, before being written?
+        bool live_after(int level, Symbol* iv)
+        {
+            list<Stat_ptr>* stats = m_context[level].m_stats;
+            list<Stat_ptr>::iterator iter = m_context[level].m_pos;
+            for(iter++; iter != stats->end(); iter++){
+                if(reads_or_kills(*iter, iv))
+                    return !kills(*iter, iv);
+            }
+            if(level == 0){
+                set<Symbol*> read;
+                m_effects.reads(m_return, read);
+                return read.count(iv) != 0;
+            }
+            // at the end of a loop's body we go around again before leaving the loop
+            if(WhileLoop* w = dynamic_cast<WhileLoop*>(*m_context[level - 1].m_pos)){
+                set<Symbol*> read;
+                m_effects.reads(w->m_expr, read);
+                if(read.count(iv) != 0)
+                    return true;
+                for(iter = stats->begin(); iter != m_context[level].m_pos; iter++){
+                    if(reads_or_kills(*iter, iv))
+                        break;
+                }
+                if(iter == m_context[level].m_pos || !kills(*iter, iv))
+                    return true;
+            }
+            return live_after(level - 1, iv);
+        }
+
+        bool reads_or_kills(Stat* s, Symbol* iv)
+        {
+            set<Symbol*> read;
+            m_effects.stat_reads(s, read);
+            return read.count(iv) != 0 || kills(s, iv);
+        }
+
+        // Does s overwrite iv without reading it?
+        bool kills(Stat* s, Symbol* iv)
+        {
+            Assignment* a = dynamic_cast<Assignment*>(s);
+            if(a == NULL || m_effects.lookup(a, a->m_symname) != iv)
+                return false;
+            set<Symbol*> read;
+            m_effects.reads(a->m_expr, read);
+            return read.count(iv) == 0;
+        }
+
+        Ident* make_ident(const char* name, Expr* like)
+        {
+            Ident* id = new Ident(new SymName(copy_spelling(name)));
+            copy_attribute(id, like);
+            id->m_attribute.m_basetype = bt_integer;
+            id->m_attribute.m_lattice_elem = TOP;
+            return id;
+        }
+
+        Stat* make_assignment(const char* name, Expr* e, Visitable* like)
+        {
+            Stat* s = new Assignment(new SymName(copy_spelling(name)), e);
+            copy_attribute(s, like);
+            return s;
+        }
+
+        // Can "iv op bound" be replaced by the same test on c*iv + d, given iv starts at start
+        // and goes up by step? *new_bound and *new_op are the test to use.
+        bool can_replace_test(BinaryOp op, int bound, int start, int step, int c, int d,
+            int* new_bound, BinaryOp* new_op)
+        {
+            bool up = (op == op_lt || op == op_le);
+            if((up && step <= 0) || (!up && step >= 0) || (op != op_lt && op != op_le && op != op_gt && op != op_ge))
+                return false;
+            // iv goes from start to at most one step past the bound
+            long long lo = start, hi = start;
+            long long last = (long long) bound + step;
+            if(last < lo) lo = last;
+            if(last > hi) hi = last;
+            if(lo < -2147483647LL - 1 || hi > 2147483647LL)
+                return false;
+            long long values[3] = { (long long) c * lo + d, (long long) c * hi + d, (long long) c * bound + d };
+            for(int i = 0; i < 3; i++)
+                if(values[i] < -2147483647LL - 1 || values[i] > 2147483647LL)
+                    return false;
+            *new_bound = (int) values[2];
+            // multiplying both sides by a negative c turns the comparison around
+            *new_op = c < 0 ? mirror_op(op) : op;
+            return true;
+        }
+
+        void reduce(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos, WhileLoop* w,
+            list<Stat_ptr>::iterator update, Symbol* iv, int step)
+        {
+            list<Stat_ptr>* body = w->m_nested_block->m_stat_list;
+            Assignment* update_stat = (Assignment*) *update;
+
+            // is the test "iv op B", which we might replace?
+            BinaryOp op;
+            int bound;
+            bool test_form = m_iv.is_test(w->m_expr, iv, &op, &bound) && op != op_ne;
+
+            vector<Derived> derived;
+            int bare = 0;
+            if(!test_form)
+                find_derived(&w->m_expr, iv, derived, &bare);
+            vector<Expr**> slots;
+            m_effects.expr_slots_anywhere(body, slots);
+            for(unsigned i = 0; i < slots.size(); i++)
+                if(slots[i] != &update_stat->m_expr)
+                    find_derived(slots[i], iv, derived, &bare);
+            if(derived.empty())
+                return;
+
+            list<Stat_ptr>::iterator init;
+            int start;
+            bool read_since;
+            bool start_known = m_iv.initial_value(stats, pos, iv, &init, &start, &read_since);
+
+            // can iv go altogether?
+            bool remove_iv = false;
+            int new_bound = 0;
+            BinaryOp new_op = op_none;
+            unsigned test_group = 0;
+            if(test_form && bare == 0 && start_known && !read_since &&
+               m_cur_func != NULL && m_cg->is_local(m_cur_func, iv)){
+                set<Symbol*> called_reads;
+                m_effects.calls_reads(body, called_reads);
+                int savings = bump_cost;
+                for(unsigned g = 0; g < derived.size(); g++){
+                    savings += derived[g].m_savings;
+                    if(derived[g].m_savings > derived[test_group].m_savings)
+                        test_group = g;
+                }
+                remove_iv = called_reads.count(iv) == 0 &&
+                    savings > bump_cost * (int) derived.size() && !live_after(m_context.size() - 1, iv) &&
+                    can_replace_test(op, bound, start, step, derived[test_group].m_c,
+                        derived[test_group].m_d, &new_bound, &new_op);
+            }
+
+            list<Stat_ptr>::iterator after_update = update;
+            after_update++;
+            for(unsigned g = 0; g < derived.size(); g++){
+                Derived& dv = derived[g];
+                if(!remove_iv && dv.m_savings <= bump_cost)
+                    continue;
+                Expr* like = *dv.m_slots[0];
+                const char* name = new_temporary(m_st, m_scope, bt_integer);
+                m_temps++;
+
+                // before the loop: name = c*iv + d
+                Expr* first;
+                if(start_known){
+                    int value = InductionVariables::wrap_mul(dv.m_c, start);
+                    first = make_literal(bt_integer, InductionVariables::wrap_add(value, dv.m_d), like);
+                } else {
+                    first = make_ident(iv_name(update_stat), like);
+                    if(dv.m_c != 1)
+                        first = make_binary(op_times, first, make_literal(bt_integer, dv.m_c, like), like);
+                    if(dv.m_d != 0)
+                        first = make_binary(op_plus, first, make_literal(bt_integer, dv.m_d, like), like);
+                }
+                stats->insert(pos, make_assignment(name, first, w));
+
+                // after iv's update: name = name + c*step
+                Expr* bump = make_binary(op_plus, make_ident(name, like),
+                    make_literal(bt_integer, InductionVariables::wrap_mul(dv.m_c, step), like), like);
+                body->insert(after_update, make_assignment(name, bump, update_stat));
+
+                for(unsigned i = 0; i < dv.m_slots.size(); i++){
+                    Expr* old = *dv.m_slots[i];
+                    *dv.m_slots[i] = make_ident(name, old);
+                    delete old;
+                    m_replaced++;
+                }
+
+                if(remove_iv && g == test_group){
+                    Expr* cond = make_binary(new_op, make_ident(name, w->m_expr),
+                        make_literal(bt_integer, new_bound, w->m_expr), w->m_expr);
+                    delete w->m_expr;
+                    w->m_expr = cond;
+                    cond->m_parent_attribute = &w->m_attribute;
+                }
+            }
+
+            if(remove_iv){
+                delete *update;
+                body->erase(update);
+                delete *init;
+                stats->erase(init);
+                m_tests++;
+            }
+        }
+
+        const char* iv_name(Assignment* update)
+        {
+            return update->m_symname->spelling();
+        }
+
+        void reduce_loop(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos)
+        {
+            WhileLoop* w = dynamic_cast<WhileLoop*>(*pos);
+            if(w == NULL)
+                return;
+            list<Stat_ptr>* body = w->m_nested_block->m_stat_list;
+
+            vector<Symbol*> ivs;
+            vector<int> steps;
+            m_iv.basic(body, ivs, steps);
+            for(unsigned i = 0; i < ivs.size(); i++){
+                // find the update again: reducing an earlier variable may have moved things
+                list<Stat_ptr>::iterator update = m_iv.find_update(body, ivs[i]);
+                if(update != body->end())
+                    reduce(stats, pos, w, update, ivs[i], steps[i]);
+            }
+        }
+
+        void process_stats(list<Stat_ptr>* stats)
+        {
+            Context c;
+            c.m_stats = stats;
+            m_context.push_back(c);
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                m_context.back().m_pos = iter;
+                visit(*iter);   // inner loops first
+            }
+            forall(iter,stats){
+                m_context.back().m_pos = iter;
+                reduce_loop(stats, iter);
+            }
+            m_context.pop_back();
+        }
+
+    public:
+        StrengthReduction(SymTab* st, CallGraph* cg, bool bounds_check) : m_effects(st, cg, bounds_check), m_iv(&m_effects)
+        {
+            m_st = st;
+            m_cg = cg;
+            m_scope = NULL;
+            m_cur_func = NULL;
+            m_return = NULL;
+            m_temps = m_replaced = m_tests = 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "ivs: %d induction variables added, replacing %d expressions;"
+                " %d loop tests replaced and their induction variables removed\n",
+                m_temps, m_replaced, m_tests);
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            SymScope* saved_scope = m_scope;
+            FuncInfo* saved_func = m_cur_func;
+            Expr* saved_return = m_return;
+            vector<Context> saved_context;
+            saved_context.swap(m_context);
+
+            m_scope = p->m_function_block->m_attribute.m_scope;
+            m_cur_func = m_cg->info(p);
+            m_return = p->m_function_block->m_return->m_expr;
+            visit(p->m_function_block);
+
+            m_scope = saved_scope;
+            m_cur_func = saved_func;
+            m_return = saved_return;
+            m_context.swap(saved_context);
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            process_stats(p->m_stat_list);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            visit(p->m_nested_block_1);
+            visit(p->m_nested_block_2);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
+
+/*
+ * Loop unrolling. A counted loop
+ *     i = k; while (i < B) { ...; i = i + s; }
+ * with k, B and s constant (i being a basic induction variable, see InductionVariables) runs a
+ * number of times known at compile time, and every iteration evaluates the test and branches
+ * back. When the body is small enough that N copies of it are cheap, the loop is replaced by the
+ * copies (full unrolling). Since the value of i in each copy is known, it is substituted for i and
+ * the updates of i in between are dropped; the simplifier runs again afterwards (see main.cpp) to
+ * fold what that makes constant.
+ *
+ * Otherwise the body is repeated factor times (--unroll=N, 4 by default) so the test runs once
+ * per factor iterations, and the test changes to stop before i passes the last whole group:
+ *     while (i < k + q*factor*s) { ...; i = i + s; ...; i = i + s; ... }
+ * The N mod factor iterations left run in a remainder loop after it, the original loop, or as
+ * straight-line copies if those are small enough. When N is under twice the factor, the unrolled
+ * loop would run once: then the copies are straight-line, and if the rest fits as well, the whole
+ * loop is unrolled fully.
+ *
+ * The budgets are in statements and expression nodes of the body, so deeply nested bodies and
+ * big expressions don't get copied around. i itself is only changed where the loop changed it,
+ * so nothing else has to know about it.
+ */
+
+class LoopUnrolling : public Visitor {
+    private:
+        SideEffects m_effects;
+        InductionVariables m_iv;
+        int m_factor;
+
+        static const int full_budget = 64;      // of the fully unrolled loop
+        static const int partial_budget = 96;   // of the unrolled body
+        static const int max_body = 32;         // bodies bigger than this gain little from partial unrolling
+
+        // statistics
+        int m_full;
+        int m_copies;
+        int m_partial;
+        int m_remainder_loops;
+
+        // How many times "while (iv op bound)" runs when iv starts at start and goes up by step,
+        // if it terminates without iv wrapping around
+        static bool trip_count(BinaryOp op, long long start, long long bound, long long step, long long* count)
+        {
+            long long n;
+            if(op == op_ne){
+                if((bound - start) % step != 0 || (bound - start) / step < 0)
+                    return false;
+                n = (bound - start) / step;
+            } else {
+                bool up = (op == op_lt || op == op_le);
+                bool runs = op == op_lt ? start < bound : op == op_le ? start <= bound :
+                    op == op_gt ? start > bound : start >= bound;
+                if(!runs)
+                    n = 0;
+                else if(up != (step > 0))
+                    return false;   // counts away from the bound
+                else if(op == op_lt)
+                    n = (bound - start + step - 1) / step;
+                else if(op == op_le)
+                    n = (bound - start) / step + 1;
+                else if(op == op_gt)
+                    n = (start - bound - step - 1) / -step;
+                else
+                    n = (start - bound) / -step + 1;
+            }
+            long long last = start + n * step;
+            if(last < -2147483647LL - 1 || last > 2147483647LL)
+                return false;
+            *count = n;
+            return true;
+        }
+
+        // Replace reads of iv in the expression in slot by value
+        void substitute(Expr** slot, Symbol* iv, int value)
+        {
+            if(m_iv.is_var(*slot, iv)){
+                Expr* old = *slot;
+                *slot = make_literal(bt_integer, value, old);
+                delete old;
+                return;
+            }
+            Expr** ops[2];
+            int n = expr_operands(*slot, ops);
+            for(int i = 0; i < n; i++)
+                substitute(ops[i], iv, value);
+        }
+
+        // Append copies of the body of w to out, for the iterations where iv starts at start,
+        // start + step, ...; if fold, iv's value is substituted and its updates dropped
+        void copy_body(WhileLoop* w, Symbol* iv, int start, int step, long long count, bool fold,
+            list<Stat_ptr>& out)
+        {
+            list<Stat_ptr>* body = w->m_nested_block->m_stat_list;
+            int value = start;
+            for(long long n = 0; n < count; n++){
+                list<Stat_ptr>::iterator iter;
+                forall(iter,body){
+                    Symbol* v;
+                    int s;
+                    if(fold && m_iv.is_update(*iter, &v, &s) && v == iv){
+                        value = InductionVariables::wrap_add(value, step);
+                        continue;
+                    }
+                    Stat* copy = SideEffects::copy_stat(*iter);
+                    copy->m_parent_attribute = w->m_parent_attribute;
+                    if(fold){
+                        vector<Expr**> slots;
+                        list<Stat_ptr> single(1, copy);
+                        m_effects.expr_slots_anywhere(&single, slots);
+                        for(unsigned i = 0; i < slots.size(); i++)
+                            substitute(slots[i], iv, value);
+                    }
+                    out.push_back(copy);
+                }
+            }
+        }
+
+        // Unroll the loop at pos in stats if it is counted and small enough; returns the
+        // position of the statement after it
+        list<Stat_ptr>::iterator unroll(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos)
+        {
+            list<Stat_ptr>::iterator next = pos;
+            next++;
+            WhileLoop* w = dynamic_cast<WhileLoop*>(*pos);
+            if(w == NULL)
+                return next;
+            list<Stat_ptr>* body = w->m_nested_block->m_stat_list;
+
+            vector<Symbol*> ivs;
+            vector<int> steps;
+            m_iv.basic(body, ivs, steps);
+            unsigned k;
+            BinaryOp op;
+            int bound;
+            for(k = 0; k < ivs.size(); k++)
+                if(m_iv.is_test(w->m_expr, ivs[k], &op, &bound))
+                    break;
+            if(k == ivs.size())
+                return next;
+            Symbol* iv = ivs[k];
+            int step = steps[k];
+            list<Stat_ptr>::iterator init;
+            int start;
+            bool read_since;
+            long long count;
+            if(!m_iv.initial_value(stats, pos, iv, &init, &start, &read_since) ||
+               !trip_count(op, start, bound, step, &count))
+                return next;
+            int body_size = SideEffects::list_size(body);
+            bool partial = m_factor > 1 && count >= m_factor && body_size <= max_body &&
+                m_factor * body_size <= partial_budget;
+            long long groups = count / m_factor;
+            long long rest = count % m_factor;
+
+            list<Stat_ptr> unrolled;
+            if(count * body_size <= full_budget || (partial && groups == 1 && rest * body_size <= full_budget)){
+                // functions we call may read iv, and then it has to be kept up to date
+                set<Symbol*> called_reads;
+                m_effects.calls_reads(body, called_reads);
+                bool fold = called_reads.count(iv) == 0;
+                copy_body(w, iv, start, step, count, fold, unrolled);
+                if(fold && count > 0){
+                    Assignment* update = (Assignment*) *m_iv.find_update(body, iv);
+                    int last = (int) (start + count * step);
+                    Stat* s = new Assignment(new SymName(copy_spelling(update->m_symname->spelling())),
+                        make_literal(bt_integer, last, update->m_expr));
+                    copy_attribute(s, w);
+                    unrolled.push_back(s);
+                }
+                m_full++;
+                m_copies += count;
+            } else if(partial && groups == 1){
+                // one group of copies runs once, so it needs no loop; the rest is too big to copy
+                copy_body(w, iv, start, step, m_factor, false, unrolled);
+                unrolled.push_back(w);
+                w = NULL;
+                m_partial++;
+                m_remainder_loops++;
+            } else if(partial){
+                int end = (int) (start + groups * m_factor * step);
+                // the unrolled loop, reusing w for the remainder loop if there is one
+                WhileLoop* loop = rest == 0 ? w : (WhileLoop*) SideEffects::copy_stat(w);
+                list<Stat_ptr> copies;
+                copy_body(w, iv, start, step, m_factor, false, copies);
+                list<Stat_ptr>::iterator iter;
+                forall(iter,loop->m_nested_block->m_stat_list){
+                    delete *iter;
+                }
+                loop->m_nested_block->m_stat_list->clear();
+                forall(iter,(&copies)){
+                    (*iter)->m_parent_attribute = &loop->m_nested_block->m_attribute;
+                    loop->m_nested_block->m_stat_list->push_back(*iter);
+                }
+                Expr** test[2];
+                expr_operands(loop->m_expr, test);
+                // iv only takes the values start + k * factor * step, so "iv < end" is the same test as
+                // "iv < end - (factor - 1) * step", which tells range analysis what the copies index with
+                Expr* var = copy_expr(*test[0]);
+                Expr* limit = make_literal(bt_integer, (int) (end - (m_factor - 1) * step), *test[1]);
+                Expr* cond = make_binary(step > 0 ? op_lt : op_gt, var, limit, loop->m_expr);
+                var->m_parent_attribute = limit->m_parent_attribute = &cond->m_attribute;
+                cond->m_parent_attribute = &loop->m_attribute;
+                delete loop->m_expr;
+                loop->m_expr = cond;
+                unrolled.push_back(loop);
+                if(rest != 0){
+                    if(rest * body_size <= full_budget){
+                        copy_body(w, iv, end, step, rest, false, unrolled);
+                    } else {
+                        unrolled.push_back(w);
+                        w = NULL;
+                        m_remainder_loops++;
+                    }
+                } else {
+                    w = NULL;   // it is the unrolled loop now
+                }
+                m_partial++;
+            } else {
+                return next;
+            }
+
+            stats->insert(pos, unrolled.begin(), unrolled.end());
+            stats->erase(pos);
+            delete w;
+            return next;
+        }
+
+        void process_stats(list<Stat_ptr>* stats)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                visit(*iter);   // inner loops first
+            }
+            iter = stats->begin();
+            while(iter != stats->end())
+                iter = unroll(stats, iter);
+        }
+
+    public:
+        LoopUnrolling(SymTab* st, CallGraph* cg, bool bounds_check, int factor) : m_effects(st, cg, bounds_check), m_iv(&m_effects)
+        {
+            m_factor = factor;
+            m_full = m_copies = m_partial = m_remainder_loops = 0;
+        }
+
+        // Did we unroll anything?
+        bool changed()
+        {
+            return m_full + m_partial != 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "unroll: %d loops fully unrolled (%d copies of their bodies),"
+                " %d unrolled by %d (%d with a remainder loop)\n",
+                m_full, m_copies, m_partial, m_factor, m_remainder_loops);
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            visit(p->m_function_block);
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            process_stats(p->m_stat_list);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            visit(p->m_nested_block_1);
+            visit(p->m_nested_block_2);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
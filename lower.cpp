@@ -0,0 +1,560 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "bounds.h"
+#include "remarks.h"
+#include "ir.h"
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+#define forallrev(iterator,listptr) \
+    for(iterator = listptr->rbegin(); iterator != listptr->rend(); iterator++) \
+
+using namespace std;
+
+/*
+ * Lowers the optimized tree to the IR of "ir.h", which codegen.cpp turns into assembly. This is
+ * where the code generator decides what to emit: which array indexes get bounds checks and which
+ * functions are memoized. Everything after it only chooses instructions.
+ *
+ * An expression lowers to the operand holding its value: literals are immediates and variables
+ * are themselves, so only inner nodes need instructions, each into a new temporary. The root of
+ * an assignment's right hand side goes straight into the variable:
+ *     x = a * b + 1      =>     %0 = mul a, b
+ *                               x = add %0, 1
+ * The operand needing more registers is evaluated first (Sethi-Ullman order), which keeps fewer
+ * temporaries live at once and so fewer spilled by the register allocator.
+ * Conditions branch on their value, and codegen fuses a comparison with the branch after it:
+ *     while (i < n) { ... }   =>   B1: %0 = lt i, n
+ *                                      branch %0, B2, B3
+ *                                  B2: ...
+ *                                      jump B1
+ *                                  B3:
+ * Nested functions become functions of their own, after the one they are declared in; they still
+ * find the variables of the enclosing function at their offsets in their own frame, as before.
+ */
+
+class IRBuilder : public Visitor {
+    private:
+        SymTab* m_st;
+        IRProgram* m_program;
+        IRFunction* m_func;
+        IRBlock* m_block;           // where instructions are appended
+        int m_blocks;               // for numbering blocks across the program
+
+        IROperand m_value;          // what the last expression visited lowered to
+        IROperand m_into;           // where the expression being visited should go, if anywhere
+
+        // memoization (--memoize): NULL when off
+        CallGraph* m_memo_cg;
+        // bounds checking (--bounds-check): NULL when off
+        BoundsAnalysis* m_bounds;
+        // optimization remarks (--remarks): NULL when off
+        Remarks* m_remarks;
+
+        // ********** Helper functions ********************************
+
+        IRBlock* new_block()
+        {
+            IRBlock* b = new IRBlock(m_blocks++);
+            m_func->m_blocks.push_back(b);
+            return b;
+        }
+
+        IROperand new_temp()
+        {
+            return IROperand::make_temp(m_func->m_temps++);
+        }
+
+        IRInstr* emit(IROp op, int line)
+        {
+            IRInstr* in = new IRInstr(op, line);
+            m_block->m_instrs.push_back(in);
+            return in;
+        }
+
+        void emit_jump(IRBlock* target, int line)
+        {
+            emit(ir_jump, line)->m_target = target;
+        }
+
+        void emit_branch(IROperand cond, IRBlock* if_true, IRBlock* if_false, int line)
+        {
+            IRInstr* in = emit(ir_branch, line);
+            in->m_a = cond;
+            in->m_target = if_true;
+            in->m_target2 = if_false;
+        }
+
+        Symbol* lookup(Visitable* p, SymName* name)
+        {
+            Symbol* s = m_st->lookup(p->m_attribute.m_scope, name->spelling());
+            assert(s != NULL);
+            return s;
+        }
+
+        IROperand variable(Visitable* p, SymName* name)
+        {
+            return IROperand::make_var(lookup(p, name), name->spelling());
+        }
+
+        // Lower e, into the variable or temporary into if given
+        IROperand value(Expr* e, IROperand into = IROperand())
+        {
+            IROperand saved = m_into;
+            m_into = into;
+            visit(e);
+            m_into = saved;
+            if(!into.is_none() && !(m_value == into)){
+                IRInstr* in = emit(ir_copy, e->m_attribute.lineno);
+                in->m_dst = into;
+                in->m_a = m_value;
+                m_value = into;
+            }
+            return m_value;
+        }
+
+        // The destination for an inner node: where it was asked to go, or a new temporary
+        IROperand destination()
+        {
+            IROperand dst = m_into.is_none() ? new_temp() : m_into;
+            m_into = IROperand();
+            return dst;
+        }
+
+        // Evaluate the operand that needs more registers first (see expr_registers), so the
+        // other one's temporaries are the only ones live next to its result
+        void lower_binary(Expr* p, IROp op, Expr* e1, Expr* e2)
+        {
+            IROperand dst = m_into;
+            m_into = IROperand();
+            IROperand a, b;
+            if(expr_registers(e2) > expr_registers(e1)){
+                b = value(e2);
+                a = value(e1);
+            } else {
+                a = value(e1);
+                b = value(e2);
+            }
+            IRInstr* in = emit(op, p->m_attribute.lineno);
+            m_into = dst;
+            in->m_dst = destination();
+            in->m_a = a;
+            in->m_b = b;
+            m_value = in->m_dst;
+        }
+
+        void lower_unary(Expr* p, IROp op, Expr* e)
+        {
+            IROperand dst = m_into;
+            m_into = IROperand();
+            IROperand a = value(e);
+            IRInstr* in = emit(op, p->m_attribute.lineno);
+            m_into = dst;
+            in->m_dst = destination();
+            in->m_a = a;
+            m_value = in->m_dst;
+        }
+
+        // The instruction for storing into or loading from arr[index] of the ArrayAccess,
+        // ArrayAssignment or ArrayCall p, after its bounds check if it needs one (--bounds-check).
+        // A literal index out of bounds always traps, which codegen does by jumping to the trap.
+        IRInstr* emit_array(IROp op, Visitable* p, SymName* name, IROperand index)
+        {
+            Symbol* s = lookup(p, name);
+            int line = p->m_attribute.lineno;
+            if(m_bounds != NULL && needs_check(p, s, index)){
+                IRInstr* check = emit(ir_check, line);
+                check->m_a = index;
+                check->m_array = s;
+                check->m_array_name = name->spelling();
+                m_program->m_bounds_checked = true;
+            }
+            IRInstr* in = emit(op, line);
+            in->m_a = index;
+            in->m_array = s;
+            in->m_array_name = name->spelling();
+            return in;
+        }
+
+        bool needs_check(Visitable* p, Symbol* s, IROperand index)
+        {
+            if(index.is_imm()){
+                if(index.m_value >= 0 && index.m_value < s->arr_length)
+                    return false;
+                if(m_remarks != NULL)
+                    m_remarks->missed("codegen", p->m_attribute.lineno, m_func->m_name, "%s is always out of bounds (length %d): it traps",
+                        array_text(p).c_str(), s->arr_length);
+                return true;
+            }
+            bool proven = m_bounds->in_bounds(p);
+            if(m_remarks != NULL && proven)
+                m_remarks->passed("codegen", p->m_attribute.lineno, m_func->m_name, "no bounds check on %s: index proven in [0, %d)",
+                    array_text(p).c_str(), s->arr_length);
+            else if(m_remarks != NULL)
+                m_remarks->missed("codegen", p->m_attribute.lineno, m_func->m_name, "bounds check kept on %s: index not proven in [0, %d)",
+                    array_text(p).c_str(), s->arr_length);
+            return !proven;
+        }
+
+        // "a[i]" for the ArrayAccess, ArrayAssignment or ArrayCall p
+        static string array_text(Visitable* p)
+        {
+            const char* name;
+            Expr* index;
+            if(ArrayAccess* a = dynamic_cast<ArrayAccess*>(p)){
+                name = a->m_symname->spelling();
+                index = a->m_expr;
+            } else if(ArrayAssignment* aa = dynamic_cast<ArrayAssignment*>(p)){
+                name = aa->m_symname->spelling();
+                index = aa->m_expr_1;
+            } else {
+                ArrayCall* ac = dynamic_cast<ArrayCall*>(p);
+                name = ac->m_symname_1->spelling();
+                index = ac->m_expr_1;
+            }
+            return string(name) + "[" + Remarks::text(index) + "]";
+        }
+
+        // Evaluate the arguments, then pass them last first and call f into dst
+        void emit_call(Stat* p, SymName* f, list<Expr_ptr>* args, IROperand dst)
+        {
+            vector<IROperand> values;
+            list<Expr_ptr>::iterator iter;
+            forall(iter,args){
+                values.push_back(value(*iter));
+            }
+            int line = p->m_attribute.lineno;
+            for(int i = (int) values.size() - 1; i >= 0; i--)
+                emit(ir_param, line)->m_a = values[i];
+            IRInstr* in = emit(ir_call, line);
+            in->m_dst = dst;
+            in->m_func = f->spelling();
+            in->m_args = values.size();
+        }
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //  Memoization
+        //
+        //  A recursive function that neither reads nor writes anything outside its own
+        //  frame returns the same value whenever it is called with the same arguments, so
+        //  with --memoize it keeps a table of the values it returned (see codegen.cpp for
+        //  the code). The tables have memo_entries entries in all, so each argument is looked
+        //  up if it is in [0, range), where range is the largest with range^args <= memo_entries
+        //  (256 for two arguments). That covers fib-like recurrences and dynamic programming
+        //  helpers over small indices, which go from exponential to linear time.
+        //
+        //////////////////////////////////////////////////////////////////////////////
+
+        static const int memo_entries = 65536;
+
+        // The range of each argument if p is to be memoized, 0 if not. If p is recursive but
+        // can't be memoized, *why says why.
+        int memo_range(Func* p, const char** why)
+        {
+            *why = NULL;
+            if(m_memo_cg == NULL)
+                return 0;
+            FuncInfo* f = m_memo_cg->info(p);
+            if(f == NULL || !f->m_recursive)
+                return 0;
+            *why = "it may have side effects";
+            if(!f->m_pure)
+                return 0;
+            *why = "it reads variables of enclosing functions";
+            if(!f->m_ref.empty())
+                return 0;
+            int n = p->m_param_list->size();
+            list<Param_ptr>::iterator iter;
+            *why = "it takes an array";
+            forall(iter,p->m_param_list){
+                Basetype type = (*iter)->m_type->m_attribute.m_basetype;
+                if(type != bt_integer && type != bt_boolean)
+                    return 0;
+            }
+            *why = "it takes no arguments";
+            if(n == 0)
+                return 0;
+            *why = "a table covering 8 values of each argument would be too large";
+            int range = 1;
+            while(true){
+                long long entries = 1;
+                for(int i = 0; i < n; i++)
+                    entries *= range + 1;
+                if(entries > memo_entries)
+                    break;
+                range++;
+            }
+            return range >= 8 ? range : 0;
+        }
+
+    public:
+
+        // With a call graph, pure recursive functions are memoized (see memo_range)
+        // With a bounds analysis, array indexes it can't show are in bounds are checked
+        // With remarks, the memoization and bounds check decisions are reported
+        IRBuilder(SymTab* st, CallGraph* memo_cg = NULL, BoundsAnalysis* bounds = NULL, Remarks* remarks = NULL)
+        {
+            m_st = st;
+            m_program = new IRProgram();
+            m_func = NULL;
+            m_block = NULL;
+            m_blocks = 0;
+            m_memo_cg = memo_cg;
+            m_bounds = bounds;
+            m_remarks = remarks;
+        }
+
+        ~IRBuilder()
+        {
+            delete m_program;
+        }
+
+        // What was lowered so far; the caller owns it from here
+        IRProgram* release()
+        {
+            IRProgram* program = m_program;
+            m_program = new IRProgram();
+            return program;
+        }
+
+        void visitProgram(Program * p)
+        {
+            visit_children_of(p);
+        }
+        void visitFunc(Func * p)
+        {
+            const char* name = p->m_symname->spelling();
+            IRFunction* f = new IRFunction(name);
+            m_program->m_funcs.push_back(f);
+            m_func = f;
+            list<Param_ptr>::iterator iter;
+            SymScope* scope = p->m_function_block->m_attribute.m_scope;
+            forall(iter,p->m_param_list){
+                const char* param = (*iter)->m_symname->spelling();
+                f->m_params.push_back(IROperand::make_var(m_st->lookup(scope, param), param));
+            }
+            f->m_frame = m_st->scopesize(scope);
+
+            const char* why;
+            f->m_memo_range = memo_range(p, &why);
+            if(m_remarks != NULL && f->m_memo_range > 0)
+                m_remarks->passed("codegen", p->m_attribute.lineno, name, "%s memoized: arguments in [0, %d) are looked up in a table",
+                    name, f->m_memo_range);
+            else if(m_remarks != NULL && why != NULL)
+                m_remarks->missed("codegen", p->m_attribute.lineno, name, "%s not memoized: %s", name, why);
+
+            m_block = new_block();
+            visit(p->m_function_block);
+            f->build_cfg();
+
+            // then the nested functions, each a function of its own
+            list<Func_ptr>::iterator fiter;
+            forall(fiter,p->m_function_block->m_func_list){
+                visit(*fiter);
+            }
+        }
+        void visitFunction_block(Function_block * p)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,p->m_stat_list){
+                visit(*iter);
+            }
+            visit(p->m_return);
+        }
+        void visitNested_block(Nested_block * p)
+        {
+            visit_children_of(p);
+        }
+        void visitReturn(Return * p)
+        {
+            IROperand a = value(p->m_expr);
+            emit(ir_return, p->m_attribute.lineno)->m_a = a;
+        }
+        void visitAssignment(Assignment * p)
+        {
+            value(p->m_expr, variable(p, p->m_symname));
+        }
+        void visitArrayAssignment(ArrayAssignment * p)
+        {
+            IROperand index, v;
+            if(expr_registers(p->m_expr_2) > expr_registers(p->m_expr_1)){
+                v = value(p->m_expr_2);
+                index = value(p->m_expr_1);
+            } else {
+                index = value(p->m_expr_1);
+                v = value(p->m_expr_2);
+            }
+            emit_array(ir_store, p, p->m_symname, index)->m_b = v;
+        }
+        void visitCall(Call * p)
+        {
+            emit_call(p, p->m_symname_2, p->m_expr_list, variable(p, p->m_symname_1));
+        }
+        void visitArrayCall(ArrayCall * p)
+        {
+            // the index is evaluated before the call
+            IROperand index = value(p->m_expr_1);
+            if(index.is_var())
+                index = value(p->m_expr_1, new_temp());
+            IROperand result = new_temp();
+            emit_call(p, p->m_symname_2, p->m_expr_list_2, result);
+            emit_array(ir_store, p, p->m_symname_1, index)->m_b = result;
+        }
+
+        // control flow
+        void visitIfNoElse(IfNoElse * p)
+        {
+            int line = p->m_attribute.lineno;
+            IROperand cond = value(p->m_expr);
+            IRBlock* then_block = new_block();
+            IRBlock* done = new IRBlock(m_blocks++);
+            emit_branch(cond, then_block, done, line);
+            m_block = then_block;
+            visit(p->m_nested_block);
+            emit_jump(done, line);
+            m_func->m_blocks.push_back(done);
+            m_block = done;
+        }
+        void visitIfWithElse(IfWithElse * p)
+        {
+            int line = p->m_attribute.lineno;
+            IROperand cond = value(p->m_expr);
+            IRBlock* then_block = new_block();
+            IRBlock* else_block = new IRBlock(m_blocks++);
+            IRBlock* done = new IRBlock(m_blocks++);
+            emit_branch(cond, then_block, else_block, line);
+            m_block = then_block;
+            visit(p->m_nested_block_1);
+            emit_jump(done, line);
+            m_func->m_blocks.push_back(else_block);
+            m_block = else_block;
+            visit(p->m_nested_block_2);
+            emit_jump(done, line);
+            m_func->m_blocks.push_back(done);
+            m_block = done;
+        }
+        void visitWhileLoop(WhileLoop * p)
+        {
+            int line = p->m_attribute.lineno;
+            IRBlock* head = new_block();
+            emit_jump(head, line);
+            m_block = head;
+            IROperand cond = value(p->m_expr);
+            IRBlock* body = new_block();
+            IRBlock* done = new IRBlock(m_blocks++);
+            emit_branch(cond, body, done, line);
+            m_block = body;
+            visit(p->m_nested_block);
+            emit_jump(head, line);
+            m_func->m_blocks.push_back(done);
+            m_block = done;
+        }
+
+        // declarations have no code
+        void visitDecl(Decl * p) {}
+        void visitParam(Param * p) {}
+        void visitTInt(TInt * p) {}
+        void visitTBool(TBool * p) {}
+        void visitTIntArray(TIntArray * p) {}
+
+        // comparison operations
+        void visitCompare(Compare * p)
+        {
+            lower_binary(p, ir_eq, p->m_expr_1, p->m_expr_2);
+        }
+        void visitNoteq(Noteq * p)
+        {
+            lower_binary(p, ir_ne, p->m_expr_1, p->m_expr_2);
+        }
+        void visitGt(Gt * p)
+        {
+            lower_binary(p, ir_gt, p->m_expr_1, p->m_expr_2);
+        }
+        void visitGteq(Gteq * p)
+        {
+            lower_binary(p, ir_ge, p->m_expr_1, p->m_expr_2);
+        }
+        void visitLt(Lt * p)
+        {
+            lower_binary(p, ir_lt, p->m_expr_1, p->m_expr_2);
+        }
+        void visitLteq(Lteq * p)
+        {
+            lower_binary(p, ir_le, p->m_expr_1, p->m_expr_2);
+        }
+
+        // arithmetic and logic operations
+        void visitAnd(And * p)
+        {
+            lower_binary(p, ir_and, p->m_expr_1, p->m_expr_2);
+        }
+        void visitOr(Or * p)
+        {
+            lower_binary(p, ir_or, p->m_expr_1, p->m_expr_2);
+        }
+        void visitMinus(Minus * p)
+        {
+            lower_binary(p, ir_sub, p->m_expr_1, p->m_expr_2);
+        }
+        void visitPlus(Plus * p)
+        {
+            lower_binary(p, ir_add, p->m_expr_1, p->m_expr_2);
+        }
+        void visitTimes(Times * p)
+        {
+            lower_binary(p, ir_mul, p->m_expr_1, p->m_expr_2);
+        }
+        void visitDiv(Div * p)
+        {
+            lower_binary(p, ir_div, p->m_expr_1, p->m_expr_2);
+        }
+        void visitNot(Not * p)
+        {
+            lower_unary(p, ir_not, p->m_expr);
+        }
+        void visitUminus(Uminus * p)
+        {
+            lower_unary(p, ir_neg, p->m_expr);
+        }
+        void visitMagnitude(Magnitude * p)
+        {
+            lower_unary(p, ir_abs, p->m_expr);
+        }
+
+        // variable and constant access
+        void visitIdent(Ident * p)
+        {
+            m_value = variable(p, p->m_symname);
+        }
+        void visitIntLit(IntLit * p)
+        {
+            m_value = IROperand::make_imm(p->m_primitive->m_data);
+        }
+        void visitBoolLit(BoolLit * p)
+        {
+            m_value = IROperand::make_imm(p->m_primitive->m_data);
+        }
+        void visitArrayAccess(ArrayAccess * p)
+        {
+            IROperand dst = m_into;
+            m_into = IROperand();
+            IROperand index = value(p->m_expr);
+            IRInstr* in = emit_array(ir_load, p, p->m_symname, index);
+            m_into = dst;
+            in->m_dst = destination();
+            m_value = in->m_dst;
+        }
+
+        // special cases
+        void visitSymName(SymName * p) {}
+        void visitPrimitive(Primitive * p) {}
+};
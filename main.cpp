@@ -5,9 +5,28 @@
 #include "symtab.h"
 #include "primitive.h"
 #include "typecheck.cpp"
+#include "callgraph.h"
 #include "constantfolding.cpp"
+#include "simplify.cpp"
+#include "tailcalls.cpp"
+#include "inliner.cpp"
+#include "liveness.cpp"
+#include "threading.cpp"
+#include "valuenumbering.cpp"
+#include "loops.cpp"
+#include "lower.cpp"
 #include "codegen.cpp"
+#include "deadfuncs.cpp"
 #include <assert.h>
+#include <stdlib.h>
+#include <set>
+#include <string>
+
+#ifdef NOFOLDING
+#define FOLDING 0
+#else
+#define FOLDING 1
+#endif
 
 extern int yydebug; // set this to 1 if you want yyparse to dump a trace
 extern int yyparse(); // this actually the parser which then calls the scanner
@@ -20,26 +39,241 @@ void dopass_typecheck(Program_ptr ast, SymTab* st) {
 	delete typecheck;
 }
 
-void dopass_constantfolding(Program_ptr ast, SymTab* st) {
-        ConstantFolding* constant_folding = new ConstantFolding(stderr, st); //create the visitor
+CallGraph* dopass_callgraph(Program_ptr ast, SymTab* st) {
+	CallGraph* call_graph = new CallGraph(st);
+	call_graph->build(ast); //collect calls and compute the mod/ref summaries
+	return call_graph;
+}
+
+void dopass_constantfolding(Program_ptr ast, SymTab* st, CallGraph* cg, long budget, Remarks* remarks) {
+        ConstantFolding* constant_folding = new ConstantFolding(stderr, st, cg, budget, remarks); //create the visitor
 	LatticeElemMap *map = new LatticeElemMap();
         map = ast->accept(constant_folding, map); //walk the tree with the visitor above
 	delete map;
 	delete constant_folding;
 }
 
-void dopass_codegen(Program_ptr ast, SymTab * st)
+void dopass_simplify(Program_ptr ast, SymTab* st, bool bounds_check, bool stats) {
+	Simplifier* simplifier = new Simplifier(st, bounds_check);
+	ast->accept(simplifier);
+	if (stats) simplifier->print_stats(stderr);
+	delete simplifier;
+}
+
+void dopass_deadstores(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, long budget, bool stats) {
+	DeadStoreElimination* dse = new DeadStoreElimination(st, cg, bounds_check, budget);
+	ast->accept(dse);
+	if (stats) dse->print_stats(stderr);
+	delete dse;
+}
+
+// Returns whether any call was eliminated
+bool dopass_tailcalls(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, bool stats) {
+	TailCalls* tailcalls = new TailCalls(st, cg, bounds_check);
+	ast->accept(tailcalls);
+	if (stats) tailcalls->print_stats(stderr);
+	bool changed = tailcalls->changed();
+	delete tailcalls;
+	return changed;
+}
+
+// Returns whether anything was inlined
+bool dopass_inline(Program_ptr ast, SymTab* st, CallGraph* cg, bool stats) {
+	Inliner* inliner = new Inliner(st, cg);
+	ast->accept(inliner);
+	if (stats) inliner->print_stats(stderr);
+	bool changed = inliner->changed();
+	delete inliner;
+	return changed;
+}
+
+void dopass_threading(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, bool stats) {
+	JumpThreading* threading = new JumpThreading(st, cg, bounds_check);
+	ast->accept(threading);
+	if (stats) threading->print_stats(stderr);
+	delete threading;
+}
+
+void dopass_licm(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, bool stats) {
+	LoopInvariantCodeMotion* licm = new LoopInvariantCodeMotion(st, cg, bounds_check);
+	ast->accept(licm);
+	if (stats) licm->print_stats(stderr);
+	delete licm;
+}
+
+void dopass_unswitch(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, bool stats) {
+	LoopUnswitching* unswitch = new LoopUnswitching(st, cg, bounds_check);
+	ast->accept(unswitch);
+	if (stats) unswitch->print_stats(stderr);
+	delete unswitch;
+}
+
+void dopass_strengthreduction(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, bool stats) {
+	StrengthReduction* ivs = new StrengthReduction(st, cg, bounds_check);
+	ast->accept(ivs);
+	if (stats) ivs->print_stats(stderr);
+	delete ivs;
+}
+
+// returns whether it unrolled anything
+bool dopass_unroll(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, int factor, bool stats) {
+	LoopUnrolling* unroll = new LoopUnrolling(st, cg, bounds_check, factor);
+	ast->accept(unroll);
+	if (stats) unroll->print_stats(stderr);
+	bool changed = unroll->changed();
+	delete unroll;
+	return changed;
+}
+
+void dopass_pre(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, bool stats) {
+	PartialRedundancyElimination* pre = new PartialRedundancyElimination(st, cg, bounds_check);
+	ast->accept(pre);
+	if (stats) pre->print_stats(stderr);
+	delete pre;
+}
+
+void dopass_valuenumbering(Program_ptr ast, SymTab* st, CallGraph* cg, bool bounds_check, bool stats) {
+	LocalValueNumbering* lvn = new LocalValueNumbering(st, cg, bounds_check);
+	ast->accept(lvn);
+	if (stats) lvn->print_stats(stderr);
+	delete lvn;
+}
+
+void dopass_deadfuncs(Program_ptr ast, SymTab* st, CallGraph* cg, bool stats) {
+	DeadFunctions* deadfuncs = new DeadFunctions(cg);
+	ast->accept(deadfuncs);
+	if (stats) {
+		// what the removed functions would have cost, by generating them on the side
+		FILE* scratch = tmpfile();
+		long bytes = 0;
+		if (scratch != NULL) {
+			IRBuilder* builder = new IRBuilder(st);
+			for (unsigned i = 0; i < deadfuncs->removed().size(); i++)
+				deadfuncs->removed()[i]->accept(builder);
+			IRProgram* ir = builder->release();
+			RegisterAllocator alloc;
+			Peephole peephole;
+			Codegen* codegen = new Codegen(scratch, &alloc, &peephole);
+			for (unsigned i = 0; i < ir->m_funcs.size(); i++)
+				codegen->emit(ir->m_funcs[i]);
+			delete codegen;
+			delete ir;
+			delete builder;
+			bytes = ftell(scratch);
+			fclose(scratch);
+		}
+		deadfuncs->print_stats(stderr, bytes);
+	}
+	delete deadfuncs;
+}
+
+BoundsAnalysis* dopass_bounds(Program_ptr ast, SymTab* st, CallGraph* cg, long budget, bool stats) {
+	BoundsAnalysis* bounds = new BoundsAnalysis(st, cg, budget);
+	ast->accept(bounds);
+	if (stats) bounds->print_stats(stderr);
+	return bounds;
+}
+
+IRProgram* dopass_lower(Program_ptr ast, SymTab * st, CallGraph * memo_cg, BoundsAnalysis * bounds, Remarks * remarks, bool dump)
+{
+	IRBuilder* builder = new IRBuilder(st, memo_cg, bounds, remarks);
+	ast->accept(builder);
+	IRProgram* ir = builder->release();
+	delete builder;
+	IRVerifier verifier(stderr);
+	if (!verifier.verify(ir)) {
+		ir->dump(stderr);
+		exit(1);
+	}
+	if (dump) ir->dump(stderr);
+	return ir;
+}
+
+void dopass_codegen(IRProgram * ir, bool regalloc, bool peephole, bool stats)
 {
-	Codegen *codegen = new Codegen(stdout, st);	// create the visitor
-	ast->accept(codegen);				// walk the tree with the visitor above
+	RegisterAllocator* alloc = regalloc ? new RegisterAllocator() : NULL;
+	Peephole* peep = peephole ? new Peephole() : NULL;
+	Codegen *codegen = new Codegen(stdout, alloc, peep);
+	codegen->emit(ir);
+	if (stats && alloc != NULL) alloc->print_stats(stderr);
+	if (stats && peep != NULL) peep->print_stats(stderr);
+	if (stats) codegen->print_stats(stderr);
 	delete codegen;
+	delete alloc;
+	delete peep;
 }
 
 Program_ptr ast; /* make sure to set this to the final syntax tree in parser.ypp*/
 
-int main(void) {
+// names of the passes that can be turned off with --disable=
+static const char* optional_passes[] = { "tailcalls", "inline", "simplify", "dse", "threading", "licm", "unswitch", "ivs", "unroll", "pre", "lvn", "deadfuncs", "regalloc", "peephole", NULL };
+
+// Per function and pass, in statements and expression nodes visited while iterating loops to a
+// fixpoint (see "budget.h"). Ordinary functions use well under 10000; running out takes loops
+// nested about eight deep, each changing what the next one sees.
+static const long default_budget = 200000;
+
+static void usage(const char* prog) {
+	fprintf(stderr, "usage: %s [options] < program > assembly\n", prog);
+	fprintf(stderr, "  --stats            print what each optimization pass did to stderr\n");
+	fprintf(stderr, "  --unroll=N         unroll counted loops N times (default 4; 1 only unrolls fully)\n");
+	fprintf(stderr, "  --memoize          cache the results of pure recursive functions in a table\n");
+	fprintf(stderr, "  --bounds-check     trap on array indexes out of bounds (ud2), where not proven in bounds\n");
+	fprintf(stderr, "  --remarks=FILE     write what folding and codegen did and didn't do, and why, as JSON lines\n");
+	fprintf(stderr, "  --dump-ir          print the intermediate representation codegen works from to stderr\n");
+	fprintf(stderr, "  --budget=N         steps each function gets in each loop analysis before it gives up (default %ld)\n", default_budget);
+	fprintf(stderr, "  --disable=PASS     don't run PASS, one of:");
+	for (int i = 0; optional_passes[i] != NULL; i++)
+		fprintf(stderr, " %s", optional_passes[i]);
+	fprintf(stderr, "\n");
+}
+
+static bool is_optional_pass(const char* name) {
+	for (int i = 0; optional_passes[i] != NULL; i++)
+		if (strcmp(optional_passes[i], name) == 0)
+			return true;
+	return false;
+}
+
+int main(int argc, char** argv) {
 
 	SymTab st; //symbol table
+	bool stats = false;
+	set<string> disabled;
+	int unroll_factor = 4;
+	bool memoize = false;
+	bool bounds_check = false;
+	long budget = default_budget;
+	FILE* remarks_file = NULL;
+	bool dump_ir = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--stats") == 0) {
+			stats = true;
+		} else if (strncmp(argv[i], "--budget=", 9) == 0 && atol(argv[i] + 9) >= 1) {
+			budget = atol(argv[i] + 9);
+		} else if (strncmp(argv[i], "--remarks=", 10) == 0 && argv[i][10] != '\0') {
+			if (remarks_file != NULL) fclose(remarks_file);
+			remarks_file = fopen(argv[i] + 10, "w");
+			if (remarks_file == NULL) {
+				perror(argv[i] + 10);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--dump-ir") == 0) {
+			dump_ir = true;
+		} else if (strcmp(argv[i], "--bounds-check") == 0) {
+			bounds_check = true;
+		} else if (strcmp(argv[i], "--memoize") == 0) {
+			memoize = true;
+		} else if (strncmp(argv[i], "--unroll=", 9) == 0 && atoi(argv[i] + 9) >= 1) {
+			unroll_factor = atoi(argv[i] + 9);
+		} else if (strncmp(argv[i], "--disable=", 10) == 0 && is_optional_pass(argv[i] + 10)) {
+			disabled.insert(argv[i] + 10);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
 	// set this to 1 if you would like to print a trace 
 	// of the entire parsing process (it prints to stdout)
@@ -50,12 +284,59 @@ int main(void) {
         yyparse();  
 
 	if (ast) {
+		Remarks* remarks = remarks_file != NULL ? new Remarks(remarks_file) : NULL;
 		dopass_typecheck( ast, &st );
-		dopass_constantfolding(ast, &st);
+		CallGraph* call_graph = dopass_callgraph(ast, &st);
+		// folding rewrites the tree; codegen relies on constants being literals only for speed.
+		// Its remarks are held until we know whether it runs again after inlining.
+		if (remarks) remarks->hold();
+		if (FOLDING) dopass_constantfolding(ast, &st, call_graph, budget, remarks);
+		// functions whose recursion became a loop may be inlined
+		if (!disabled.count("tailcalls") && dopass_tailcalls(ast, &st, call_graph, bounds_check, stats)) {
+			delete call_graph;
+			call_graph = dopass_callgraph(ast, &st);
+		}
+		// fold again with the arguments of the inlined calls in view
+		if (!disabled.count("inline") && dopass_inline(ast, &st, call_graph, stats)) {
+			delete call_graph;
+			call_graph = dopass_callgraph(ast, &st);
+			if (remarks) remarks->hold();
+			if (FOLDING) dopass_constantfolding(ast, &st, call_graph, budget, remarks);
+		}
+		if (remarks) remarks->flush();
+		if (!disabled.count("simplify")) dopass_simplify(ast, &st, bounds_check, stats);
+
+		// folding may have replaced calls, so the summaries are out of date
+		delete call_graph;
+		call_graph = dopass_callgraph(ast, &st);
+		if (!disabled.count("dse")) dopass_deadstores(ast, &st, call_graph, bounds_check, budget, stats);
+		if (!disabled.count("threading")) dopass_threading(ast, &st, call_graph, bounds_check, stats);
+		if (!disabled.count("licm")) dopass_licm(ast, &st, call_graph, bounds_check, stats);
+		if (!disabled.count("unswitch")) dopass_unswitch(ast, &st, call_graph, bounds_check, stats);
+		if (!disabled.count("ivs")) dopass_strengthreduction(ast, &st, call_graph, bounds_check, stats);
+		// fold what full unrolling made constant
+		if (!disabled.count("unroll") && dopass_unroll(ast, &st, call_graph, bounds_check, unroll_factor, stats) &&
+		    !disabled.count("simplify"))
+			dopass_simplify(ast, &st, bounds_check, false);
+		if (!disabled.count("pre")) dopass_pre(ast, &st, call_graph, bounds_check, stats);
+		if (!disabled.count("lvn")) dopass_valuenumbering(ast, &st, call_graph, bounds_check, stats);
+
+		// only what Main can reach gets emitted; the passes above may have dropped calls
+		delete call_graph;
+		call_graph = dopass_callgraph(ast, &st);
+		if (!disabled.count("deadfuncs")) dopass_deadfuncs(ast, &st, call_graph, stats);
+
+		BoundsAnalysis* bounds = bounds_check ? dopass_bounds(ast, &st, call_graph, budget, stats) : NULL;
 
 		// do codegen!
-		dopass_codegen( ast, &st );
+		IRProgram* ir = dopass_lower(ast, &st, memoize ? call_graph : NULL, bounds, remarks, dump_ir);
+		dopass_codegen(ir, !disabled.count("regalloc"), !disabled.count("peephole"), stats);
+		delete ir;
+		delete bounds;
+		delete call_graph;
+		delete remarks;
 	}
+	if (remarks_file != NULL) fclose(remarks_file);
     return 0;
 }
 
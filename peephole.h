@@ -0,0 +1,459 @@
+#ifndef PEEPHOLE_HPP
+#define PEEPHOLE_HPP
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * The assembly of a function as a list of instructions, labels and directives, which codegen
+ * builds instead of printing as it goes, and a peephole optimizer over it. Operands are kept as
+ * what they are (a register, an immediate, a memory reference or a name) and only turned into
+ * text when the code is printed.
+ *
+ * Codegen chooses instructions one IR instruction at a time, so the seams between them are left
+ * with moves and jumps that a look at a few instructions at once shows are redundant:
+ *     movl %edi, -104(%ebp,%ebx,4)         jmp B5              cmpl $0, %ebx
+ *     movl -104(%ebp,%ebx,4), %edi         ...                 =>  testl %ebx, %ebx
+ *     =>  (the load goes)              B5: jmp B1
+ *                                          =>  jmp B1
+ * Each rule in the table below looks at the instructions from one position and rewrites them in
+ * place if they match. The rules are applied at every position until none applies, and each
+ * counts how often it did (--stats).
+ *
+ * Only the patterns codegen actually produces are handled, and the rules rely on how it uses
+ * the flags: they are read by the instruction right after the one that sets them and never
+ * across a label. So a rule that changes the flags (inc for add, xor for mov $0, ...) only
+ * checks the next instruction.
+ */
+
+// The registers codegen names; r_al is the low byte of %eax
+enum MachineReg { r_none, r_eax, r_ebx, r_ecx, r_edx, r_esi, r_edi, r_ebp, r_esp, r_al };
+
+inline const char* register_name(MachineReg r)
+{
+    static const char* names[] = { "", "%eax", "%ebx", "%ecx", "%edx", "%esi", "%edi", "%ebp", "%esp", "%al" };
+    return names[r];
+}
+
+// An operand of a machine instruction
+struct MachineOperand
+{
+    enum Kind { reg, imm, mem, name };
+
+    Kind m_kind;
+    MachineReg m_reg;           // reg: the register; mem: the base, or r_none
+    MachineReg m_index;         // mem: the index register, or r_none
+    int m_scale;                // mem: what the index is multiplied by
+    int m_value;                // imm: the value; mem: the displacement
+    string m_name;              // name: the label or symbol; mem: a symbol the displacement is from
+
+    MachineOperand() : m_kind(imm), m_reg(r_none), m_index(r_none), m_scale(1), m_value(0) {}
+
+    static MachineOperand make_reg(MachineReg r)
+    {
+        MachineOperand o;
+        o.m_kind = reg;
+        o.m_reg = r;
+        return o;
+    }
+
+    static MachineOperand make_imm(int value)
+    {
+        MachineOperand o;
+        o.m_kind = imm;
+        o.m_value = value;
+        return o;
+    }
+
+    // displacement(base,index,scale), or symbol+displacement(...) with a symbol
+    static MachineOperand make_mem(int displacement, MachineReg base, MachineReg index = r_none, int scale = 1,
+        const string& symbol = "")
+    {
+        MachineOperand o;
+        o.m_kind = mem;
+        o.m_value = displacement;
+        o.m_reg = base;
+        o.m_index = index;
+        o.m_scale = scale;
+        o.m_name = symbol;
+        return o;
+    }
+
+    // A label, a function, or an operand of a directive, written as it is
+    static MachineOperand make_name(const string& name)
+    {
+        MachineOperand o;
+        o.m_kind = MachineOperand::name;
+        o.m_name = name;
+        return o;
+    }
+
+    bool is_reg() const { return m_kind == reg; }
+    bool is_reg(MachineReg r) const { return m_kind == reg && m_reg == r; }
+    bool is_imm() const { return m_kind == imm; }
+    bool is_imm(int value) const { return m_kind == imm && m_value == value; }
+    bool is_mem() const { return m_kind == mem; }
+
+    bool operator == (const MachineOperand& other) const
+    {
+        if(m_kind != other.m_kind)
+            return false;
+        switch(m_kind){
+            case reg: return m_reg == other.m_reg;
+            case imm: return m_value == other.m_value;
+            case mem: return m_value == other.m_value && m_reg == other.m_reg && m_index == other.m_index &&
+                m_scale == other.m_scale && m_name == other.m_name;
+            default: return m_name == other.m_name;
+        }
+    }
+
+    bool operator != (const MachineOperand& other) const { return !(*this == other); }
+
+    string text() const
+    {
+        char buffer[32];
+        switch(m_kind){
+            case reg:
+                return register_name(m_reg);
+            case imm:
+                sprintf(buffer, "$%d", m_value);
+                return buffer;
+            case mem:
+            {
+                string out = m_name;
+                if(m_value != 0 || (m_name.empty() && m_reg == r_none && m_index == r_none)){
+                    sprintf(buffer, m_name.empty() ? "%d" : "%+d", m_value);
+                    out += buffer;
+                }
+                if(m_reg == r_none && m_index == r_none)
+                    return out;
+                out += "(";
+                out += register_name(m_reg);
+                if(m_index != r_none){
+                    sprintf(buffer, ",%s,%d", register_name(m_index), m_scale);
+                    out += buffer;
+                }
+                return out + ")";
+            }
+            default:
+                return m_name;
+        }
+    }
+};
+
+struct MachineInstr
+{
+    enum Kind { label, instr, directive };
+
+    Kind m_kind;
+    string m_op;                        // the mnemonic, the label's name, or the directive
+    vector<MachineOperand> m_args;      // operands, in AT&T order (source first)
+    bool m_indented;
+
+    MachineInstr() : m_kind(instr), m_indented(true) {}
+
+    // An instruction; add its operands to m_args
+    explicit MachineInstr(const string& op) : m_kind(instr), m_op(op), m_indented(true) {}
+
+    static MachineInstr make_label(const string& name)
+    {
+        MachineInstr m;
+        m.m_kind = label;
+        m.m_op = name;
+        m.m_indented = false;
+        return m;
+    }
+
+    static MachineInstr make_directive(const string& op, bool indented)
+    {
+        MachineInstr m;
+        m.m_kind = directive;
+        m.m_op = op;
+        m.m_indented = indented;
+        return m;
+    }
+
+    string text() const
+    {
+        if(m_kind == label)
+            return m_op + ":";
+        string out = m_indented ? "    " + m_op : m_op;
+        for(unsigned i = 0; i < m_args.size(); i++)
+            out += (i == 0 ? " " : ", ") + m_args[i].text();
+        return out;
+    }
+
+    bool is(const char* op) const
+    {
+        return m_kind == instr && m_op == op;
+    }
+
+    bool is_jump() const
+    {
+        return m_kind == instr && m_op[0] == 'j';
+    }
+
+    // The label a jump goes to
+    const string& target() const
+    {
+        return m_args[0].m_name;
+    }
+
+    // Does it read the flags?
+    bool reads_flags() const
+    {
+        if(m_kind != instr)
+            return false;
+        return (is_jump() && m_op != "jmp") || m_op.compare(0, 3, "set") == 0 ||
+            m_op.compare(0, 4, "cmov") == 0 || m_op.compare(0, 3, "sbb") == 0 || m_op.compare(0, 3, "adc") == 0;
+    }
+};
+
+typedef vector<MachineInstr> MachineCode;
+
+class Peephole
+{
+    private:
+        typedef bool (*Rule)(MachineCode& code, unsigned i);
+
+        struct Pattern
+        {
+            const char* m_name;
+            Rule m_rule;
+        };
+
+        static const Pattern* patterns()
+        {
+            static const Pattern table[] = {
+                { "self-move",          self_move },
+                { "push-pop",           push_pop },
+                { "store-load",         store_load },
+                { "jump-to-next",       jump_to_next },
+                { "jump-to-jump",       jump_to_jump },
+                { "unreachable",        unreachable },
+                { "unused-label",       unused_label },
+                { "cmp-zero",           cmp_zero },
+                { "mov-zero",           mov_zero },
+                { "inc-dec",            inc_dec },
+                { "mul-shift",          mul_shift },
+                { NULL,                 NULL }
+            };
+            return table;
+        }
+
+        map<string, int> m_hits;
+
+        // ********** The rules ********************************
+        // Each gets the code and a position, and returns whether it rewrote the code there.
+
+        // The entry after i, or NULL
+        static const MachineInstr* next(MachineCode& code, unsigned i)
+        {
+            return i + 1 < code.size() ? &code[i + 1] : NULL;
+        }
+
+        static bool flags_dead_after(MachineCode& code, unsigned i)
+        {
+            const MachineInstr* n = next(code, i);
+            return n != NULL && n->m_kind == MachineInstr::instr && !n->reads_flags();
+        }
+
+        // movl %r, %r
+        static bool self_move(MachineCode& code, unsigned i)
+        {
+            MachineInstr& m = code[i];
+            if(!m.is("movl") && !m.is("mov"))
+                return false;
+            if(m.m_args[0] != m.m_args[1] || !m.m_args[0].is_reg())
+                return false;
+            code.erase(code.begin() + i);
+            return true;
+        }
+
+        // pushl x; popl y  =>  movl x, y (unless both are in memory)
+        static bool push_pop(MachineCode& code, unsigned i)
+        {
+            const MachineInstr* n = next(code, i);
+            if(!(code[i].is("pushl") || code[i].is("push")) || n == NULL || !(n->is("popl") || n->is("pop")))
+                return false;
+            MachineOperand from = code[i].m_args[0], to = n->m_args[0];
+            if(from.is_mem() && to.is_mem())
+                return false;
+            code.erase(code.begin() + i + 1);
+            if(from == to){
+                code.erase(code.begin() + i);
+            } else {
+                code[i].m_op = "movl";
+                code[i].m_args.push_back(to);
+            }
+            return true;
+        }
+
+        // movl %r, x; movl x, %s  =>  movl %r, x; movl %r, %s (and no second move if s is r)
+        static bool store_load(MachineCode& code, unsigned i)
+        {
+            const MachineInstr* n = next(code, i);
+            if(!code[i].is("movl") || n == NULL || !n->is("movl"))
+                return false;
+            const MachineOperand& r = code[i].m_args[0];
+            const MachineOperand& x = code[i].m_args[1];
+            if(!r.is_reg() || n->m_args[0] != x || !n->m_args[1].is_reg())
+                return false;
+            if(n->m_args[1] == r)
+                code.erase(code.begin() + i + 1);
+            else if(!x.is_reg())
+                code[i + 1].m_args[0] = r;
+            else
+                return false;
+            return true;
+        }
+
+        // jmp L (or a conditional jump) just before L:
+        static bool jump_to_next(MachineCode& code, unsigned i)
+        {
+            if(!code[i].is_jump())
+                return false;
+            for(unsigned j = i + 1; j < code.size() && code[j].m_kind == MachineInstr::label; j++){
+                if(code[j].m_op == code[i].target()){
+                    code.erase(code.begin() + i);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // a jump to L where L: jmp M  =>  a jump to M
+        static bool jump_to_jump(MachineCode& code, unsigned i)
+        {
+            if(!code[i].is_jump())
+                return false;
+            const string& target = code[i].target();
+            for(unsigned j = 0; j < code.size(); j++){
+                if(code[j].m_kind != MachineInstr::label || code[j].m_op != target)
+                    continue;
+                unsigned k = j + 1;
+                while(k < code.size() && code[k].m_kind == MachineInstr::label)
+                    k++;
+                if(k == code.size() || !code[k].is("jmp") || code[k].target() == target)
+                    return false;
+                code[i].m_args[0] = code[k].m_args[0];
+                return true;
+            }
+            return false;
+        }
+
+        // instructions after a jmp or ret, up to the next label, never run
+        static bool unreachable(MachineCode& code, unsigned i)
+        {
+            if(!code[i].is("jmp") && !code[i].is("ret"))
+                return false;
+            const MachineInstr* n = next(code, i);
+            if(n == NULL || n->m_kind != MachineInstr::instr)
+                return false;
+            code.erase(code.begin() + i + 1);
+            return true;
+        }
+
+        // a block label (B<n>) nothing jumps to
+        static bool unused_label(MachineCode& code, unsigned i)
+        {
+            const string& name = code[i].m_op;
+            if(code[i].m_kind != MachineInstr::label || name.size() < 2 || name[0] != 'B' ||
+               name.find_first_not_of("0123456789", 1) != string::npos)
+                return false;
+            for(unsigned j = 0; j < code.size(); j++)
+                if(code[j].is_jump() && code[j].target() == name)
+                    return false;
+            code.erase(code.begin() + i);
+            return true;
+        }
+
+        // cmpl $0, %r  =>  testl %r, %r (the same flags)
+        static bool cmp_zero(MachineCode& code, unsigned i)
+        {
+            MachineInstr& m = code[i];
+            if(!m.is("cmpl") || !m.m_args[0].is_imm(0) || !m.m_args[1].is_reg())
+                return false;
+            m.m_op = "testl";
+            m.m_args[0] = m.m_args[1];
+            return true;
+        }
+
+        // movl $0, %r  =>  xorl %r, %r
+        static bool mov_zero(MachineCode& code, unsigned i)
+        {
+            MachineInstr& m = code[i];
+            if(!m.is("movl") || !m.m_args[0].is_imm(0) || !m.m_args[1].is_reg() || !flags_dead_after(code, i))
+                return false;
+            m.m_op = "xorl";
+            m.m_args[0] = m.m_args[1];
+            return true;
+        }
+
+        // addl $1, x  =>  incl x, and the same for decl
+        static bool inc_dec(MachineCode& code, unsigned i)
+        {
+            MachineInstr& m = code[i];
+            if(!(m.is("addl") || m.is("subl")) || !flags_dead_after(code, i))
+                return false;
+            if(!m.m_args[0].is_imm(1) && !m.m_args[0].is_imm(-1))
+                return false;
+            bool up = (m.m_op == "addl") == m.m_args[0].is_imm(1);
+            m.m_op = up ? "incl" : "decl";
+            m.m_args.erase(m.m_args.begin());
+            return true;
+        }
+
+        // imull $2^k, %r  =>  shll $k, %r
+        static bool mul_shift(MachineCode& code, unsigned i)
+        {
+            MachineInstr& m = code[i];
+            if(!m.is("imull") || m.m_args.size() != 2 || !m.m_args[0].is_imm() || !flags_dead_after(code, i))
+                return false;
+            long factor = m.m_args[0].m_value;
+            if(factor < 2 || (factor & (factor - 1)) != 0)
+                return false;
+            int shift = 0;
+            while((1L << shift) != factor)
+                shift++;
+            m.m_op = "shll";
+            m.m_args[0] = MachineOperand::make_imm(shift);
+            return true;
+        }
+
+    public:
+        // Rewrite code until no rule applies
+        void run(MachineCode& code)
+        {
+            const Pattern* table = patterns();
+            bool changed = true;
+            while(changed){
+                changed = false;
+                for(unsigned i = 0; i < code.size(); i++){
+                    for(int p = 0; table[p].m_name != NULL && i < code.size(); p++){
+                        if(table[p].m_rule(code, i)){
+                            m_hits[table[p].m_name]++;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        void print_stats(FILE* out)
+        {
+            const Pattern* table = patterns();
+            int total = 0;
+            for(int p = 0; table[p].m_name != NULL; p++)
+                total += m_hits[table[p].m_name];
+            fprintf(out, "peephole: %d rewrites:", total);
+            for(int p = 0; table[p].m_name != NULL; p++)
+                fprintf(out, " %s %d%s", table[p].m_name, m_hits[table[p].m_name], table[p + 1].m_name != NULL ? "," : "\n");
+        }
+};
+
+#endif //PEEPHOLE_HPP
@@ -0,0 +1,280 @@
+#ifndef REGALLOC_HPP
+#define REGALLOC_HPP
+
+#include "ir.h"
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Linear scan register allocation (Poletto and Sarkar) over the IR of a function, for codegen.
+ * The values it places are the temporaries and the int and bool variables, parameters included;
+ * arrays stay in the frame, and so does anything this leaves out. Nothing in the language takes
+ * the address of a scalar, so any of them may live in a register.
+ *
+ * Instructions are numbered in layout order, instruction i reading its operands at position 2i
+ * and writing its result at 2i + 1, and liveness over the CFG gives each value one interval from
+ * the first to the last position it may be live at. So x = add y, 1 may put x in y's register if
+ * that was y's last use. Walking the intervals by start, each takes a free register, and when
+ * there is none the interval that ends last (this one or an active one) is spilled to its frame
+ * slot.
+ *
+ * The registers are %ebx, %esi and %edi, which the prologue saves anyway, and %ecx and %edx, which
+ * the callee may clobber: an interval live across a call only gets one of the first three. Codegen
+ * also does division and magnitude in %ecx and %edx, so an interval live into one of those doesn't
+ * get them either. %eax is left to codegen as its scratch register.
+ */
+
+class RegisterAllocator {
+    public:
+        enum { EBX, ESI, EDI, ECX, EDX, num_registers };
+
+    private:
+        struct Interval
+        {
+            int m_value;            // the value's number (see value())
+            int m_start, m_end;     // first and last positions it may be live at
+            bool m_across_call;     // live across a call: no %ecx or %edx
+            bool m_across_div;      // live into a division or magnitude: no %ecx or %edx
+
+            bool operator < (const Interval& other) const
+            {
+                return m_start < other.m_start || (m_start == other.m_start && m_value < other.m_value);
+            }
+        };
+
+        IRFunction* m_func;
+        map<Symbol*, int> m_vars;       // numbers of the variables, after the temporaries
+        vector<int> m_register;         // by value number, -1 if it is in the frame
+        vector<int> m_slot;             // by temporary, its frame slot if it has no register
+        int m_slots;
+
+        // statistics
+        int m_values;
+        int m_in_registers;
+
+        // Values are numbered temporaries first, then variables; -1 if o isn't one to allocate
+        int value(const IROperand& o)
+        {
+            if(o.is_temp())
+                return o.m_value;
+            if(!o.is_var() || (o.m_symbol->m_basetype != bt_integer && o.m_symbol->m_basetype != bt_boolean))
+                return -1;
+            map<Symbol*, int>::iterator iter = m_vars.find(o.m_symbol);
+            if(iter != m_vars.end())
+                return iter->second;
+            int n = m_func->m_temps + m_vars.size();
+            m_vars[o.m_symbol] = n;
+            return n;
+        }
+
+        // Which values are live into each block
+        void liveness(vector< set<int> >& live_in, vector< set<int> >& live_out, map<IRBlock*, int>& index)
+        {
+            vector<IRBlock*>& blocks = m_func->m_blocks;
+            vector< set<int> > use(blocks.size()), def(blocks.size());
+            for(unsigned b = 0; b < blocks.size(); b++){
+                for(unsigned i = 0; i < blocks[b]->m_instrs.size(); i++){
+                    IRInstr* in = blocks[b]->m_instrs[i];
+                    vector<const IROperand*> used;
+                    in->uses(used);
+                    for(unsigned j = 0; j < used.size(); j++){
+                        int v = value(*used[j]);
+                        if(v >= 0 && !def[b].count(v)) use[b].insert(v);
+                    }
+                    if(in->has_dst() && value(in->m_dst) >= 0)
+                        def[b].insert(value(in->m_dst));
+                }
+            }
+            live_in.assign(blocks.size(), set<int>());
+            live_out.assign(blocks.size(), set<int>());
+            bool changed = true;
+            while(changed){
+                changed = false;
+                for(int b = (int) blocks.size() - 1; b >= 0; b--){
+                    set<int> out;
+                    for(unsigned s = 0; s < blocks[b]->m_succs.size(); s++){
+                        set<int>& in = live_in[index[blocks[b]->m_succs[s]]];
+                        out.insert(in.begin(), in.end());
+                    }
+                    set<int> in = use[b];
+                    set<int>::iterator iter;
+                    for(iter = out.begin(); iter != out.end(); iter++)
+                        if(!def[b].count(*iter)) in.insert(*iter);
+                    if(in != live_in[b] || out != live_out[b]){
+                        live_in[b].swap(in);
+                        live_out[b].swap(out);
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        void build_intervals(vector<Interval>& intervals)
+        {
+            vector<IRBlock*>& blocks = m_func->m_blocks;
+            map<IRBlock*, int> index;
+            for(unsigned b = 0; b < blocks.size(); b++)
+                index[blocks[b]] = b;
+            vector< set<int> > live_in, live_out;
+            liveness(live_in, live_out, index);
+
+            map<int, Interval> found;
+            vector<int> calls, divs;
+            int position = 0;
+            for(unsigned b = 0; b < blocks.size(); b++){
+                int first = position;
+                for(unsigned i = 0; i < blocks[b]->m_instrs.size(); i++, position += 2){
+                    IRInstr* in = blocks[b]->m_instrs[i];
+                    vector<const IROperand*> used;
+                    in->uses(used);
+                    for(unsigned j = 0; j < used.size(); j++)
+                        extend(found, value(*used[j]), position);
+                    if(in->has_dst())
+                        extend(found, value(in->m_dst), position + 1);
+                    if(in->m_op == ir_call) calls.push_back(position);
+                    if(in->m_op == ir_div || in->m_op == ir_abs) divs.push_back(position);
+                }
+                set<int>::iterator iter;
+                for(iter = live_in[b].begin(); iter != live_in[b].end(); iter++)
+                    extend(found, *iter, first);
+                for(iter = live_out[b].begin(); iter != live_out[b].end(); iter++)
+                    extend(found, *iter, position - 1);     // the terminator's result position
+            }
+            // the parameters arrive in the frame, and are loaded before the first instruction
+            for(unsigned i = 0; i < m_func->m_params.size(); i++)
+                extend(found, value(m_func->m_params[i]), 0);
+
+            map<int, Interval>::iterator iter;
+            for(iter = found.begin(); iter != found.end(); iter++){
+                Interval& r = iter->second;
+                r.m_across_call = r.m_across_div = false;
+                // the result of the call or division itself may go anywhere
+                for(unsigned i = 0; i < calls.size(); i++)
+                    if(r.m_start <= calls[i] && calls[i] < r.m_end) r.m_across_call = true;
+                for(unsigned i = 0; i < divs.size(); i++)
+                    if(r.m_start <= divs[i] && divs[i] <= r.m_end) r.m_across_div = true;
+                intervals.push_back(r);
+            }
+            sort(intervals.begin(), intervals.end());
+        }
+
+        static void extend(map<int, Interval>& found, int v, int position)
+        {
+            if(v < 0)
+                return;
+            map<int, Interval>::iterator iter = found.find(v);
+            if(iter == found.end()){
+                Interval r;
+                r.m_value = v;
+                r.m_start = r.m_end = position;
+                found[v] = r;
+            } else {
+                iter->second.m_start = min(iter->second.m_start, position);
+                iter->second.m_end = max(iter->second.m_end, position);
+            }
+        }
+
+        static bool allowed(const Interval& r, int reg)
+        {
+            return !((r.m_across_call || r.m_across_div) && (reg == ECX || reg == EDX));
+        }
+
+        void linear_scan(vector<Interval>& intervals)
+        {
+            vector<Interval*> active;           // by increasing end
+            bool free[num_registers];
+            for(int reg = 0; reg < num_registers; reg++)
+                free[reg] = true;
+            for(unsigned i = 0; i < intervals.size(); i++){
+                Interval* r = &intervals[i];
+
+                // expire the intervals that ended
+                while(!active.empty() && active.front()->m_end < r->m_start){
+                    free[m_register[active.front()->m_value]] = true;
+                    active.erase(active.begin());
+                }
+
+                int reg = -1;
+                for(int j = 0; j < num_registers && reg < 0; j++)
+                    if(free[j] && allowed(*r, j)) reg = j;
+                if(reg < 0){
+                    // spill whichever ends last, of r and the active intervals whose register r may take
+                    Interval* spill = r;
+                    for(unsigned j = 0; j < active.size(); j++)
+                        if(active[j]->m_end > spill->m_end && allowed(*r, m_register[active[j]->m_value]))
+                            spill = active[j];
+                    if(spill == r)
+                        continue;
+                    reg = m_register[spill->m_value];
+                    m_register[spill->m_value] = -1;
+                    active.erase(find(active.begin(), active.end(), spill));
+                }
+                m_register[r->m_value] = reg;
+                free[reg] = false;
+                unsigned j = 0;
+                while(j < active.size() && active[j]->m_end <= r->m_end)
+                    j++;
+                active.insert(active.begin() + j, r);
+            }
+        }
+
+    public:
+        RegisterAllocator()
+        {
+            m_func = NULL;
+            m_slots = 0;
+            m_values = m_in_registers = 0;
+        }
+
+        void allocate(IRFunction* f)
+        {
+            m_func = f;
+            m_vars.clear();
+            vector<Interval> intervals;
+            build_intervals(intervals);
+            m_register.assign(f->m_temps + m_vars.size(), -1);
+            linear_scan(intervals);
+
+            // temporaries without a register get a slot below the variables
+            m_slot.assign(f->m_temps, -1);
+            m_slots = 0;
+            for(int t = 0; t < f->m_temps; t++)
+                if(m_register[t] < 0) m_slot[t] = m_slots++;
+
+            m_values += intervals.size();
+            for(unsigned i = 0; i < intervals.size(); i++)
+                if(m_register[intervals[i].m_value] >= 0) m_in_registers++;
+        }
+
+        // The register of o (one of the enum) in the function allocated last, or -1 if it is in
+        // the frame
+        int reg(const IROperand& o)
+        {
+            int v = value(o);
+            return v >= 0 && v < (int) m_register.size() ? m_register[v] : -1;
+        }
+
+        // The frame slot of a temporary without a register, counting from 0 below the variables
+        int slot(const IROperand& o)
+        {
+            return m_slot[o.m_value];
+        }
+
+        // How many slots the temporaries without a register need
+        int slots()
+        {
+            return m_slots;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "regalloc: %d of %d values kept in registers\n", m_in_registers, m_values);
+        }
+};
+
+#endif //REGALLOC_HPP
@@ -0,0 +1,185 @@
+#ifndef REMARKS_HPP
+#define REMARKS_HPP
+
+#include "ast.h"
+#include "astutil.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Optimization remarks (--remarks=FILE): what the passes did, and what they didn't and why, as
+ * one JSON object a line so scripts can filter and count them:
+ *   {"pass":"folding","kind":"missed","line":12,"function":"Main",
+ *    "message":"x + 1 not folded: x killed by call to f at line 9"}
+ * kind is "passed" for a change that was made and "missed" for one that wasn't, and line is
+ * Attribute::lineno of the node it is about. For a statement that spans lines the parser stamps
+ * the line it ends on, so an If or While is reported at its closing brace.
+ *
+ * Remarks are written as the passes make their decisions, in tree order within a pass. A remark
+ * that was already written isn't repeated. Between hold() and flush() they are kept back instead:
+ * folding runs again after inlining, and only what the last run decided is true of the output.
+ */
+
+class Remarks
+{
+    private:
+        FILE* m_out;
+        set<string> m_seen;
+        bool m_holding;
+        vector<string> m_held;
+
+        static void append_json(string& out, const char* s)
+        {
+            for(; *s; s++){
+                if(*s == '"' || *s == '\\'){
+                    out += '\\';
+                    out += *s;
+                } else if((unsigned char) *s < 0x20){
+                    char buffer[8];
+                    sprintf(buffer, "\\u%04x", *s);
+                    out += buffer;
+                } else {
+                    out += *s;
+                }
+            }
+        }
+
+        void emit(const char* pass, const char* kind, int line, const char* func,
+            const char* format, va_list args)
+        {
+            char message[512];
+            vsnprintf(message, sizeof(message), format, args);
+            string out = "{\"pass\":\"";
+            append_json(out, pass);
+            out += "\",\"kind\":\"";
+            out += kind;
+            char number[32];
+            sprintf(number, "\",\"line\":%d,\"function\":\"", line);
+            out += number;
+            append_json(out, func);
+            out += "\",\"message\":\"";
+            append_json(out, message);
+            out += "\"}\n";
+            if(m_holding)
+                m_held.push_back(out);
+            else if(m_seen.insert(out).second)
+                fputs(out.c_str(), m_out);
+        }
+
+    public:
+        Remarks(FILE* out)
+        {
+            m_out = out;
+            m_holding = false;
+        }
+
+        // Keep remarks back from here on, dropping any still held from an earlier hold()
+        void hold()
+        {
+            m_holding = true;
+            m_held.clear();
+        }
+
+        // Write the held remarks and go back to writing them as they come
+        void flush()
+        {
+            m_holding = false;
+            for(unsigned int i = 0; i < m_held.size(); i++){
+                if(m_seen.insert(m_held[i]).second)
+                    fputs(m_held[i].c_str(), m_out);
+            }
+            m_held.clear();
+        }
+
+        // A change pass made on line (Attribute::lineno), in function func. This takes the line
+        // rather than the node since Func, the blocks, Param, Decl and Return each declare their
+        // own m_attribute, hiding the one a Visitable* would see.
+        void passed(const char* pass, int line, const char* func, const char* format, ...)
+        {
+            va_list args;
+            va_start(args, format);
+            emit(pass, "passed", line, func, format, args);
+            va_end(args);
+        }
+
+        // A change pass couldn't make on line, and why
+        void missed(const char* pass, int line, const char* func, const char* format, ...)
+        {
+            va_list args;
+            va_start(args, format);
+            emit(pass, "missed", line, func, format, args);
+            va_end(args);
+        }
+
+        // e as it would be written in the source, abbreviated past max_length characters
+        static string text(Expr* e, unsigned max_length = 40)
+        {
+            string out;
+            write(e, out);
+            if(out.size() > max_length)
+                out = out.substr(0, max_length - 3) + "...";
+            return out;
+        }
+
+    private:
+        static void write(Expr* e, string& out)
+        {
+            char buffer[16];
+            int value;
+            if(is_literal(e, &value)){
+                if(e->m_attribute.m_basetype == bt_boolean)
+                    out += value ? "true" : "false";
+                else {
+                    sprintf(buffer, "%d", value);
+                    out += buffer;
+                }
+                return;
+            }
+            if(Ident* id = dynamic_cast<Ident*>(e)){
+                out += id->m_symname->spelling();
+                return;
+            }
+            if(ArrayAccess* a = dynamic_cast<ArrayAccess*>(e)){
+                out += a->m_symname->spelling();
+                out += "[";
+                write(a->m_expr, out);
+                out += "]";
+                return;
+            }
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            if(n == 2){
+                const char* op = op_spelling(binary_op(e));
+                write_operand(*ops[0], out);
+                out += " ";
+                out += op;
+                out += " ";
+                write_operand(*ops[1], out);
+            } else if(dynamic_cast<Magnitude*>(e)){
+                out += "|";
+                write(*ops[0], out);
+                out += "|";
+            } else {
+                out += dynamic_cast<Not*>(e) ? "!" : "-";
+                write_operand(*ops[0], out);
+            }
+        }
+
+        // Parenthesize compound operands rather than work out precedence
+        static void write_operand(Expr* e, string& out)
+        {
+            Expr** ops[2];
+            bool compound = expr_operands(e, ops) > 0 && !dynamic_cast<ArrayAccess*>(e) &&
+                !dynamic_cast<Magnitude*>(e);
+            if(compound) out += "(";
+            write(e, out);
+            if(compound) out += ")";
+        }
+};
+
+#endif //REMARKS_HPP
@@ -0,0 +1,499 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "astutil.h"
+#include <stdio.h>
+#include <vector>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Algebraic simplification. Runs after constant folding, which only fires when a whole subtree is
+ * constant; this pass handles the identities that hold whatever the variables are, such as x+0, x*1,
+ * x-x, !!b and -(-x), and moves constants together so (x+1)+2 becomes x+3.
+ *
+ * Every expression is simplified bottom-up: first its operands, then the rules below are tried on it
+ * in order until none of them applies. A rule either returns the expression that replaces the one it
+ * was given (taking the parts it reuses out of the old one, which is then deleted) or NULL. All rules
+ * make the expression smaller or move it towards the canonical form (constants on the right, no
+ * subtraction of constants, one constant per chain), so this always terminates.
+ *
+ * Expressions have no side effects and arithmetic wraps around, so all of these are exact. Division
+ * is the exception: we never fold or drop a division whose divisor could be 0 or whose result could
+ * overflow, since the generated code traps on those. So x * 0 and x - x are only rewritten when x
+ * can't trap (see may_trap, which also covers checked array accesses).
+ *
+ * With --stats, the number of rewrites each rule made is printed to stderr.
+ */
+
+class Simplifier : public Visitor {
+    private:
+        typedef Expr* (Simplifier::*RuleFn)(Expr*);
+
+        struct Rule
+        {
+            const char* m_name;
+            RuleFn m_apply;
+            int m_count;
+        };
+
+        SymTab* m_st;
+        bool m_bounds_check;    // array indexes are checked (--bounds-check), so accesses may trap
+        vector<Rule> m_rules;
+        static const int max_rewrites_per_node = 64;
+
+        void add_rule(const char* name, RuleFn apply)
+        {
+            Rule r;
+            r.m_name = name;
+            r.m_apply = apply;
+            r.m_count = 0;
+            m_rules.push_back(r);
+        }
+
+        Expr* simplify(Expr* e)
+        {
+            visit(e);   // operands first
+            Attribute* parent = e->m_parent_attribute;
+            for(int rewrites = 0; rewrites < max_rewrites_per_node; rewrites++){
+                Expr* result = NULL;
+                unsigned int i;
+                for(i = 0; i < m_rules.size() && result == NULL; i++)
+                    result = (this->*m_rules[i].m_apply)(e);
+                if(result == NULL)
+                    break;
+                m_rules[i-1].m_count++;
+                e = result;
+                e->m_parent_attribute = parent;
+            }
+            return e;
+        }
+
+        // Take operand i out of e, so that deleting e leaves it alone
+        static Expr* detach(Expr* e, int i)
+        {
+            Expr** ops[2];
+            expr_operands(e, ops);
+            Expr* operand = *ops[i];
+            *ops[i] = NULL;
+            return operand;
+        }
+
+        // Replace e by its operand i
+        static Expr* keep_operand(Expr* e, int i)
+        {
+            Expr* operand = detach(e, i);
+            delete e;
+            return operand;
+        }
+
+        // Replace e by a literal
+        static Expr* replace_by_literal(Expr* e, Basetype type, int value)
+        {
+            Expr* literal = make_literal(type, value, e);
+            delete e;
+            return literal;
+        }
+
+        static bool is_literal_value(Expr* e, int value)
+        {
+            int v;
+            return is_literal(e, &v) && v == value;
+        }
+
+        static bool is_commutative(BinaryOp op)
+        {
+            return op == op_plus || op == op_times || op == op_and || op == op_or || op == op_eq || op == op_ne;
+        }
+
+        // Evaluate "a op b" the way the generated code does. Returns false for a division that traps.
+        static bool evaluate(BinaryOp op, int a, int b, int* result)
+        {
+            unsigned int ua = a, ub = b;
+            switch(op){
+                case op_plus: *result = (int) (ua + ub); return true;
+                case op_minus: *result = (int) (ua - ub); return true;
+                case op_times: *result = (int) (ua * ub); return true;
+                case op_div:
+                    if(b == 0 || (a == (int) 0x80000000 && b == -1)) return false;
+                    *result = a / b; return true;
+                case op_and: *result = a && b; return true;
+                case op_or: *result = a || b; return true;
+                case op_eq: *result = a == b; return true;
+                case op_ne: *result = a != b; return true;
+                case op_lt: *result = a < b; return true;
+                case op_le: *result = a <= b; return true;
+                case op_gt: *result = a > b; return true;
+                case op_ge: *result = a >= b; return true;
+                default: return false;
+            }
+        }
+
+        // ********** Rules ********************************
+
+        // c1 op c2, !c, -c and |c|
+        Expr* rule_fold_constants(Expr* e)
+        {
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            int a, b, result;
+            if(n == 2){
+                if(!is_literal(*ops[0], &a) || !is_literal(*ops[1], &b)) return NULL;
+                if(!evaluate(binary_op(e), a, b, &result)) return NULL;
+            } else if(n == 1 && is_literal(*ops[0], &a)){
+                if(dynamic_cast<Not*>(e)) result = !a;
+                else if(dynamic_cast<Uminus*>(e)) result = (int) (0u - (unsigned int) a);
+                else if(dynamic_cast<Magnitude*>(e)) result = a < 0 ? (int) (0u - (unsigned int) a) : a;
+                else return NULL;
+            } else {
+                return NULL;
+            }
+            return replace_by_literal(e, e->m_attribute.m_basetype, result);
+        }
+
+        // c op x => x op' c, so that Codegen can use c as an immediate and the other rules
+        // only have to look for constants on the right
+        Expr* rule_constant_to_right(Expr* e)
+        {
+            BinaryOp op = binary_op(e);
+            if(op == op_none || op == op_minus || op == op_div) return NULL;
+            Expr** ops[2];
+            expr_operands(e, ops);
+            if(!is_literal(*ops[0]) || is_literal(*ops[1])) return NULL;
+            if(is_commutative(op)){
+                swap(*ops[0], *ops[1]);
+                return e;
+            }
+            Expr* c = detach(e, 0);
+            Expr* x = detach(e, 1);
+            Expr* result = make_binary(mirror_op(op), x, c, e);
+            delete e;
+            return result;
+        }
+
+        // x - c => x + (-c), so constants only have to be combined across additions
+        Expr* rule_subtract_constant(Expr* e)
+        {
+            Minus* m = dynamic_cast<Minus*>(e);
+            int c;
+            if(m == NULL || !is_literal(m->m_expr_2, &c)) return NULL;
+            Expr* x = detach(e, 0);
+            Expr* result = make_binary(op_plus, x, make_literal(bt_integer, (int) (0u - (unsigned int) c), e), e);
+            delete e;
+            return result;
+        }
+
+        // 0 - x => -x
+        Expr* rule_subtract_from_zero(Expr* e)
+        {
+            Minus* m = dynamic_cast<Minus*>(e);
+            if(m == NULL || !is_literal_value(m->m_expr_1, 0)) return NULL;
+            Expr* result = new Uminus(detach(e, 1));
+            copy_attribute(result, e);
+            result->m_attribute.m_basetype = bt_integer;
+            delete e;
+            return result;
+        }
+
+        // x + 0, x * 1, x / 1, x && true, x || false => x
+        Expr* rule_identity(Expr* e)
+        {
+            BinaryOp op = binary_op(e);
+            Expr** ops[2];
+            if(op == op_none) return NULL;
+            expr_operands(e, ops);
+            if((op == op_plus && is_literal_value(*ops[1], 0)) ||
+               ((op == op_times || op == op_div) && is_literal_value(*ops[1], 1)) ||
+               (op == op_and && is_literal_value(*ops[1], 1)) ||
+               (op == op_or && is_literal_value(*ops[1], 0)))
+                return keep_operand(e, 0);
+            return NULL;
+        }
+
+        // x * 0 => 0, x && false => false, x || true => true
+        Expr* rule_annihilate(Expr* e)
+        {
+            BinaryOp op = binary_op(e);
+            Expr** ops[2];
+            if(op == op_none) return NULL;
+            expr_operands(e, ops);
+            if(may_trap(*ops[0], m_st, m_bounds_check)) return NULL;
+            if((op == op_times && is_literal_value(*ops[1], 0)) ||
+               (op == op_and && is_literal_value(*ops[1], 0)) ||
+               (op == op_or && is_literal_value(*ops[1], 1))){
+                int value;
+                is_literal(*ops[1], &value);
+                return replace_by_literal(e, e->m_attribute.m_basetype, value);
+            }
+            return NULL;
+        }
+
+        // x * -1 => -x
+        Expr* rule_times_minus_one(Expr* e)
+        {
+            Times* t = dynamic_cast<Times*>(e);
+            if(t == NULL || !is_literal_value(t->m_expr_2, -1)) return NULL;
+            Expr* result = new Uminus(detach(e, 0));
+            copy_attribute(result, e);
+            result->m_attribute.m_basetype = bt_integer;
+            delete e;
+            return result;
+        }
+
+        // x - x => 0, x == x => true, x < x => false, x && x => x, ...
+        Expr* rule_same_operands(Expr* e)
+        {
+            BinaryOp op = binary_op(e);
+            Expr** ops[2];
+            if(op == op_none || op == op_plus || op == op_times || op == op_div) return NULL;
+            expr_operands(e, ops);
+            if(!expr_equal(*ops[0], *ops[1])) return NULL;
+            if(op == op_and || op == op_or) return keep_operand(e, 0);
+            if(may_trap(*ops[0], m_st, m_bounds_check)) return NULL;
+            switch(op){
+                case op_minus: return replace_by_literal(e, bt_integer, 0);
+                case op_eq:
+                case op_le:
+                case op_ge: return replace_by_literal(e, bt_boolean, 1);
+                default: return replace_by_literal(e, bt_boolean, 0);
+            }
+        }
+
+        // !!b => b, -(-x) => x, |(|x|)| => |x|, |-x| => |x|
+        Expr* rule_double_negation(Expr* e)
+        {
+            Expr** ops[2];
+            Expr** inner_ops[2];
+            if(expr_operands(e, ops) != 1 || dynamic_cast<ArrayAccess*>(e)) return NULL;
+            Expr* inner = *ops[0];
+            if(typeid(*inner) == typeid(*e)){
+                if(dynamic_cast<Magnitude*>(e))
+                    return keep_operand(e, 0);
+                expr_operands(inner, inner_ops);
+                Expr* x = *inner_ops[0];
+                *inner_ops[0] = NULL;
+                delete e;
+                return x;
+            }
+            if(dynamic_cast<Magnitude*>(e) && dynamic_cast<Uminus*>(inner)){
+                expr_operands(inner, inner_ops);
+                Expr* x = *inner_ops[0];
+                *inner_ops[0] = NULL;
+                *ops[0] = x;
+                x->m_parent_attribute = &e->m_attribute;
+                delete inner;
+                return e;
+            }
+            return NULL;
+        }
+
+        // !(a < b) => a >= b, !(a == b) => a != b, ...
+        Expr* rule_not_of_comparison(Expr* e)
+        {
+            Not* n = dynamic_cast<Not*>(e);
+            if(n == NULL) return NULL;
+            BinaryOp op = negate_op(binary_op(n->m_expr));
+            if(op == op_none) return NULL;
+            Expr* inner = detach(e, 0);
+            Expr* result = make_binary(op, detach(inner, 0), detach(inner, 1), e);
+            delete inner;
+            delete e;
+            return result;
+        }
+
+        // b == true, b != false => b; b == false, b != true => !b
+        Expr* rule_compare_with_bool(Expr* e)
+        {
+            BinaryOp op = binary_op(e);
+            if(op != op_eq && op != op_ne) return NULL;
+            Expr** ops[2];
+            expr_operands(e, ops);
+            int c;
+            if(!dynamic_cast<BoolLit*>(*ops[1]) || !is_literal(*ops[1], &c)) return NULL;
+            if((op == op_eq) == (c != 0))
+                return keep_operand(e, 0);
+            Expr* result = new Not(detach(e, 0));
+            copy_attribute(result, e);
+            result->m_attribute.m_basetype = bt_boolean;
+            delete e;
+            return result;
+        }
+
+        // Flatten a chain of op (+ or *) into its operands, taking them out of the chain and
+        // combining the constants into *constant. Returns how many constants were found.
+        int flatten_chain(Expr* e, BinaryOp op, vector<Expr*>& terms, unsigned int* constant)
+        {
+            int constants = 0;
+            Expr** ops[2];
+            expr_operands(e, ops);
+            for(int i = 0; i < 2; i++){
+                Expr* operand = *ops[i];
+                int value;
+                if(binary_op(operand) == op){
+                    constants += flatten_chain(operand, op, terms, constant);
+                } else if(is_literal(operand, &value)){
+                    *constant = op == op_plus ? *constant + (unsigned int) value : *constant * (unsigned int) value;
+                    constants++;
+                } else {
+                    terms.push_back(operand);
+                    *ops[i] = NULL;
+                }
+            }
+            return constants;
+        }
+
+        // Is e (a chain of op) already in the form ((x op y) op ...) op c with no other constants?
+        bool is_canonical_chain(Expr* e, BinaryOp op)
+        {
+            Expr** ops[2];
+            expr_operands(e, ops);
+            if(binary_op(*ops[1]) == op) return false;
+            Expr* left = *ops[0];
+            while(binary_op(left) == op){
+                Expr** left_ops[2];
+                expr_operands(left, left_ops);
+                if(is_literal(*left_ops[1]) || binary_op(*left_ops[1]) == op) return false;
+                left = *left_ops[0];
+            }
+            return !is_literal(left);
+        }
+
+        // (x + 1) + 2 => x + 3, (x + 1) + (y + 2) => (x + y) + 3, and the same for *
+        Expr* rule_reassociate(Expr* e)
+        {
+            BinaryOp op = binary_op(e);
+            if(op != op_plus && op != op_times) return NULL;
+            if(is_canonical_chain(e, op)) return NULL;
+            vector<Expr*> terms;
+            unsigned int constant = op == op_plus ? 0 : 1;     // the identity of op
+            flatten_chain(e, op, terms, &constant);
+            Expr* result = NULL;
+            for(unsigned int i = 0; i < terms.size(); i++)
+                result = result == NULL ? terms[i] : make_binary(op, result, terms[i], e);
+            unsigned int identity = op == op_plus ? 0 : 1;
+            if(result == NULL)
+                result = make_literal(bt_integer, (int) constant, e);
+            else if(constant != identity)
+                result = make_binary(op, result, make_literal(bt_integer, (int) constant, e), e);
+            delete e;
+            return result;
+        }
+
+        // ************************************************************
+
+    public:
+        Simplifier(SymTab* st, bool bounds_check)
+        {
+            m_st = st;
+            m_bounds_check = bounds_check;
+            add_rule("fold-constants", &Simplifier::rule_fold_constants);
+            add_rule("constant-to-right", &Simplifier::rule_constant_to_right);
+            add_rule("subtract-constant", &Simplifier::rule_subtract_constant);
+            add_rule("subtract-from-zero", &Simplifier::rule_subtract_from_zero);
+            add_rule("identity", &Simplifier::rule_identity);
+            add_rule("annihilate", &Simplifier::rule_annihilate);
+            add_rule("times-minus-one", &Simplifier::rule_times_minus_one);
+            add_rule("same-operands", &Simplifier::rule_same_operands);
+            add_rule("double-negation", &Simplifier::rule_double_negation);
+            add_rule("not-of-comparison", &Simplifier::rule_not_of_comparison);
+            add_rule("compare-with-bool", &Simplifier::rule_compare_with_bool);
+            add_rule("reassociate", &Simplifier::rule_reassociate);
+        }
+
+        int total_rewrites()
+        {
+            int total = 0;
+            for(unsigned int i = 0; i < m_rules.size(); i++)
+                total += m_rules[i].m_count;
+            return total;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "simplify: %d rewrites\n", total_rewrites());
+            for(unsigned int i = 0; i < m_rules.size(); i++)
+                fprintf(out, "  %-20s %d\n", m_rules[i].m_name, m_rules[i].m_count);
+        }
+
+        void visitProgram(Program *p) { visit_list(p->m_func_list); }
+        void visitFunc(Func *p) { visit(p->m_function_block); }
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            visit_list(p->m_stat_list);
+            visit(p->m_return);
+        }
+        void visitNested_block(Nested_block *p) { visit_list(p->m_stat_list); }
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) { p->m_expr = simplify(p->m_expr); }
+
+        void visitAssignment(Assignment *p) { p->m_expr = simplify(p->m_expr); }
+        void visitArrayAssignment(ArrayAssignment *p)
+        {
+            p->m_expr_1 = simplify(p->m_expr_1);
+            p->m_expr_2 = simplify(p->m_expr_2);
+        }
+        void visitCall(Call *p)
+        {
+            list<Expr_ptr>::iterator expr_iter;
+            forall(expr_iter,p->m_expr_list){
+                *expr_iter = simplify(*expr_iter);
+            }
+        }
+        void visitArrayCall(ArrayCall *p)
+        {
+            p->m_expr_1 = simplify(p->m_expr_1);
+            list<Expr_ptr>::iterator expr_iter;
+            forall(expr_iter,p->m_expr_list_2){
+                *expr_iter = simplify(*expr_iter);
+            }
+        }
+        void visitIfNoElse(IfNoElse *p)
+        {
+            p->m_expr = simplify(p->m_expr);
+            visit(p->m_nested_block);
+        }
+        void visitIfWithElse(IfWithElse *p)
+        {
+            p->m_expr = simplify(p->m_expr);
+            visit(p->m_nested_block_1);
+            visit(p->m_nested_block_2);
+        }
+        void visitWhileLoop(WhileLoop *p)
+        {
+            p->m_expr = simplify(p->m_expr);
+            visit(p->m_nested_block);
+        }
+
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+
+        // Expressions: simplify the operands in place; simplify() then works on the node itself
+        void visitAnd(And *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitDiv(Div *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitCompare(Compare *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitGt(Gt *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitGteq(Gteq *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitLt(Lt *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitLteq(Lteq *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitMinus(Minus *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitNoteq(Noteq *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitOr(Or *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitPlus(Plus *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitTimes(Times *p) { p->m_expr_1 = simplify(p->m_expr_1); p->m_expr_2 = simplify(p->m_expr_2); }
+        void visitNot(Not *p) { p->m_expr = simplify(p->m_expr); }
+        void visitUminus(Uminus *p) { p->m_expr = simplify(p->m_expr); }
+        void visitMagnitude(Magnitude *p) { p->m_expr = simplify(p->m_expr); }
+        void visitArrayAccess(ArrayAccess *p) { p->m_expr = simplify(p->m_expr); }
+        void visitIdent(Ident *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
@@ -197,6 +197,17 @@ bool SymTab::insert_in_parent_scope( char* name, Symbol * s )
 	else return false;
 }
 
+bool SymTab::insert_in_scope( SymScope* targetscope, char* name, Symbol * s )
+{
+	assert( name != NULL );
+	assert( s != NULL );
+	assert( targetscope != NULL );
+	assert( is_dup_string(name) ); 
+	Symbol* r = targetscope->insert( name, s );
+	if ( r == NULL ) return true;
+	else return false;
+}
+
 Symbol* SymTab::lookup( const char * name )
 {
 	return lookup( m_cur_scope, name );
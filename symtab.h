@@ -145,6 +145,10 @@ class SymTab
   //(it will have an assert failure if there is no parent scope)
   bool insert_in_parent_scope( char* name, Symbol * s ); 
 
+  //does an insert into targetscope instead of the working scope,
+  //for passes that add variables after typecheck has finished
+  bool insert_in_scope( SymScope* targetscope, char* name, Symbol * s ); 
+
   //tries to locate name in the current scope and all
   //of the parent scopes
   Symbol* lookup( const char * name ); 
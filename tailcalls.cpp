@@ -0,0 +1,267 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "effects.h"
+#include <stdio.h>
+#include <set>
+#include <vector>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Self tail call elimination. A function returning r whose body ends (on some path) in a call
+ * to itself storing into r,
+ *     function int f(int p, int q) { S ... r = f(a, b); return r; }
+ * computes the same r by starting over with p = a and q = b. Without gotos in the AST the jump
+ * back to the entry is a loop:
+ *     _t0 = true;
+ *     while (_t0) { _t0 = false; S ... p = a; q = b; _t0 = true; }
+ *     return r;
+ * so the stack stays the same size however deep the recursion, and each level costs two
+ * assignments instead of a call. A call is in tail position if it is the last statement of the
+ * body, or the last statement of a branch of an If in tail position.
+ *
+ * The new parameter values are assigned in order. An argument reading a parameter that was
+ * already assigned is computed into a temporary first; an argument that is the parameter itself
+ * needs no assignment at all.
+ *
+ * Functions with nested functions (which may read the parameters) and functions taking an array
+ * that is passed on changed are left alone. With no recursive call left the function may no
+ * longer be recursive, so main.cpp rebuilds the call graph afterwards, which gives the inliner
+ * a chance at it.
+ */
+
+class TailCalls : public Visitor {
+    private:
+        SymTab* m_st;
+        CallGraph* m_cg;
+        SideEffects m_effects;
+
+        // statistics
+        int m_calls;
+        int m_functions;
+
+        // The tail calls of f at the end of stats that store into r
+        void tail_calls(list<Stat_ptr>* stats, FuncInfo* f, Symbol* r, vector<Call*>& calls)
+        {
+            if(stats->empty())
+                return;
+            Stat* last = stats->back();
+            if(Call* c = dynamic_cast<Call*>(last)){
+                if(m_cg->resolve(c->m_attribute.m_scope, c->m_symname_2->spelling()) == f &&
+                   m_effects.lookup(c, c->m_symname_1) == r)
+                    calls.push_back(c);
+            } else if(IfNoElse* i = dynamic_cast<IfNoElse*>(last)){
+                tail_calls(i->m_nested_block->m_stat_list, f, r, calls);
+            } else if(IfWithElse* i = dynamic_cast<IfWithElse*>(last)){
+                tail_calls(i->m_nested_block_1->m_stat_list, f, r, calls);
+                tail_calls(i->m_nested_block_2->m_stat_list, f, r, calls);
+            }
+        }
+
+        // Can call's arguments become the new values of f's parameters?
+        bool can_pass(Call* call, FuncInfo* f)
+        {
+            list<Param_ptr>::iterator param = f->m_func->m_param_list->begin();
+            list<Expr_ptr>::iterator arg;
+            forall(arg,call->m_expr_list){
+                Basetype type = (*param)->m_type->m_attribute.m_basetype;
+                if(type != bt_integer && type != bt_boolean && !passes_itself(*arg, *param))
+                    return false;
+                param++;
+            }
+            return true;
+        }
+
+        static bool passes_itself(Expr* arg, Param* param)
+        {
+            Ident* id = dynamic_cast<Ident*>(arg);
+            return id != NULL && strcmp(id->m_symname->spelling(), param->m_symname->spelling()) == 0;
+        }
+
+        Expr* make_ident(const char* name, Basetype type, Visitable* like)
+        {
+            Ident* id = new Ident(new SymName(copy_spelling(name)));
+            copy_attribute(id, like);
+            id->m_attribute.m_basetype = type;
+            id->m_attribute.m_lattice_elem = TOP;
+            return id;
+        }
+
+        Stat* make_assignment(const char* name, Expr* e, Visitable* like)
+        {
+            Stat* s = new Assignment(new SymName(copy_spelling(name)), e);
+            copy_attribute(s, like);
+            e->m_parent_attribute = &s->m_attribute;
+            return s;
+        }
+
+        // Replace the call (the last statement of stats) by the parameter assignments
+        void replace(list<Stat_ptr>* stats, Call* call, FuncInfo* f, const char* go)
+        {
+            list<Stat_ptr> out;
+            vector<Stat*> assigns;
+            set<Symbol*> assigned;
+            list<Param_ptr>::iterator param = f->m_func->m_param_list->begin();
+            list<Expr_ptr>::iterator arg;
+            forall(arg,call->m_expr_list){
+                if(passes_itself(*arg, *param)){
+                    delete *arg;
+                    param++;
+                    continue;
+                }
+                const char* name = (*param)->m_symname->spelling();
+                Expr* value = *arg;
+                set<Symbol*> read;
+                m_effects.reads(value, read);
+                if(SideEffects::intersect(read, assigned)){
+                    const char* temp = new_temporary(m_st, f->m_scope, value->m_attribute.m_basetype);
+                    out.push_back(make_assignment(temp, value, call));
+                    value = make_ident(temp, value->m_attribute.m_basetype, call);
+                }
+                assigns.push_back(make_assignment(name, value, call));
+                assigned.insert(m_st->lookup_single(f->m_scope, name));
+                param++;
+            }
+            call->m_expr_list->clear();
+            out.insert(out.end(), assigns.begin(), assigns.end());
+            out.push_back(make_assignment(go, make_literal(bt_boolean, 1, call), call));
+
+            stats->pop_back();
+            stats->splice(stats->end(), out);
+            delete call;
+        }
+
+        void process(FuncInfo* f)
+        {
+            Function_block* b = f->m_func->m_function_block;
+            if(!b->m_func_list->empty())
+                return;
+            Ident* ret = dynamic_cast<Ident*>(b->m_return->m_expr);
+            if(ret == NULL)
+                return;
+            Symbol* r = m_effects.lookup(ret, ret->m_symname);
+            vector<Call*> calls;
+            tail_calls(b->m_stat_list, f, r, calls);
+            for(unsigned i = 0; i < calls.size(); i++){
+                if(!can_pass(calls[i], f))
+                    return;
+            }
+            if(calls.empty())
+                return;
+
+            const char* go = new_temporary(m_st, f->m_scope, bt_boolean);
+            for(unsigned i = 0; i < calls.size(); i++){
+                Call* call = calls[i];
+                replace(find_list(b->m_stat_list, call), call, f, go);
+            }
+
+            // _t0 = true; while (_t0) { _t0 = false; body }
+            list<Stat_ptr>* body = new list<Stat_ptr>();
+            body->push_back(make_assignment(go, make_literal(bt_boolean, 0, ret), ret));
+            body->splice(body->end(), *b->m_stat_list);
+            Nested_block* block = new Nested_block(body);
+            copy_attribute(block, ret);
+            Expr* cond = make_ident(go, bt_boolean, ret);
+            WhileLoop* loop = new WhileLoop(cond, block);
+            copy_attribute(loop, ret);
+            loop->m_parent_attribute = &b->m_attribute;
+            cond->m_parent_attribute = block->m_parent_attribute = &loop->m_attribute;
+            list<Stat_ptr>::iterator iter;
+            forall(iter,body){
+                (*iter)->m_parent_attribute = &block->m_attribute;
+            }
+            b->m_stat_list->push_back(make_assignment(go, make_literal(bt_boolean, 1, ret), ret));
+            b->m_stat_list->back()->m_parent_attribute = &b->m_attribute;
+            b->m_stat_list->push_back(loop);
+
+            m_calls += calls.size();
+            m_functions++;
+        }
+
+        // The statement list in stats (or in a block nested in it) ending in s
+        static list<Stat_ptr>* find_list(list<Stat_ptr>* stats, Stat* s)
+        {
+            if(stats->empty())
+                return NULL;
+            if(stats->back() == s)
+                return stats;
+            vector<list<Stat_ptr>*> lists;
+            SideEffects::nested_lists(stats->back(), lists);
+            for(unsigned i = 0; i < lists.size(); i++){
+                if(list<Stat_ptr>* found = find_list(lists[i], s))
+                    return found;
+            }
+            return NULL;
+        }
+
+    public:
+        TailCalls(SymTab* st, CallGraph* cg, bool bounds_check) : m_effects(st, cg, bounds_check)
+        {
+            m_st = st;
+            m_cg = cg;
+            m_calls = m_functions = 0;
+        }
+
+        // Did we eliminate any call?
+        bool changed()
+        {
+            return m_calls != 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "tailcalls: %d self tail calls turned into loops in %d functions\n",
+                m_calls, m_functions);
+        }
+
+        void visitProgram(Program *p)
+        {
+            for(unsigned i = 0; i < m_cg->m_funcs.size(); i++)
+                process(m_cg->m_funcs[i]);
+        }
+
+        void visitFunc(Func *p) {}
+        void visitFunction_block(Function_block *p) {}
+        void visitNested_block(Nested_block *p) {}
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitIfNoElse(IfNoElse *p) {}
+        void visitIfWithElse(IfWithElse *p) {}
+        void visitWhileLoop(WhileLoop *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
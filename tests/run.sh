@@ -0,0 +1,55 @@
+#!/bin/sh
+# Compile, assemble and run each test program and check its exit status.
+#
+# Every tests/*.simple starts with a comment holding one or more lines
+#     run: STATUS [OPTIONS...]
+# Each compiles the program with OPTIONS and expects it to exit with STATUS: what Main returns,
+# modulo 256, or 128 plus the signal it died of (132 for the ud2 of a failed bounds check, 139 for
+# a segfault). The programs are 32-bit x86 and run without libc, so this needs as and ld that can
+# target i386.
+#
+# usage: tests/run.sh [COMPILER [TEST...]]     (default ./simple and every test)
+
+SIMPLE=${1:-./simple}
+[ $# -gt 0 ] && shift
+DIR=$(dirname "$0")
+TMP=${TMPDIR:-/tmp}/simple-check.$$
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+as --32 -o "$TMP/start.o" "$DIR/start.s" || exit 1
+
+[ $# -eq 0 ] && set -- "$DIR"/*.simple
+passed=0
+failed=0
+for test in "$@"; do
+	runs=$(sed -n 's/ *\$\].*//; s/^.*run: *\([0-9][0-9]*\)\(.*\)$/\1\2/p' "$test")
+	if [ -z "$runs" ]; then
+		echo "$test: no run: lines"
+		failed=$((failed + 1))
+		continue
+	fi
+	echo "$runs" | while read -r expected options; do
+		status=
+		if ! "$SIMPLE" $options < "$test" > "$TMP/prog.s" 2> "$TMP/err"; then
+			status="compile error: $(head -1 "$TMP/err")"
+		elif ! as --32 -o "$TMP/prog.o" "$TMP/prog.s" ||
+		     ! ld -m elf_i386 -o "$TMP/prog" "$TMP/start.o" "$TMP/prog.o"; then
+			status="assembly failed"
+		else
+			timeout 10 "$TMP/prog" > /dev/null 2>&1
+			status=$?
+		fi
+		if [ "$status" = "$expected" ]; then
+			echo "ok"
+		else
+			echo "FAIL $test ${options:-(no options)}: expected $expected, got $status" >&2
+			echo "fail"
+		fi
+	done > "$TMP/results"
+	passed=$((passed + $(grep -c '^ok' "$TMP/results")))
+	failed=$((failed + $(grep -c '^fail' "$TMP/results")))
+done
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
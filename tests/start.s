@@ -0,0 +1,7 @@
+# Entry point for the test programs: call Main and exit with its result as the status
+.globl _start
+_start:
+    call Main
+    mov %eax, %ebx
+    mov $1, %eax
+    int $0x80
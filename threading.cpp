@@ -0,0 +1,438 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "effects.h"
+#include <stdio.h>
+#include <set>
+#include <vector>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Jump threading. The AST is structured, so rather than retargeting jumps in a control flow
+ * graph this works on the Ifs themselves, with the same effect on the generated code: a test
+ * whose outcome is already known on the way to it is not made again.
+ *
+ * While walking a function we keep the conditions known to hold (or not to) at the current
+ * statement: the condition of each If we are inside, a While's condition at the start of its
+ * body and after the loop, and the parts of && (in a then-branch) and || (in an else-branch).
+ * A fact is forgotten as soon as a statement may write something it reads. An If whose
+ * condition follows from the facts is replaced by the branch it takes. Comparisons of the same
+ * expression against constants imply each other when the values they allow nest, so x > 5
+ * decides x > 0 and x <= 3.
+ *
+ * For an If followed by another If on a condition the first one decides,
+ *     if (c) { A } else { B }  S  if (c) { C } else { D }
+ * becomes
+ *     if (c) { A S C } else { B S D }
+ * as long as A, B and S leave c's variables alone. S is duplicated, so this is only done when S
+ * (and the second If, if it is only decided on one side) is at most max_duplicate statements
+ * and expression nodes. Chains of Ifs on the same condition fold into one.
+ *
+ * A condition that may trap is never dropped, so such Ifs are left alone.
+ */
+
+class JumpThreading : public Visitor {
+    private:
+        SideEffects m_effects;
+
+        // a condition known to have m_value; m_cond belongs to the tree and outlives the fact
+        struct Fact
+        {
+            Expr* m_cond;
+            bool m_value;
+            set<Symbol*> m_reads;
+        };
+        vector<Fact> m_facts;
+
+        static const int max_duplicate = 24;
+
+        // statistics
+        int m_decided;
+        int m_threaded;
+        int m_duplicated;
+
+        // The values of e where "e op c" has the given truth, for an int e and constant c
+        struct Range
+        {
+            long long m_lo, m_hi;
+            bool m_except;      // all values but m_lo (== m_hi)
+        };
+
+        bool range(Expr* cond, bool truth, Expr** e, Range* r)
+        {
+            BinaryOp op = binary_op(cond);
+            if(!is_comparison(op))
+                return false;
+            Expr** ops[2];
+            expr_operands(cond, ops);
+            int c;
+            if(!is_literal(*ops[1], &c) || (*ops[0])->m_attribute.m_basetype != bt_integer)
+                return false;
+            *e = *ops[0];
+            const long long min = -2147483647LL - 1, max = 2147483647LL;
+            r->m_except = false;
+            switch(truth ? op : negate_op(op)){
+                case op_lt: r->m_lo = min; r->m_hi = (long long) c - 1; break;
+                case op_le: r->m_lo = min; r->m_hi = c; break;
+                case op_gt: r->m_lo = (long long) c + 1; r->m_hi = max; break;
+                case op_ge: r->m_lo = c; r->m_hi = max; break;
+                case op_eq: r->m_lo = r->m_hi = c; break;
+                case op_ne: r->m_lo = r->m_hi = c; r->m_except = true; break;
+                default: break;
+            }
+            return true;
+        }
+
+        static bool subset(const Range& a, const Range& b)
+        {
+            if(!a.m_except && !b.m_except)
+                return b.m_lo <= a.m_lo && a.m_hi <= b.m_hi;
+            if(!a.m_except)
+                return b.m_lo < a.m_lo || b.m_lo > a.m_hi;
+            if(!b.m_except)
+                return false;
+            return a.m_lo == b.m_lo;
+        }
+
+        static bool disjoint(const Range& a, const Range& b)
+        {
+            if(!a.m_except && !b.m_except)
+                return a.m_hi < b.m_lo || b.m_hi < a.m_lo;
+            if(!a.m_except)
+                return a.m_lo == a.m_hi && a.m_lo == b.m_lo;
+            if(!b.m_except)
+                return b.m_lo == b.m_hi && b.m_lo == a.m_lo;
+            return false;
+        }
+
+        // Does fact having the given value decide q? If so, *value is q's value.
+        bool implies(Expr* fact, bool truth, Expr* q, bool* value)
+        {
+            if(expr_equal(fact, q)){
+                *value = truth;
+                return true;
+            }
+            if(Not* n = dynamic_cast<Not*>(fact))
+                return implies(n->m_expr, !truth, q, value);
+            if(And* a = dynamic_cast<And*>(fact))
+                return truth && (implies(a->m_expr_1, true, q, value) || implies(a->m_expr_2, true, q, value));
+            if(Or* o = dynamic_cast<Or*>(fact))
+                return !truth && (implies(o->m_expr_1, false, q, value) || implies(o->m_expr_2, false, q, value));
+            Expr* fe;
+            Expr* qe;
+            Range fr, qr;
+            if(!range(fact, truth, &fe, &fr) || !range(q, true, &qe, &qr) || !expr_equal(fe, qe))
+                return false;
+            if(subset(fr, qr)){
+                *value = true;
+                return true;
+            }
+            if(disjoint(fr, qr)){
+                *value = false;
+                return true;
+            }
+            return false;
+        }
+
+        // Is the value of q known here?
+        bool decided(Expr* q, bool* value)
+        {
+            int literal;
+            if(is_literal(q, &literal)){
+                *value = literal != 0;
+                return true;
+            }
+            for(unsigned i = 0; i < m_facts.size(); i++)
+                if(implies(m_facts[i].m_cond, m_facts[i].m_value, q, value))
+                    return true;
+            if(Not* n = dynamic_cast<Not*>(q)){
+                if(!decided(n->m_expr, value))
+                    return false;
+                *value = !*value;
+                return true;
+            }
+            BinaryOp op = binary_op(q);
+            if(op == op_and || op == op_or){
+                Expr** ops[2];
+                expr_operands(q, ops);
+                bool v1, v2;
+                bool d1 = decided(*ops[0], &v1);
+                bool d2 = decided(*ops[1], &v2);
+                bool absorbing = op == op_or;     // true for ||, false for &&
+                if((d1 && v1 == absorbing) || (d2 && v2 == absorbing)){
+                    *value = absorbing;
+                    return true;
+                }
+                if(d1 && d2){
+                    *value = !absorbing;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void add_fact(Expr* cond, bool value)
+        {
+            Fact f;
+            f.m_cond = cond;
+            f.m_value = value;
+            m_effects.reads(cond, f.m_reads);
+            m_facts.push_back(f);
+        }
+
+        void kill(Stat* s)
+        {
+            set<Symbol*> mods;
+            m_effects.stat_mods(s, mods);
+            vector<Fact>::iterator iter = m_facts.begin();
+            while(iter != m_facts.end()){
+                if(SideEffects::intersect(iter->m_reads, mods))
+                    iter = m_facts.erase(iter);
+                else
+                    iter++;
+            }
+        }
+
+        static Expr* if_cond(Stat* s)
+        {
+            if(IfNoElse* i = dynamic_cast<IfNoElse*>(s))
+                return i->m_expr;
+            if(IfWithElse* ie = dynamic_cast<IfWithElse*>(s))
+                return ie->m_expr;
+            return NULL;
+        }
+
+        // Move the statements of the branch the If s takes when its condition is outcome to the
+        // end of out, and delete s
+        static void take_branch(Stat* s, bool outcome, list<Stat_ptr>& out)
+        {
+            Nested_block* branch = NULL;
+            if(IfNoElse* i = dynamic_cast<IfNoElse*>(s))
+                branch = outcome ? i->m_nested_block : NULL;
+            else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(s))
+                branch = outcome ? ie->m_nested_block_1 : ie->m_nested_block_2;
+            if(branch != NULL)
+                out.splice(out.end(), *branch->m_stat_list);
+            delete s;
+        }
+
+        static void adopt(Nested_block* block)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,block->m_stat_list){
+                (*iter)->m_parent_attribute = &block->m_attribute;
+            }
+        }
+
+        // Merge the If at pos with a later one its condition decides; see the comment at the top
+        bool thread(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos)
+        {
+            Expr* cond = if_cond(*pos);
+            if(m_effects.may_trap(cond))
+                return false;
+            set<Symbol*> reads, mods;
+            m_effects.reads(cond, reads);
+            m_effects.stat_mods(*pos, mods);
+            if(SideEffects::intersect(reads, mods))
+                return false;
+
+            // find the If, checking what lies in between
+            list<Stat_ptr>::iterator next = pos;
+            int duplicate = 0;
+            bool known_then, known_else, value_then, value_else;
+            for(next++; next != stats->end(); next++){
+                Expr* c = if_cond(*next);
+                if(c != NULL && !m_effects.may_trap(c)){
+                    known_then = implies(cond, true, c, &value_then);
+                    known_else = implies(cond, false, c, &value_else);
+                    if(known_then || known_else)
+                        break;
+                }
+                set<Symbol*> m;
+                m_effects.stat_mods(*next, m);
+                list<Stat_ptr> single(1, *next);
+                duplicate += SideEffects::list_size(&single);
+                if(SideEffects::intersect(reads, m) || duplicate > max_duplicate)
+                    return false;
+            }
+            if(next == stats->end())
+                return false;
+            if(!known_then || !known_else){
+                list<Stat_ptr> single(1, *next);
+                duplicate += SideEffects::list_size(&single);
+                if(duplicate > max_duplicate)
+                    return false;
+            }
+
+            // the first If, as an IfWithElse
+            IfWithElse* first = dynamic_cast<IfWithElse*>(*pos);
+            if(first == NULL){
+                IfNoElse* i = (IfNoElse*) *pos;
+                Nested_block* empty = new Nested_block(new list<Stat_ptr>());
+                copy_attribute(empty, i->m_nested_block);
+                first = new IfWithElse(i->m_expr, i->m_nested_block, empty);
+                copy_attribute(first, i);
+                first->m_expr->m_parent_attribute = first->m_nested_block_1->m_parent_attribute =
+                    empty->m_parent_attribute = &first->m_attribute;
+                i->m_expr = NULL;
+                i->m_nested_block = NULL;
+                delete i;
+                *pos = first;
+            }
+            list<Stat_ptr>* then_stats = first->m_nested_block_1->m_stat_list;
+            list<Stat_ptr>* else_stats = first->m_nested_block_2->m_stat_list;
+
+            // what lies in between goes to both branches, the second If to the side it is decided on
+            list<Stat_ptr>::iterator iter = pos;
+            for(iter++; iter != next; iter++)
+                then_stats->push_back(SideEffects::copy_stat(*iter));
+            iter = pos;
+            iter++;
+            else_stats->splice(else_stats->end(), *stats, iter, next);
+            Stat* second = *next;
+            stats->erase(next);
+            Stat* second_copy = SideEffects::copy_stat(second);
+            if(known_then)
+                take_branch(second_copy, value_then, *then_stats);
+            else
+                then_stats->push_back(second_copy);
+            if(known_else)
+                take_branch(second, value_else, *else_stats);
+            else
+                else_stats->push_back(second);
+            adopt(first->m_nested_block_1);
+            adopt(first->m_nested_block_2);
+
+            m_threaded++;
+            m_duplicated += duplicate;
+            return true;
+        }
+
+        void process_stats(list<Stat_ptr>* stats)
+        {
+            list<Stat_ptr>::iterator iter = stats->begin();
+            while(iter != stats->end()){
+                Expr* cond = if_cond(*iter);
+                bool value;
+                if(cond != NULL && !m_effects.may_trap(cond) && decided(cond, &value)){
+                    // the statements of the branch taken are walked next
+                    list<Stat_ptr> taken;
+                    take_branch(*iter, value, taken);
+                    list<Stat_ptr>::iterator next = stats->erase(iter);
+                    iter = taken.empty() ? next : taken.begin();
+                    stats->splice(next, taken);
+                    m_decided++;
+                    continue;
+                }
+                if(cond != NULL)
+                    while(thread(stats, iter)) {}
+                visit(*iter);
+                kill(*iter);
+                // a loop is only left when its condition is false
+                if(WhileLoop* w = dynamic_cast<WhileLoop*>(*iter))
+                    add_fact(w->m_expr, false);
+                iter++;
+            }
+        }
+
+        void process_branch(Nested_block* block, Expr* cond, bool value)
+        {
+            vector<Fact> saved = m_facts;
+            add_fact(cond, value);
+            visit(block);
+            m_facts = saved;
+        }
+
+    public:
+        JumpThreading(SymTab* st, CallGraph* cg, bool bounds_check) : m_effects(st, cg, bounds_check)
+        {
+            m_decided = m_threaded = m_duplicated = 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "threading: %d ifs decided by earlier conditions, %d ifs threaded into an earlier one"
+                " (%d statements and expression nodes duplicated)\n", m_decided, m_threaded, m_duplicated);
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            vector<Fact> saved;
+            saved.swap(m_facts);
+            visit(p->m_function_block);
+            m_facts.swap(saved);
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            process_stats(p->m_stat_list);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            process_branch(p->m_nested_block, p->m_expr, true);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            process_branch(p->m_nested_block_1, p->m_expr, true);
+            process_branch(p->m_nested_block_2, p->m_expr, false);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            // facts the loop may change only hold on the first iteration
+            kill(p);
+            process_branch(p->m_nested_block, p->m_expr, true);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
@@ -0,0 +1,753 @@
+#include "ast.h"
+#include "primitive.h"
+#include "attribute.h"
+#include "symtab.h"
+#include "callgraph.h"
+#include "astutil.h"
+#include "effects.h"
+#include <stdio.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#define forall(iterator,listptr) \
+    for(iterator = listptr->begin(); iterator != listptr->end(); iterator++) \
+
+using namespace std;
+
+/*
+ * Local value numbering: an expression computed more than once while none of the variables it
+ * reads has changed is computed once, into a new temporary, and every occurrence reads that
+ * temporary instead. Codegen evaluates every subtree from scratch, so in
+ *     x = a[i+1] * a[i+1] + (i+1);
+ * i+1 and the array load would otherwise be evaluated two and three times.
+ *
+ * Each statement list is walked in order, keeping in m_avail the expressions computed so far
+ * whose operands haven't been written since:
+ *   * x = e and a[i] = e make e (and i) available, then kill whatever reads x (or a).
+ *   * A call makes its arguments available, then kills its result variable and everything the
+ *     callee may write (the mod summary from "callgraph.h").
+ *   * An If's condition is available in both branches; each branch continues from what was
+ *     available before it, and afterwards whatever either branch may write is killed.
+ *   * A While first kills whatever its body may write; what is left has the same value on every
+ *     iteration and stays available throughout the loop. The condition is evaluated again each
+ *     time round, so of the expressions in it only those reading nothing the body writes are
+ *     made available: a temporary for any other would be computed once, before the loop.
+ *   * The Return expression continues the function's top-level statement list.
+ *   * "_tN = e", as inserted by PartialRedundancyElimination below, makes e available in _tN
+ *     straight away, unless e reads _tN. Temporaries are written again by the loop passes
+ *     (induction variables are bumped, unrolled bodies define them again), so that first kills
+ *     whatever reads _tN or was available in it.
+ * Expressions are compared structurally, after their operands have been numbered, so a[i+1]
+ * matches a[i+1] even once both i+1 have become the same temporary.
+ *
+ * The temporary is only made when the second occurrence is found: "_tN = e" is inserted right
+ * before the statement holding the first occurrence, which then reads _tN too. That statement
+ * evaluated e before doing anything else (there is no short-circuit evaluation), so this never
+ * changes whether or where a division traps. When a whole expression matches, its operands
+ * aren't given temporaries of their own. Only expressions of at least three nodes are worth a
+ * temporary: storing one and loading it back costs about as much as recomputing x+1 or a[i].
+ *
+ * Temporaries are named "_tN", which the lexer can never produce, and are added to the scope of
+ * the function that uses them, so codegen gives them a stack slot like any other local.
+ */
+
+class LocalValueNumbering : public Visitor {
+    private:
+        SymTab* m_st;
+        SideEffects m_effects;
+
+        // An expression which is available, and where it was first computed
+        struct Available
+        {
+            Expr** m_slot;                      // the field holding it
+            list<Stat_ptr>* m_stats;            // the statement list evaluating it...
+            list<Stat_ptr>::iterator m_anchor;  // ...at this statement (end() for the Return)
+            Visitable* m_like;                  // that statement, to take attributes from
+            set<Symbol*> m_reads;
+            string m_temp;                      // its temporary, once it has one
+        };
+        typedef vector<Available*> Table;
+        Table m_avail;
+        vector<Available*> m_all;               // every Available made in the current function
+
+        SymScope* m_scope;                      // scope of the current function, for temporaries
+        list<Stat_ptr>* m_stats;                // where the current statement is
+        list<Stat_ptr>::iterator m_anchor;
+        Visitable* m_like;
+        set<Symbol*>* m_loop_mods;              // while numbering a loop condition, what the body writes
+
+        static const int min_size = 3;
+
+        // statistics
+        int m_temp_count;
+        int m_replaced;
+        int m_nodes_removed;
+
+        void kill(const set<Symbol*>& mods)
+        {
+            Table::iterator iter = m_avail.begin();
+            while(iter != m_avail.end()){
+                if(SideEffects::intersect((*iter)->m_reads, mods))
+                    iter = m_avail.erase(iter);
+                else
+                    iter++;
+            }
+        }
+
+        void kill(Symbol* s)
+        {
+            set<Symbol*> mods;
+            mods.insert(s);
+            kill(mods);
+        }
+
+        bool is_candidate(Expr* e)
+        {
+            Basetype type = e->m_attribute.m_basetype;
+            return (type == bt_integer || type == bt_boolean) && expr_size(e) >= min_size;
+        }
+
+        Available* find(Expr* e)
+        {
+            Table::iterator iter;
+            forall(iter,(&m_avail)){
+                if((*iter)->m_slot != NULL && expr_equal(*(*iter)->m_slot, e))
+                    return *iter;
+            }
+            return NULL;
+        }
+
+        void add(Expr** slot)
+        {
+            set<Symbol*> reads;
+            m_effects.reads(*slot, reads);
+            if(m_loop_mods != NULL && SideEffects::intersect(reads, *m_loop_mods))
+                return;
+            Available* a = new Available;
+            a->m_slot = slot;
+            a->m_stats = m_stats;
+            a->m_anchor = m_anchor;
+            a->m_like = m_like;
+            a->m_reads.swap(reads);
+            m_avail.push_back(a);
+            m_all.push_back(a);
+        }
+
+        // Is slot one of the fields inside the expression e?
+        bool contains(Expr* e, Expr** slot)
+        {
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            for(int i = 0; i < n; i++)
+                if(ops[i] == slot || contains(*ops[i], slot))
+                    return true;
+            return false;
+        }
+
+        // Compute a into a new temporary just before the statement that first computed it
+        void promote(Available* a)
+        {
+            Expr* e = *a->m_slot;
+            const char* name = new_temporary(m_st, m_scope, e->m_attribute.m_basetype);
+            m_temp_count++;
+
+            Ident* temp = make_ident(name, e);
+            Stat* def = new Assignment(new SymName(copy_spelling(name)), e);
+            copy_attribute(def, a->m_like);
+            list<Stat_ptr>::iterator def_iter = a->m_stats->insert(a->m_anchor, def);
+            *a->m_slot = temp;
+
+            // what was available inside e is now computed by def
+            vector<Available*>::iterator iter;
+            forall(iter,(&m_all)){
+                if(contains(e, (*iter)->m_slot)){
+                    (*iter)->m_anchor = def_iter;
+                    (*iter)->m_like = def;
+                }
+            }
+            a->m_slot = &((Assignment*) def)->m_expr;
+            a->m_anchor = def_iter;
+            a->m_like = def;
+            a->m_temp = name;
+        }
+
+        Ident* make_ident(const char* name, Expr* like)
+        {
+            Ident* id = new Ident(new SymName(copy_spelling(name)));
+            copy_attribute(id, like);
+            id->m_attribute.m_basetype = like->m_attribute.m_basetype;
+            id->m_attribute.m_lattice_elem = TOP;
+            return id;
+        }
+
+        // Replace the expression in slot, which computes the same value as a, with a's temporary
+        void replace(Expr** slot, Available* a)
+        {
+            if(a->m_temp.empty())
+                promote(a);
+            Expr* old = *slot;
+            *slot = make_ident(a->m_temp.c_str(), old);
+
+            // nothing inside old should be available (it would have matched), but make sure
+            vector<Available*>::iterator iter;
+            forall(iter,(&m_all)){
+                if(contains(old, (*iter)->m_slot)){
+                    (*iter)->m_slot = NULL;
+                    kill_available(*iter);
+                }
+            }
+
+            m_replaced++;
+            m_nodes_removed += expr_size(old) - 1;
+            delete old;
+        }
+
+        void kill_available(Available* a)
+        {
+            Table::iterator iter = m_avail.begin();
+            while(iter != m_avail.end()){
+                if(*iter == a)
+                    iter = m_avail.erase(iter);
+                else
+                    iter++;
+            }
+        }
+
+        // Number the expression in slot and its operands. If it matches an available expression
+        // without a temporary yet, that is returned instead of being replaced, since an enclosing
+        // expression may match as a whole.
+        Available* number(Expr** slot)
+        {
+            Expr* e = *slot;
+            Expr** ops[2];
+            int n = expr_operands(e, ops);
+            Available* matched[2] = { NULL, NULL };
+            for(int i = 0; i < n; i++)
+                matched[i] = number(ops[i]);
+
+            if(is_candidate(e)){
+                Available* a = find(e);
+                if(a != NULL && a->m_temp.empty())
+                    return a;
+                if(a != NULL){
+                    replace(slot, a);
+                    return NULL;
+                }
+            }
+            for(int i = 0; i < n; i++)
+                if(matched[i] != NULL)
+                    replace(ops[i], matched[i]);
+            if(is_candidate(e))
+                add(slot);
+            return NULL;
+        }
+
+        void value(Expr** slot)
+        {
+            Available* a = number(slot);
+            if(a != NULL)
+                replace(slot, a);
+        }
+
+        void value_list(list<Expr_ptr>* exprs)
+        {
+            list<Expr_ptr>::iterator iter;
+            forall(iter,exprs){
+                value(&*iter);
+            }
+        }
+
+        void process_stats(list<Stat_ptr>* stats)
+        {
+            list<Stat_ptr>* saved_stats = m_stats;
+            list<Stat_ptr>::iterator saved_anchor = m_anchor;
+            Visitable* saved_like = m_like;
+
+            m_stats = stats;
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                m_anchor = iter;
+                m_like = *iter;
+                visit(*iter);
+            }
+
+            m_stats = saved_stats;
+            m_anchor = saved_anchor;
+            m_like = saved_like;
+        }
+
+        // A branch starts from what is available before it, and what it adds isn't available after
+        void process_block(Nested_block* block, Table& before)
+        {
+            m_avail = before;
+            process_stats(block->m_stat_list);
+        }
+
+    public:
+        LocalValueNumbering(SymTab* st, CallGraph* cg, bool bounds_check) : m_effects(st, cg, bounds_check)
+        {
+            m_st = st;
+            m_scope = NULL;
+            m_stats = NULL;
+            m_like = NULL;
+            m_loop_mods = NULL;
+            m_temp_count = 0;
+            m_replaced = m_nodes_removed = 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "lvn: %d temporaries, %d redundant expressions replaced (%d expression nodes)\n",
+                m_temp_count, m_replaced, m_nodes_removed);
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            SymScope* saved_scope = m_scope;
+            Table saved_avail;
+            saved_avail.swap(m_avail);
+            vector<Available*> saved_all;
+            saved_all.swap(m_all);
+
+            m_scope = p->m_function_block->m_attribute.m_scope;
+            visit(p->m_function_block);
+
+            vector<Available*>::iterator iter;
+            forall(iter,(&m_all)){
+                delete *iter;
+            }
+            m_scope = saved_scope;
+            m_avail.swap(saved_avail);
+            m_all.swap(saved_all);
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            m_avail.clear();
+            process_stats(p->m_stat_list);
+
+            m_stats = p->m_stat_list;
+            m_anchor = p->m_stat_list->end();
+            // Return declares its own m_attribute, which copy_attribute can't see; its
+            // expression was typechecked in the same scope
+            m_like = p->m_return->m_expr;
+            value(&p->m_return->m_expr);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+
+        void visitAssignment(Assignment *p)
+        {
+            value(&p->m_expr);
+            Symbol* target = m_effects.lookup(p, p->m_symname);
+            kill(target);
+            if(is_temporary(p->m_symname->spelling())){
+                // its expression is available in it from here on, until it is written again
+                Table::iterator iter = m_avail.begin();
+                while(iter != m_avail.end()){
+                    if((*iter)->m_temp == p->m_symname->spelling())
+                        iter = m_avail.erase(iter);
+                    else
+                        iter++;
+                }
+                Available* a = find(p->m_expr);
+                if(a != NULL && a->m_slot == &p->m_expr && a->m_temp.empty())
+                    a->m_temp = p->m_symname->spelling();
+            }
+        }
+
+        void visitArrayAssignment(ArrayAssignment *p)
+        {
+            value(&p->m_expr_1);
+            value(&p->m_expr_2);
+            kill(m_effects.lookup(p, p->m_symname));
+        }
+
+        // codegen evaluates the index of an ArrayCall before the arguments, and both before the call
+        void visitCall(Call *p)
+        {
+            value_list(p->m_expr_list);
+            set<Symbol*> mods;
+            mods.insert(m_effects.lookup(p, p->m_symname_1));
+            m_effects.call_mods(p, p->m_symname_2, mods);
+            kill(mods);
+        }
+
+        void visitArrayCall(ArrayCall *p)
+        {
+            value(&p->m_expr_1);
+            value_list(p->m_expr_list_2);
+            set<Symbol*> mods;
+            mods.insert(m_effects.lookup(p, p->m_symname_1));
+            m_effects.call_mods(p, p->m_symname_2, mods);
+            kill(mods);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            value(&p->m_expr);
+            Table before = m_avail;
+            process_block(p->m_nested_block, before);
+            m_avail = before;
+            set<Symbol*> mods;
+            m_effects.list_mods(p->m_nested_block->m_stat_list, mods);
+            kill(mods);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            value(&p->m_expr);
+            Table before = m_avail;
+            process_block(p->m_nested_block_1, before);
+            process_block(p->m_nested_block_2, before);
+            m_avail = before;
+            set<Symbol*> mods;
+            m_effects.list_mods(p->m_nested_block_1->m_stat_list, mods);
+            m_effects.list_mods(p->m_nested_block_2->m_stat_list, mods);
+            kill(mods);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            set<Symbol*> mods;
+            m_effects.list_mods(p->m_nested_block->m_stat_list, mods);
+            kill(mods);
+            set<Symbol*>* saved_mods = m_loop_mods;
+            m_loop_mods = &mods;
+            value(&p->m_expr);
+            m_loop_mods = saved_mods;
+            Table before = m_avail;
+            process_block(p->m_nested_block, before);
+            m_avail = before;
+        }
+
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+
+        // Expressions are numbered by number(), not visited
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};
+
+/*
+ * Partial redundancy elimination across branches and loops. LocalValueNumbering only reuses a
+ * value along the way it was computed: into both arms of an If and through a loop, but never
+ * out of them. This pass moves computations up out of If and While statements so that it can:
+ *   * An expression computed in both arms of an IfWithElse, each time before its operands may
+ *     be written in that arm, is computed once before the If.
+ *   * An expression computed anywhere inside an If or While whose operands it doesn't write,
+ *     and again right after it (before its operands may be written), is computed once before
+ *     the statement. Inside the statement it was only partially redundant; now it is fully.
+ * Both insert "_tN = e" before the statement and leave the rest to LocalValueNumbering, which
+ * then finds e available in _tN everywhere it was computed.
+ *
+ * Statement lists are processed innermost first, so an expression hoisted out of an inner If
+ * can be hoisted out of the outer one as well. Nothing is hoisted that is already available
+ * before the statement, or that is only part of another hoisted expression.
+ *
+ * A hoisted expression is always computed on every path that reached it before, but now earlier.
+ * That is only observable if it traps and something in between might not return (a call or a
+ * loop), so a division is hoisted out of both arms only when nothing like that comes before it,
+ * and never out of a statement it was only partially redundant with.
+ */
+
+class PartialRedundancyElimination : public Visitor {
+    private:
+        SymTab* m_st;
+        SideEffects m_effects;
+        SymScope* m_scope;
+
+        static const int min_size = 3;  // the same as LocalValueNumbering's
+
+        // statistics
+        int m_hoisted_from_arms;
+        int m_hoisted_partial;
+        int m_evaluations_removed;
+
+        void candidates(Expr* e, vector<Expr*>& out)
+        {
+            m_effects.subexpressions(e, min_size, out);
+        }
+
+        int count(vector<Expr*>& exprs, Expr* e)
+        {
+            return SideEffects::count_equal(exprs, e);
+        }
+
+        // The expressions available before the statement at pos in stats
+        void available(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos, vector<Expr*>& out)
+        {
+            list<Stat_ptr>::iterator iter;
+            for(iter = stats->begin(); iter != pos; iter++){
+                vector<Expr*> exprs;
+                m_effects.evaluated(*iter, exprs);
+                vector<Expr*>::iterator e;
+                forall(e,(&exprs)){
+                    candidates(*e, out);
+                }
+                set<Symbol*> mods;
+                m_effects.stat_mods(*iter, mods);
+                vector<Expr*>::iterator a = out.begin();
+                while(a != out.end()){
+                    set<Symbol*> reads;
+                    m_effects.reads(*a, reads);
+                    if(SideEffects::intersect(reads, mods))
+                        a = out.erase(a);
+                    else
+                        a++;
+                }
+            }
+        }
+
+        // Is e the same as one of the expressions in exprs, or part of one?
+        bool covered(vector<Expr*>& exprs, Expr* e)
+        {
+            vector<Expr*>::iterator iter;
+            forall(iter,(&exprs)){
+                vector<Expr*> parts;
+                candidates(*iter, parts);
+                if(count(parts, e) != 0)
+                    return true;
+            }
+            return false;
+        }
+
+        struct Hoist
+        {
+            Expr* m_expr;
+            int m_removed;      // how many computations of it that saves
+            bool m_from_arms;
+        };
+
+        void choose(vector<Hoist>& hoist, Expr* e, int removed, bool from_arms)
+        {
+            for(unsigned i = 0; i < hoist.size(); i++){
+                if(expr_equal(hoist[i].m_expr, e)){
+                    if(removed > hoist[i].m_removed) hoist[i].m_removed = removed;
+                    return;
+                }
+            }
+            Hoist h;
+            h.m_expr = e;
+            h.m_removed = removed;
+            h.m_from_arms = from_arms;
+            hoist.push_back(h);
+        }
+
+        // Hoist what can be hoisted out of the statement at pos in stats (followed by ret)
+        void hoist_from(list<Stat_ptr>* stats, list<Stat_ptr>::iterator pos, Expr* ret)
+        {
+            Stat* s = *pos;
+            vector<list<Stat_ptr>*> blocks;
+            if(IfNoElse* i = dynamic_cast<IfNoElse*>(s)){
+                blocks.push_back(i->m_nested_block->m_stat_list);
+            } else if(IfWithElse* ie = dynamic_cast<IfWithElse*>(s)){
+                blocks.push_back(ie->m_nested_block_1->m_stat_list);
+                blocks.push_back(ie->m_nested_block_2->m_stat_list);
+            } else if(WhileLoop* w = dynamic_cast<WhileLoop*>(s)){
+                blocks.push_back(w->m_nested_block->m_stat_list);
+            } else {
+                return;
+            }
+
+            vector<Hoist> hoist;
+            vector<Expr*>::iterator e;
+
+            // computed in both arms
+            if(blocks.size() == 2){
+                vector<Expr*> arm1, arm2;
+                m_effects.anticipated(blocks[0]->begin(), blocks[0]->end(), NULL, true, min_size, arm1);
+                m_effects.anticipated(blocks[1]->begin(), blocks[1]->end(), NULL, true, min_size, arm2);
+                forall(e,(&arm1)){
+                    int n2 = count(arm2, *e);
+                    if(n2 != 0)
+                        choose(hoist, *e, count(arm1, *e) + n2 - 1, true);
+                }
+            }
+
+            // computed inside, and again after
+            set<Symbol*> mods;
+            m_effects.stat_mods(s, mods);
+            vector<Expr*> inside, after;
+            for(unsigned b = 0; b < blocks.size(); b++)
+                m_effects.evaluated_anywhere(blocks[b], inside);
+            vector<Expr*> inside_cands;
+            forall(e,(&inside)){
+                candidates(*e, inside_cands);
+            }
+            list<Stat_ptr>::iterator next = pos;
+            next++;
+            m_effects.anticipated(next, stats->end(), ret, false, min_size, after);
+            forall(e,(&after)){
+                int n = count(inside_cands, *e);
+                if(n == 0)
+                    continue;
+                set<Symbol*> reads;
+                m_effects.reads(*e, reads);
+                if(!SideEffects::intersect(reads, mods))
+                    choose(hoist, *e, n + count(after, *e) - 1, false);
+            }
+            if(hoist.empty())
+                return;
+
+            // biggest first, so the parts of one aren't hoisted separately
+            vector<Expr*> avail, done;
+            available(stats, pos, avail);
+            for(unsigned i = 0; i < hoist.size(); i++){
+                unsigned biggest = i;
+                for(unsigned j = i + 1; j < hoist.size(); j++)
+                    if(expr_size(hoist[j].m_expr) > expr_size(hoist[biggest].m_expr))
+                        biggest = j;
+                swap(hoist[i], hoist[biggest]);
+
+                Expr* expr = hoist[i].m_expr;
+                if(count(avail, expr) != 0 || covered(done, expr))
+                    continue;
+                done.push_back(expr);
+
+                Expr* value = copy_expr(expr);
+                const char* name = new_temporary(m_st, m_scope, value->m_attribute.m_basetype);
+                Stat* def = new Assignment(new SymName(copy_spelling(name)), value);
+                copy_attribute(def, s);
+                stats->insert(pos, def);
+
+                if(hoist[i].m_from_arms)
+                    m_hoisted_from_arms++;
+                else
+                    m_hoisted_partial++;
+                m_evaluations_removed += hoist[i].m_removed;
+            }
+        }
+
+        void process_stats(list<Stat_ptr>* stats, Expr* ret)
+        {
+            list<Stat_ptr>::iterator iter;
+            forall(iter,stats){
+                visit(*iter);   // the nested blocks first
+            }
+            forall(iter,stats){
+                hoist_from(stats, iter, ret);
+            }
+        }
+
+    public:
+        PartialRedundancyElimination(SymTab* st, CallGraph* cg, bool bounds_check) : m_effects(st, cg, bounds_check)
+        {
+            m_st = st;
+            m_scope = NULL;
+            m_hoisted_from_arms = m_hoisted_partial = m_evaluations_removed = 0;
+        }
+
+        void print_stats(FILE* out)
+        {
+            fprintf(out, "pre: %d expressions hoisted out of both arms of an if, %d out of a branch or loop"
+                " they were partially redundant with (%d evaluations removed)\n",
+                m_hoisted_from_arms, m_hoisted_partial, m_evaluations_removed);
+        }
+
+        void visitProgram(Program *p)
+        {
+            visit_list(p->m_func_list);
+        }
+
+        void visitFunc(Func *p)
+        {
+            SymScope* saved_scope = m_scope;
+            m_scope = p->m_function_block->m_attribute.m_scope;
+            visit(p->m_function_block);
+            m_scope = saved_scope;
+        }
+
+        void visitFunction_block(Function_block *p)
+        {
+            visit_list(p->m_func_list);
+            process_stats(p->m_stat_list, p->m_return->m_expr);
+        }
+
+        void visitNested_block(Nested_block *p)
+        {
+            process_stats(p->m_stat_list, NULL);
+        }
+
+        void visitIfNoElse(IfNoElse *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitIfWithElse(IfWithElse *p)
+        {
+            visit(p->m_nested_block_1);
+            visit(p->m_nested_block_2);
+        }
+
+        void visitWhileLoop(WhileLoop *p)
+        {
+            visit(p->m_nested_block);
+        }
+
+        void visitParam(Param *p) {}
+        void visitDecl(Decl *p) {}
+        void visitReturn(Return *p) {}
+        void visitAssignment(Assignment *p) {}
+        void visitArrayAssignment(ArrayAssignment *p) {}
+        void visitCall(Call *p) {}
+        void visitArrayCall(ArrayCall *p) {}
+        void visitTInt(TInt *p) {}
+        void visitTBool(TBool *p) {}
+        void visitTIntArray(TIntArray *p) {}
+        void visitAnd(And *p) {}
+        void visitDiv(Div *p) {}
+        void visitCompare(Compare *p) {}
+        void visitGt(Gt *p) {}
+        void visitGteq(Gteq *p) {}
+        void visitLt(Lt *p) {}
+        void visitLteq(Lteq *p) {}
+        void visitMinus(Minus *p) {}
+        void visitNoteq(Noteq *p) {}
+        void visitOr(Or *p) {}
+        void visitPlus(Plus *p) {}
+        void visitTimes(Times *p) {}
+        void visitNot(Not *p) {}
+        void visitUminus(Uminus *p) {}
+        void visitMagnitude(Magnitude *p) {}
+        void visitIdent(Ident *p) {}
+        void visitArrayAccess(ArrayAccess *p) {}
+        void visitIntLit(IntLit *p) {}
+        void visitBoolLit(BoolLit *p) {}
+        void visitSymName(SymName *p) {}
+        void visitPrimitive(Primitive *p) {}
+};